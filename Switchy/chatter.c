@@ -0,0 +1,172 @@
+#include "chatter.h"
+#include <string.h>
+#include "checked.h"
+
+
+void Chatter_Init(ChatterFilter* filter)
+{
+	memset(filter, 0, sizeof(*filter));
+	for (int vkCode = 0; vkCode < 256; vkCode++)
+	{
+		filter->keys[vkCode].threshold = CHATTER_DEFAULT_BUCKET;
+	}
+}
+
+
+void Chatter_ResetKeys(ChatterFilter* filter)
+{
+	for (int vkCode = 0; vkCode < 256; vkCode++)
+	{
+		filter->keys[vkCode].down = 0;
+		filter->keys[vkCode].released = 0;
+		filter->keys[vkCode].dropUp = 0;
+	}
+}
+
+
+static int Bucket(uint32_t interval)
+{
+	int bucket = 0;
+	while (interval != 0 && bucket < CHATTER_BUCKETS - 1)
+	{
+		interval >>= 1;
+		bucket++;
+	}
+	return bucket;
+}
+
+
+// Just past the bounces: the first bucket above the bounce peak with few
+// intervals in it. Keys that don't bounce get the lowest threshold.
+static void Learn(ChatterKey* key)
+{
+	int peak = 0;
+	for (int bucket = 1; bucket < CHATTER_MAX_BUCKET; bucket++)
+	{
+		if (key->histogram[bucket] > key->histogram[peak])
+		{
+			peak = bucket;
+		}
+	}
+
+	int threshold = CHATTER_MIN_BUCKET;
+	uint16_t bounces = key->histogram[peak];
+	if (bounces >= CHATTER_MIN_BOUNCES && bounces >= key->samples / 64)
+	{
+		threshold = peak + 1;
+		while (threshold < CHATTER_MAX_BUCKET && key->histogram[threshold] > bounces / 8)
+		{
+			threshold++;
+		}
+	}
+	key->threshold = (uint8_t)(threshold < CHATTER_MIN_BUCKET ? CHATTER_MIN_BUCKET : threshold);
+	key->sinceLearned = 0;
+}
+
+
+static void Record(ChatterKey* key, uint32_t interval)
+{
+	key->histogram[Bucket(interval)]++;
+	if (++key->samples == CHATTER_HISTORY)
+	{
+		// Odd counts round down, so the total is counted again
+		key->samples = 0;
+		for (int bucket = 0; bucket < CHATTER_BUCKETS; bucket++)
+		{
+			key->histogram[bucket] /= 2;
+			key->samples += key->histogram[bucket];
+		}
+	}
+	if (++key->sinceLearned >= CHATTER_LEARN_EVERY && key->samples >= CHATTER_LEARN_AFTER)
+	{
+		Learn(key);
+	}
+}
+
+
+static uint32_t ThresholdOf(const ChatterKey* key)
+{
+	return key->threshold ? 1u << (key->threshold - 1) : 0;
+}
+
+
+int Chatter_OnKey(ChatterFilter* filter, uint8_t vkCode, int down, uint32_t time)
+{
+	ChatterKey* key = &filter->keys[vkCode];
+	if (!down)
+	{
+		int drop = key->dropUp;
+		key->down = 0;
+		key->dropUp = 0;
+		key->released = 1;
+		key->lastUp = time;
+		filter->dropped += drop;
+		return drop;
+	}
+
+	// Auto-repeat of a held key, dropped along with a dropped press
+	if (key->down)
+	{
+		filter->dropped += key->dropUp;
+		return key->dropUp;
+	}
+
+	key->down = 1;
+	if (key->released)
+	{
+		// The clock wraps every 49.7 days; unsigned subtraction handles it
+		uint32_t interval = time - key->lastUp;
+		Record(key, interval);
+		if (interval < ThresholdOf(key))
+		{
+			key->dropUp = 1;
+			filter->dropped++;
+			return 1;
+		}
+	}
+	return 0;
+}
+
+
+uint32_t Chatter_Threshold(const ChatterFilter* filter, uint8_t vkCode)
+{
+	return ThresholdOf(&filter->keys[vkCode]);
+}
+
+
+void Chatter_Save(const ChatterFilter* filter, ChatterLearned* learned)
+{
+	memset(learned, 0, 256 * sizeof(ChatterLearned));
+	for (int vkCode = 0; vkCode < 256; vkCode++)
+	{
+		const ChatterKey* key = &filter->keys[vkCode];
+		memcpy(learned[vkCode].histogram, key->histogram, sizeof(key->histogram));
+		learned[vkCode].samples = key->samples;
+		learned[vkCode].threshold = key->threshold;
+	}
+}
+
+
+void Chatter_Restore(ChatterFilter* filter, const ChatterLearned* learned)
+{
+	for (int vkCode = 0; vkCode < 256; vkCode++)
+	{
+		const ChatterLearned* saved = &learned[vkCode];
+		uint32_t total = 0;
+		for (int bucket = 0; bucket < CHATTER_BUCKETS; bucket++)
+		{
+			total += saved->histogram[bucket];
+		}
+		if (saved->threshold < CHATTER_MIN_BUCKET || saved->threshold > CHATTER_MAX_BUCKET ||
+			saved->samples >= CHATTER_HISTORY || total != saved->samples)
+		{
+			continue;
+		}
+
+		ChatterKey* key = &filter->keys[vkCode];
+		memcpy(key->histogram, saved->histogram, sizeof(key->histogram));
+		key->samples = saved->samples;
+		key->threshold = saved->threshold;
+		key->sinceLearned = 0;
+	}
+}
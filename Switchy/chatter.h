@@ -0,0 +1,67 @@
+#pragma once
+#include <stddef.h>
+#include <stdint.h>
+
+// Debounce for worn keyboards whose contacts bounce: one press arrives as
+// down, up, down, up within a few milliseconds. A press that follows the
+// release of the same key sooner than the key's chatter threshold is
+// dropped together with its release. The threshold is learned per key from
+// a histogram of release-to-press intervals on a log2 millisecond scale:
+// bounces form a group of their own far below real presses, and the
+// threshold is put just past it. Each event costs a few operations; the
+// histogram is rescanned every CHATTER_LEARN_EVERY intervals.
+
+// Bucket 0 holds intervals of 0 ms, bucket b > 0 holds [2^(b-1), 2^b) ms
+#define CHATTER_BUCKETS 16
+// Until a key has enough intervals, presses within 8 ms are bounces
+#define CHATTER_DEFAULT_BUCKET 4
+// The learned threshold stays between 4 and 32 ms: no finger is that fast
+#define CHATTER_MIN_BUCKET 3
+#define CHATTER_MAX_BUCKET 6
+// Fewer intervals than this in the bounce peak are not a worn key
+#define CHATTER_MIN_BOUNCES 4
+#define CHATTER_LEARN_AFTER 64
+#define CHATTER_LEARN_EVERY 32
+// Counts are halved at this many intervals, so old ones fade out
+#define CHATTER_HISTORY 1024
+
+typedef struct {
+	uint16_t histogram[CHATTER_BUCKETS];
+	uint16_t samples;
+	uint16_t sinceLearned;
+	uint32_t lastUp;
+	// Presses within [0, 2^(threshold-1)) ms of a release are bounces
+	uint8_t threshold;
+	uint8_t down;
+	uint8_t released;
+	// The press was dropped, so is its release
+	uint8_t dropUp;
+} ChatterKey;
+
+typedef struct {
+	ChatterKey keys[256];
+	uint32_t dropped;
+} ChatterFilter;
+
+// What a key has learned, kept across restarts
+typedef struct {
+	uint16_t histogram[CHATTER_BUCKETS];
+	uint16_t samples;
+	uint8_t threshold;
+	uint8_t reserved;
+} ChatterLearned;
+
+void Chatter_Init(ChatterFilter* filter);
+// Forgets which keys are down, e.g. after events were missed, keeping what
+// was learned
+void Chatter_ResetKeys(ChatterFilter* filter);
+// `time` is the event time in milliseconds (KBDLLHOOKSTRUCT.time).
+// Returns 1 if the event is a bounce and must be dropped.
+int Chatter_OnKey(ChatterFilter* filter, uint8_t vkCode, int down, uint32_t time);
+// Copies what every key has learned to or from 256 entries of `learned`.
+// Entries that are out of range, like those of a key never learned, leave
+// the key at its defaults.
+void Chatter_Save(const ChatterFilter* filter, ChatterLearned* learned);
+void Chatter_Restore(ChatterFilter* filter, const ChatterLearned* learned);
+// Current threshold of a key in milliseconds
+uint32_t Chatter_Threshold(const ChatterFilter* filter, uint8_t vkCode);
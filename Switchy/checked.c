@@ -0,0 +1,82 @@
+#include "checked.h"
+#ifdef SWITCHY_CHECKED
+#include <stdio.h>
+
+#ifdef _MSC_VER
+#define THREAD_LOCAL __declspec(thread)
+#else
+#define THREAD_LOCAL _Thread_local
+#endif
+
+CheckedCounters checkedCounters;
+
+// Only the thread inside the hot path counts
+static THREAD_LOCAL int depth = 0;
+
+
+void Checked_Enter()
+{
+	if (depth++ == 0)
+	{
+		checkedCounters.events++;
+	}
+}
+
+
+void Checked_Leave()
+{
+	depth--;
+}
+
+
+static void Violation(const char* file, int line)
+{
+	if (checkedCounters.file == NULL)
+	{
+		checkedCounters.file = file;
+		checkedCounters.line = line;
+	}
+}
+
+
+void Checked_Allocation(const char* file, int line)
+{
+	if (depth > 0)
+	{
+		checkedCounters.allocations++;
+		Violation(file, line);
+	}
+}
+
+
+void Checked_Block(const char* file, int line)
+{
+	if (depth > 0)
+	{
+		checkedCounters.blocks++;
+		Violation(file, line);
+	}
+}
+
+
+void Checked_SystemCall()
+{
+	if (depth > 0)
+	{
+		checkedCounters.systemCalls++;
+	}
+}
+
+
+int Checked_Report(char* text, size_t size)
+{
+	int written = snprintf(text, size, "%u key events: %u heap calls, %u blocking calls, %u system calls",
+		checkedCounters.events, checkedCounters.allocations, checkedCounters.blocks, checkedCounters.systemCalls);
+	if (checkedCounters.file != NULL && written >= 0 && (size_t)written < size)
+	{
+		snprintf(text + written, size - (size_t)written, ", first in %s line %d", checkedCounters.file, checkedCounters.line);
+	}
+	return checkedCounters.file != NULL;
+}
+
+#endif // SWITCHY_CHECKED
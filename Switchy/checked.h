@@ -0,0 +1,70 @@
+#pragma once
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+// Checked builds (SWITCHY_CHECKED defined) check that handling a key event
+// neither touches the heap nor blocks. What a thread runs between
+// CHECKED_ENTER and CHECKED_LEAVE is the hot path; heap calls and blocking
+// waits it makes from a file that includes this header after all others
+// are counted with the place of the first one. Other threads are not
+// affected. Only the calls in Switchy's own sources are seen: heap use and
+// locks inside Win32 and C runtime functions are not, so "0 heap calls"
+// is no guarantee that nothing allocated. Calls into the window manager
+// and injected input are counted too but allowed: the hook cannot do
+// without them, it only has to keep them few. Debug output takes the C
+// runtime's stream lock, so checked builds are meant to be release builds.
+
+#ifdef SWITCHY_CHECKED
+
+typedef struct {
+	uint32_t events;
+	uint32_t allocations;
+	uint32_t blocks;
+	uint32_t systemCalls;
+	// Where the first violation happened
+	const char* file;
+	int line;
+} CheckedCounters;
+
+extern CheckedCounters checkedCounters;
+
+void Checked_Enter();
+void Checked_Leave();
+void Checked_Allocation(const char* file, int line);
+void Checked_Block(const char* file, int line);
+void Checked_SystemCall();
+// Describes the counters; returns 0 if the hot path stayed clean
+int Checked_Report(char* text, size_t size);
+
+#define CHECKED_ENTER() Checked_Enter()
+#define CHECKED_LEAVE() Checked_Leave()
+
+// A macro is not expanded inside itself, so these still call the originals
+#define malloc(size) (Checked_Allocation(__FILE__, __LINE__), malloc(size))
+#define calloc(count, size) (Checked_Allocation(__FILE__, __LINE__), calloc(count, size))
+#define realloc(pointer, size) (Checked_Allocation(__FILE__, __LINE__), realloc(pointer, size))
+#define free(pointer) (Checked_Allocation(__FILE__, __LINE__), free(pointer))
+#ifdef _WIN32
+#define WaitForSingleObject(handle, ms) (Checked_Block(__FILE__, __LINE__), WaitForSingleObject(handle, ms))
+#define EnterCriticalSection(section) (Checked_Block(__FILE__, __LINE__), EnterCriticalSection(section))
+#define Sleep(ms) (Checked_Block(__FILE__, __LINE__), Sleep(ms))
+#define GetForegroundWindow() (Checked_SystemCall(), GetForegroundWindow())
+#define GetWindowThreadProcessId(hWnd, processId) (Checked_SystemCall(), GetWindowThreadProcessId(hWnd, processId))
+#define GetKeyboardLayout(threadId) (Checked_SystemCall(), GetKeyboardLayout(threadId))
+#define GetAsyncKeyState(key) (Checked_SystemCall(), GetAsyncKeyState(key))
+#define GetKeyState(key) (Checked_SystemCall(), GetKeyState(key))
+#define SendInput(count, inputs, size) (Checked_SystemCall(), SendInput(count, inputs, size))
+#define keybd_event(key, scan, flags, extra) (Checked_SystemCall(), keybd_event(key, scan, flags, extra))
+#else
+#define sem_wait(semaphore) (Checked_Block(__FILE__, __LINE__), sem_wait(semaphore))
+#define pthread_mutex_lock(mutex) (Checked_Block(__FILE__, __LINE__), pthread_mutex_lock(mutex))
+#define nanosleep(request, remaining) (Checked_Block(__FILE__, __LINE__), nanosleep(request, remaining))
+#endif
+
+#else
+
+#define CHECKED_ENTER()
+#define CHECKED_LEAVE()
+
+#endif // SWITCHY_CHECKED
@@ -0,0 +1,247 @@
+#include "convert.h"
+#include <string.h>
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__x86_64__) || defined(__i386__)
+#define CONVERT_AVX2 1
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#define CONVERT_TARGET_AVX2
+#else
+#define CONVERT_TARGET_AVX2 __attribute__((target("avx2")))
+#endif
+#endif
+
+// Numeric keypad keys produce the same characters in every layout
+#define VK_NUMPAD_FIRST 0x60
+#define VK_NUMPAD_LAST 0x6F
+
+
+static int SetMapping(ConvertTable* table, uint16_t from, uint16_t to, uint8_t* pageCount)
+{
+	uint8_t page = table->pageOf[from >> 8];
+	if (page == 0)
+	{
+		if (*pageCount == CONVERT_MAX_PAGES)
+		{
+			return 0;
+		}
+		page = (*pageCount)++;
+		table->pageOf[from >> 8] = page;
+	}
+
+	table->pages[page][from & 0xFF] = from ^ to;
+	return 1;
+}
+
+
+int Convert_Build(ConvertTable* table, const KeyLayout* from, const KeyLayout* to)
+{
+	uint16_t windowCount[512] = { 0 };
+	uint8_t pageCount = 1;
+	memset(table, 0, sizeof(*table));
+
+	for (int vk = 0; vk < 256; vk++)
+	{
+		if (vk >= VK_NUMPAD_FIRST && vk <= VK_NUMPAD_LAST)
+		{
+			continue;
+		}
+
+		for (int shift = LAYOUT_PLAIN; shift <= LAYOUT_SHIFT; shift++)
+		{
+			uint16_t source = from->chars[vk][shift];
+			uint16_t target = to->chars[vk][shift];
+			// The first key producing a character wins
+			if (source == 0 || target == 0 || Convert_Char(table, source) != source)
+			{
+				continue;
+			}
+			if (!SetMapping(table, source, target, &pageCount))
+			{
+				return 0;
+			}
+			windowCount[source / CONVERT_WINDOW_SIZE]++;
+		}
+	}
+
+	// Vectorized path covers the two windows with the most mapped characters
+	for (int w = 0; w < CONVERT_WINDOWS; w++)
+	{
+		int best = 0;
+		for (int i = 1; i < 512; i++)
+		{
+			if (windowCount[i] > windowCount[best])
+			{
+				best = i;
+			}
+		}
+		windowCount[best] = 0;
+		// Second window defaults to ASCII, which holds spaces and punctuation
+		if (w > 0 && best == table->windowBase[0] / CONVERT_WINDOW_SIZE)
+		{
+			best = best == 0 ? 1 : 0;
+		}
+
+		table->windowBase[w] = (uint16_t)(best * CONVERT_WINDOW_SIZE);
+		for (int i = 0; i < CONVERT_WINDOW_SIZE; i++)
+		{
+			uint16_t original = (uint16_t)(table->windowBase[w] + i);
+			uint16_t delta = table->pages[table->pageOf[original >> 8]][original & 0xFF];
+			table->windowLow[w][i] = (uint8_t)delta;
+			table->windowHigh[w][i] = (uint8_t)(delta >> 8);
+			if (table->windowLow[w][i])
+			{
+				table->lowChunks[w] |= 1 << (i / 16);
+			}
+			if (table->windowHigh[w][i])
+			{
+				table->highChunks[w] |= 1 << (i / 16);
+			}
+		}
+	}
+
+	return 1;
+}
+
+
+void Convert_TextScalar(const ConvertTable* table, const uint16_t* src, uint16_t* dst, size_t count)
+{
+	for (size_t i = 0; i < count; i++)
+	{
+		dst[i] = Convert_Char(table, src[i]);
+	}
+}
+
+
+#ifdef CONVERT_AVX2
+// Looks up indices 0..127 (anything else yields 0) in the low and high
+// byte tables of a window, visiting only the chunks that change anything
+CONVERT_TARGET_AVX2 static inline void Lookup128(const ConvertTable* table, int w, __m256i index, __m256i* low, __m256i* high)
+{
+	uint8_t chunks = table->lowChunks[w] | table->highChunks[w];
+	for (int chunk = 0; chunks; chunk++, chunks >>= 1)
+	{
+		if (chunks & 1)
+		{
+			// Indices of this chunk become 0x70..0x7F, all others get the high bit set
+			__m256i local = _mm256_adds_epu8(_mm256_sub_epi8(index, _mm256_set1_epi8((char)(chunk * 16))), _mm256_set1_epi8(0x70));
+			__m256i lowEntries = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i*)(table->windowLow[w] + chunk * 16)));
+			__m256i highEntries = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i*)(table->windowHigh[w] + chunk * 16)));
+			*low = _mm256_or_si256(*low, _mm256_shuffle_epi8(lowEntries, local));
+			*high = _mm256_or_si256(*high, _mm256_shuffle_epi8(highEntries, local));
+		}
+	}
+}
+
+
+// Converts 32 characters if all of them fall into one of the windows
+CONVERT_TARGET_AVX2 static inline int ConvertBlock(const ConvertTable* table, const uint16_t* src, uint16_t* dst)
+{
+	__m256i a = _mm256_loadu_si256((const __m256i*)src);
+	__m256i b = _mm256_loadu_si256((const __m256i*)(src + 16));
+	__m256i outside = _mm256_set1_epi16((short)(0x10000 - CONVERT_WINDOW_SIZE));
+	__m256i low = _mm256_setzero_si256();
+	__m256i high = _mm256_setzero_si256();
+	__m256i covered = _mm256_setzero_si256();
+
+	for (int w = 0; w < CONVERT_WINDOWS; w++)
+	{
+		__m256i base = _mm256_set1_epi16((short)table->windowBase[w]);
+		__m256i da = _mm256_sub_epi16(a, base);
+		__m256i db = _mm256_sub_epi16(b, base);
+		__m256i ina = _mm256_cmpeq_epi16(_mm256_and_si256(da, outside), _mm256_setzero_si256());
+		__m256i inb = _mm256_cmpeq_epi16(_mm256_and_si256(db, outside), _mm256_setzero_si256());
+		covered = _mm256_or_si256(covered, _mm256_packs_epi16(ina, inb));
+		if (!(table->lowChunks[w] | table->highChunks[w]))
+		{
+			continue;
+		}
+
+		// Characters outside the window get index 0xFF and look up as zero.
+		// Packing works within 128-bit lanes, unpacking below restores the order.
+		__m256i ia = _mm256_or_si256(_mm256_and_si256(da, ina), _mm256_andnot_si256(ina, _mm256_set1_epi16(0xFF)));
+		__m256i ib = _mm256_or_si256(_mm256_and_si256(db, inb), _mm256_andnot_si256(inb, _mm256_set1_epi16(0xFF)));
+		__m256i index = _mm256_packus_epi16(ia, ib);
+		Lookup128(table, w, index, &low, &high);
+	}
+
+	if (_mm256_movemask_epi8(covered) != -1)
+	{
+		return 0;
+	}
+
+	_mm256_storeu_si256((__m256i*)dst, _mm256_xor_si256(a, _mm256_unpacklo_epi8(low, high)));
+	_mm256_storeu_si256((__m256i*)(dst + 16), _mm256_xor_si256(b, _mm256_unpackhi_epi8(low, high)));
+	return 1;
+}
+
+
+CONVERT_TARGET_AVX2 static void ConvertTextAvx2(const ConvertTable* table, const uint16_t* src, uint16_t* dst, size_t count)
+{
+	size_t i = 0;
+	for (; i + 32 <= count; i += 32)
+	{
+		if (!ConvertBlock(table, src + i, dst + i))
+		{
+			Convert_TextScalar(table, src + i, dst + i, 32);
+		}
+	}
+	Convert_TextScalar(table, src + i, dst + i, count - i);
+}
+
+
+static int HasAvx2()
+{
+#ifdef _MSC_VER
+	int info[4];
+	__cpuid(info, 0);
+	if (info[0] < 7)
+	{
+		return 0;
+	}
+	__cpuid(info, 1);
+	// OSXSAVE and AVX, then the OS has to save the YMM registers
+	if ((info[2] & (1 << 27)) == 0 || (info[2] & (1 << 28)) == 0 || (_xgetbv(0) & 6) != 6)
+	{
+		return 0;
+	}
+	__cpuidex(info, 7, 0);
+	return (info[1] & (1 << 5)) != 0;
+#else
+	return __builtin_cpu_supports("avx2");
+#endif
+}
+#endif // CONVERT_AVX2
+
+
+void Convert_Text(const ConvertTable* table, const uint16_t* src, uint16_t* dst, size_t count)
+{
+#ifdef CONVERT_AVX2
+	static int avx2 = -1;
+	if (avx2 < 0)
+	{
+		avx2 = HasAvx2();
+	}
+	if (avx2)
+	{
+		ConvertTextAvx2(table, src, dst, count);
+		return;
+	}
+#endif
+	Convert_TextScalar(table, src, dst, count);
+}
+
+
+long Convert_Detect(const ConvertTable* forward, const ConvertTable* backward, const uint16_t* text, size_t count)
+{
+	long score = 0;
+	for (size_t i = 0; i < count; i++)
+	{
+		// Characters only one of the layouts can type decide the direction
+		int inForward = Convert_Char(forward, text[i]) != text[i];
+		int inBackward = Convert_Char(backward, text[i]) != text[i];
+		score += inForward - inBackward;
+	}
+	return score;
+}
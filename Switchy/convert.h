@@ -0,0 +1,45 @@
+#pragma once
+#include <stddef.h>
+#include <stdint.h>
+#include "layout.h"
+
+// Table-driven UTF-16 conversion of text typed in the wrong layout.
+// The table is flat (no pointers) so it can be placed in shared memory.
+
+#define CONVERT_MAX_PAGES 16
+#define CONVERT_WINDOWS 2
+#define CONVERT_WINDOW_SIZE 128
+
+typedef struct {
+	// Two-level table of (mapped ^ original) for the scalar path,
+	// page 0 is all zeros and serves every unmapped block
+	uint8_t pageOf[256];
+	uint16_t pages[CONVERT_MAX_PAGES][256];
+
+	// Two 128-character windows holding most mapped characters for the
+	// vectorized path: low and high bytes of (mapped ^ original), and the
+	// 16-character chunks of each window that change anything
+	uint16_t windowBase[CONVERT_WINDOWS];
+	uint8_t windowLow[CONVERT_WINDOWS][CONVERT_WINDOW_SIZE];
+	uint8_t windowHigh[CONVERT_WINDOWS][CONVERT_WINDOW_SIZE];
+	uint8_t lowChunks[CONVERT_WINDOWS];
+	uint8_t highChunks[CONVERT_WINDOWS];
+} ConvertTable;
+
+// Builds the table converting characters typed in layout `from` into the
+// characters the same keys produce in layout `to`.
+int Convert_Build(ConvertTable* table, const KeyLayout* from, const KeyLayout* to);
+
+static inline uint16_t Convert_Char(const ConvertTable* table, uint16_t ch)
+{
+	return ch ^ table->pages[table->pageOf[ch >> 8]][ch & 0xFF];
+}
+
+// Scalar reference implementation
+void Convert_TextScalar(const ConvertTable* table, const uint16_t* src, uint16_t* dst, size_t count);
+// Vectorized where the CPU allows it, falls back to the scalar code otherwise
+void Convert_Text(const ConvertTable* table, const uint16_t* src, uint16_t* dst, size_t count);
+
+// Returns a positive value if the text looks typed in the source layout of
+// `forward`, a negative one if it rather matches the source of `backward`.
+long Convert_Detect(const ConvertTable* forward, const ConvertTable* backward, const uint16_t* text, size_t count);
@@ -0,0 +1,250 @@
+#include "converter.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include "convert.h"
+#include "input.h"
+#include "shared.h"
+#include "checked.h"
+
+#define WM_CONVERT_TEXT (WM_APP + 1)
+#define DETECT_LIMIT 4096
+#define WAIT_STEP 10
+#define MODIFIERS_TIMEOUT 1000
+#define COPY_TIMEOUT 300
+#define SHARED_TIMEOUT 1000
+#define TABLES_VERSION 1
+
+typedef struct {
+	ConvertTable forward;
+	ConvertTable backward;
+} ConvertTables;
+
+static HANDLE hThread = NULL;
+static DWORD threadId = 0;
+static HKL layouts[2];
+static SharedSection section;
+static ConvertTables privateTables;
+static const ConvertTables* tables = &privateTables;
+
+
+static BOOL BuildTables(ConvertTables* target, HKL first, HKL second)
+{
+	static KeyLayout from, to;
+	return Layout_Load(&from, first) && Layout_Load(&to, second) &&
+		Convert_Build(&target->forward, &from, &to) && Convert_Build(&target->backward, &to, &from);
+}
+
+
+// Tables are rebuilt only when the first two installed layouts change.
+// HKL values are the same in every session, so instances of all users
+// with the same pair of layouts map one shared copy.
+static BOOL PrepareTables()
+{
+	HKL current[2];
+	if (GetKeyboardLayoutList(2, current) < 2)
+	{
+		return FALSE;
+	}
+	if (current[0] == layouts[0] && current[1] == layouts[1])
+	{
+		return TRUE;
+	}
+
+	char name[64];
+	snprintf(name, sizeof(name), "Switchy.Tables.%d.%p.%p", TABLES_VERSION, (void*)current[0], (void*)current[1]);
+	Shared_Close(&section);
+	tables = &privateTables;
+	if (Shared_Open(&section, name, sizeof(ConvertTables)))
+	{
+		if (section.created)
+		{
+			if (BuildTables((ConvertTables*)section.data, current[0], current[1]))
+			{
+				Shared_Publish(&section);
+				tables = (const ConvertTables*)section.data;
+			}
+		}
+		else if (Shared_WaitReady(&section, SHARED_TIMEOUT))
+		{
+			tables = (const ConvertTables*)section.data;
+		}
+	}
+#if _DEBUG
+	printf("Conversion tables %s\n", tables == &privateTables ? "private" : section.created ? "shared (created)" : "shared (mapped)");
+#endif // _DEBUG
+
+	if (tables == &privateTables)
+	{
+		Shared_Close(&section);
+		if (!BuildTables(&privateTables, current[0], current[1]))
+		{
+			return FALSE;
+		}
+	}
+
+	layouts[0] = current[0];
+	layouts[1] = current[1];
+	return TRUE;
+}
+
+
+static BOOL WaitForKeysReleased()
+{
+	const int keys[] = { VK_SHIFT, VK_MENU, VK_CONTROL, VK_CAPITAL };
+	for (int waited = 0; waited < MODIFIERS_TIMEOUT; waited += WAIT_STEP)
+	{
+		BOOL pressed = FALSE;
+		for (int i = 0; i < sizeof(keys) / sizeof(keys[0]); i++)
+		{
+			pressed |= (GetAsyncKeyState(keys[i]) & 0x8000) != 0;
+		}
+		if (!pressed)
+		{
+			return TRUE;
+		}
+		Sleep(WAIT_STEP);
+	}
+	return FALSE;
+}
+
+
+static BOOL CopySelection()
+{
+	DWORD sequence = GetClipboardSequenceNumber();
+	PressKey(VK_CONTROL);
+	PressKey('C');
+	ReleaseKey('C');
+	ReleaseKey(VK_CONTROL);
+
+	for (int waited = 0; waited < COPY_TIMEOUT; waited += WAIT_STEP)
+	{
+		Sleep(WAIT_STEP);
+		if (GetClipboardSequenceNumber() != sequence)
+		{
+			return TRUE;
+		}
+	}
+	return FALSE;
+}
+
+
+static BOOL ConvertClipboard()
+{
+	BOOL converted = FALSE;
+	if (!OpenClipboard(NULL))
+	{
+		return FALSE;
+	}
+
+	HANDLE hSource = GetClipboardData(CF_UNICODETEXT);
+	const WCHAR* source = hSource ? (const WCHAR*)GlobalLock(hSource) : NULL;
+	if (source != NULL)
+	{
+		size_t length = wcslen(source);
+		HGLOBAL hResult = GlobalAlloc(GMEM_MOVEABLE, (length + 1) * sizeof(WCHAR));
+		WCHAR* result = hResult ? (WCHAR*)GlobalLock(hResult) : NULL;
+		if (result != NULL)
+		{
+			long direction = Convert_Detect(&tables->forward, &tables->backward, source, min(length, DETECT_LIMIT));
+			Convert_Text(direction >= 0 ? &tables->forward : &tables->backward, source, result, length + 1);
+			GlobalUnlock(hResult);
+#if _DEBUG
+			printf("Converted %zu characters %s\n", length, direction >= 0 ? "forward" : "backward");
+#endif // _DEBUG
+		}
+		GlobalUnlock(hSource);
+
+		if (result != NULL && EmptyClipboard() && SetClipboardData(CF_UNICODETEXT, hResult))
+		{
+			converted = TRUE;
+		}
+		else if (hResult != NULL)
+		{
+			GlobalFree(hResult);
+		}
+	}
+
+	CloseClipboard();
+	return converted;
+}
+
+
+static void ConvertText()
+{
+	if (!PrepareTables() || !WaitForKeysReleased())
+	{
+		return;
+	}
+
+	BOOL selected = CopySelection();
+	if (ConvertClipboard() && selected)
+	{
+		PressKey(VK_CONTROL);
+		PressKey('V');
+		ReleaseKey('V');
+		ReleaseKey(VK_CONTROL);
+	}
+}
+
+
+static DWORD WINAPI ConverterThread(LPVOID param)
+{
+	MSG message;
+	// Create the message queue before the caller is allowed to post to it
+	PeekMessage(&message, NULL, WM_USER, WM_USER, PM_NOREMOVE);
+	SetEvent((HANDLE)param);
+
+	while (GetMessage(&message, NULL, 0, 0) > 0)
+	{
+		if (message.message == WM_CONVERT_TEXT)
+		{
+			ConvertText();
+			// Requests queued while converting are stale
+			while (PeekMessage(&message, NULL, WM_CONVERT_TEXT, WM_CONVERT_TEXT, PM_REMOVE));
+		}
+	}
+	return 0;
+}
+
+
+BOOL Converter_Start()
+{
+	HANDLE hReady = CreateEvent(NULL, TRUE, FALSE, NULL);
+	if (hReady == NULL)
+	{
+		return FALSE;
+	}
+
+	hThread = CreateThread(NULL, 0, ConverterThread, hReady, 0, &threadId);
+	if (hThread != NULL)
+	{
+		WaitForSingleObject(hReady, INFINITE);
+	}
+	CloseHandle(hReady);
+	return hThread != NULL;
+}
+
+
+void Converter_Request()
+{
+	if (hThread != NULL)
+	{
+		PostThreadMessage(threadId, WM_CONVERT_TEXT, 0, 0);
+	}
+}
+
+
+void Converter_Stop()
+{
+	if (hThread == NULL)
+	{
+		return;
+	}
+
+	PostThreadMessage(threadId, WM_QUIT, 0, 0);
+	WaitForSingleObject(hThread, INFINITE);
+	CloseHandle(hThread);
+	hThread = NULL;
+	Shared_Close(&section);
+	layouts[0] = layouts[1] = NULL;
+}
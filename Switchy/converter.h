@@ -0,0 +1,10 @@
+#pragma once
+#include <Windows.h>
+
+// Converts the selected text (or the clipboard text when nothing is selected)
+// typed in the wrong layout. All the work happens on a worker thread, the
+// hook only posts a request.
+
+BOOL Converter_Start();
+void Converter_Request();
+void Converter_Stop();
@@ -0,0 +1,325 @@
+#include "core.h"
+#include <string.h>
+#include "checked.h"
+
+
+static int OnCapsLock(DeviceKeyState* keys, const CoreEvent* event, uint32_t* effects)
+{
+	int down = event->message == CORE_KEY_DOWN || event->message == CORE_SYSKEY_DOWN;
+	if (!down)
+	{
+		int taken = keys->capsProcessed && !keys->capsPassed;
+		int used = keys->capsUsed || keys->shiftProcessed;
+		if (keys->winPressed)
+		{
+			*effects |= CORE_RELEASE_WIN;
+		}
+		if (taken && event->active && !event->popup && !used)
+		{
+			*effects |= CORE_SWITCH;
+		}
+		*effects |= CORE_ONESHOT_END;
+		keys->capsProcessed = 0;
+		keys->shiftProcessed = 0;
+		keys->winPressed = 0;
+		keys->capsUsed = 0;
+		keys->capsPassed = 0;
+		return taken ? CORE_BLOCK : CORE_NEXT;
+	}
+
+	// Auto-repeat goes the way of the press
+	if (keys->capsPassed)
+	{
+		return CORE_NEXT;
+	}
+	if (keys->capsProcessed)
+	{
+		return CORE_BLOCK;
+	}
+
+	if (event->message == CORE_SYSKEY_DOWN)
+	{
+		keys->capsProcessed = 1;
+		keys->capsUsed = 1;
+		*effects |= event->active && event->shiftDown ? CORE_CONVERT : CORE_TOGGLE_ENABLED;
+		return CORE_BLOCK;
+	}
+
+	if (!event->active)
+	{
+		keys->capsPassed = 1;
+		return CORE_NEXT;
+	}
+
+	keys->capsProcessed = 1;
+	if (keys->shiftProcessed)
+	{
+		*effects |= CORE_TOGGLE_CAPS;
+	}
+	else if (event->popup)
+	{
+		keys->winPressed = 1;
+		*effects |= CORE_POPUP;
+	}
+	else
+	{
+		*effects |= CORE_ONESHOT_BEGIN;
+	}
+	return CORE_BLOCK;
+}
+
+
+static int OnLeftShift(DeviceKeyState* keys, const CoreEvent* event, uint32_t* effects)
+{
+	int down = event->message == CORE_KEY_DOWN || event->message == CORE_SYSKEY_DOWN;
+	// Held with CapsLock, Shift stays used until CapsLock is released
+	if (!down && !keys->capsProcessed)
+	{
+		keys->shiftProcessed = 0;
+	}
+	if (!event->active)
+	{
+		return CORE_NEXT;
+	}
+
+	if (event->message == CORE_KEY_DOWN && !keys->shiftProcessed)
+	{
+		keys->shiftProcessed = 1;
+		if (keys->capsProcessed)
+		{
+			*effects |= CORE_TOGGLE_CAPS;
+			if (event->popup)
+			{
+				keys->winPressed = 1;
+				*effects |= CORE_POPUP;
+			}
+		}
+	}
+	return CORE_ALLOW;
+}
+
+
+int Core_OnKey(DeviceKeyState* keys, const CoreEvent* event, uint32_t* effects)
+{
+	switch (event->vkCode)
+	{
+	case CORE_VK_CAPITAL:
+		return OnCapsLock(keys, event, effects);
+	case CORE_VK_LSHIFT:
+		return OnLeftShift(keys, event, effects);
+	}
+	return CORE_NEXT;
+}
+
+
+void Core_Init(Core* core)
+{
+	memset(core, 0, sizeof(*core));
+	Devices_Init(&core->devices);
+	Chatter_Init(&core->chatter);
+	OneShot_Init(&core->oneShot);
+	memset(core->unseen, 1, sizeof(core->unseen));
+}
+
+
+static int IsDown(uint8_t message)
+{
+	return message == CORE_KEY_DOWN || message == CORE_SYSKEY_DOWN;
+}
+
+
+// A key that completes a macro is swallowed
+static int OnMacro(Core* core, const CoreInput* input, DeviceKeyState* keys, CoreOutput* output)
+{
+	int down = IsDown(input->message);
+	uint16_t action = Macro_OnKey(core->macros, &core->macroState, input->vkCode, down);
+	if (action == MACRO_NONE)
+	{
+		return 0;
+	}
+
+	output->effects |= CORE_MACRO;
+	output->macro = action;
+	core->macroKey = input->vkCode;
+	// A macro typed while CapsLock is held replaces the layout switch on release
+	if (keys->capsProcessed)
+	{
+		keys->capsUsed = 1;
+	}
+	return 1;
+}
+
+
+static int Decide(Core* core, const CoreInput* input, uint8_t slot, CoreOutput* output)
+{
+	int down = IsDown(input->message);
+	DeviceSlot* device = &core->devices.slots[slot];
+
+	// Bounces of worn keys never reach the decisions below
+	if (Chatter_OnKey(&core->chatter, input->vkCode, down, input->time))
+	{
+		return CORE_BLOCK;
+	}
+
+	// The auto-repeat and release of a key that completed a macro are
+	// swallowed too, even when a rule turned Switchy off in between
+	if (input->vkCode == core->macroKey)
+	{
+		core->macroKey = down ? core->macroKey : 0;
+		return CORE_BLOCK;
+	}
+
+	int active = input->enabled && !device->disabled;
+	// Auto-repeat of a key held from before a macro's first key doesn't fire it
+	int repeat = down && core->held[input->vkCode];
+	// Whatever CapsLock is held for counts on the keyboard CapsLock is held on
+	DeviceKeyState* caps = &core->devices.slots[core->raw ? core->devices.pressSlot[CORE_VK_CAPITAL] : DEVICE_UNKNOWN].keys;
+	if (core->macros != NULL && active && !repeat && OnMacro(core, input, caps, output))
+	{
+		return CORE_BLOCK;
+	}
+
+	// While CapsLock is held keys type in the other layout
+	const uint8_t* held = core->held;
+	uint32_t modifiers = (held[CORE_VK_LSHIFT] | held[CORE_VK_RSHIFT] ? ONESHOT_SHIFT : 0) |
+		(held[0xA2] | held[0xA3] | held[0xA4] | held[0xA5] | held[0x5B] | held[0x5C] ? ONESHOT_MODIFIERS : 0);
+	int oneShotAction = OneShot_OnKey(&core->oneShot, input->vkCode, down, modifiers, &output->ch);
+	if (oneShotAction != ONESHOT_PASS)
+	{
+		if (oneShotAction == ONESHOT_TYPE)
+		{
+			output->effects |= CORE_TYPE;
+			// Typing in the other layout replaces the layout switch on release
+			caps->capsUsed = 1;
+		}
+		return CORE_BLOCK;
+	}
+	// While CapsLock types in the other layout the left Shift is a plain
+	// Shift for it, not the CapsLock toggle
+	if (input->vkCode == CORE_VK_LSHIFT && down && core->oneShot.target != NULL)
+	{
+		return CORE_NEXT;
+	}
+
+	CoreEvent event;
+	event.vkCode = input->vkCode;
+	event.message = input->message;
+	event.active = (uint8_t)active;
+	event.popup = core->popup;
+	event.shiftDown = (modifiers & ONESHOT_SHIFT) != 0;
+	return Core_OnKey(&device->keys, &event, &output->effects);
+}
+
+
+// Tracks the keys and modifiers the hook has seen once a key is decided
+static int Finish(Core* core, const CoreInput* input, int result)
+{
+	int down = IsDown(input->message);
+	// The system may have seen the press of a key held since before the hook
+	// came, so its release is never swallowed
+	if (!down && core->unseen[input->vkCode])
+	{
+		result = CORE_NEXT;
+	}
+	core->held[input->vkCode] = (uint8_t)down;
+	core->unseen[input->vkCode] &= down;
+	return result;
+}
+
+
+// Decides the waiting press on the keyboard `slot`; it has already passed
+static int Resolve(Core* core, uint8_t slot, CoreOutput* output)
+{
+	memset(output, 0, sizeof(*output));
+	core->isWaiting = 0;
+	if (Finish(core, &core->waiting, Decide(core, &core->waiting, slot, output)) == CORE_BLOCK)
+	{
+		output->effects |= CORE_TAKE_BACK;
+		output->vkCode = core->waiting.vkCode;
+	}
+	return output->effects != 0;
+}
+
+
+int Core_Flush(Core* core, CoreOutput* output)
+{
+	if (!core->isWaiting)
+	{
+		return 0;
+	}
+	return Resolve(core, core->devices.pressSlot[core->waiting.vkCode], output);
+}
+
+
+int Core_OnHook(Core* core, const CoreInput* input, CoreOutput* output)
+{
+	memset(output, 0, sizeof(*output));
+	int down = IsDown(input->message);
+	if (!core->raw)
+	{
+		return Finish(core, input, Decide(core, input, DEVICE_UNKNOWN, output));
+	}
+
+	uint8_t slot = Devices_OnHook(&core->devices, input->vkCode, down);
+	// CapsLock and the left Shift do what the keyboard they came from allows
+	int fresh = down && !core->held[input->vkCode];
+	if (fresh && (input->vkCode == CORE_VK_CAPITAL || input->vkCode == CORE_VK_LSHIFT))
+	{
+		core->waiting = *input;
+		core->isWaiting = 1;
+		return CORE_NEXT;
+	}
+
+	int result = Finish(core, input, Decide(core, input, slot, output));
+	// A blocked key never reaches Raw Input
+	if (result == CORE_BLOCK)
+	{
+		Devices_OnBlocked(&core->devices, input->vkCode, down);
+	}
+	return result;
+}
+
+
+int Core_OnRaw(Core* core, uint8_t slot, uint8_t vkCode, int down, CoreOutput* output)
+{
+	if (!Devices_OnRaw(&core->devices, slot, vkCode, down) || !down || !core->isWaiting || core->waiting.vkCode != vkCode)
+	{
+		return 0;
+	}
+	core->devices.pressSlot[vkCode] = slot;
+	return Resolve(core, slot, output);
+}
+
+
+int Core_Key(Core* core, const CoreInput* input, CoreApply apply, void* context)
+{
+	CoreOutput output;
+	if (Core_Flush(core, &output) && !apply(&output, context))
+	{
+		return CORE_NEXT;
+	}
+	int result = Core_OnHook(core, input, &output);
+	apply(&output, context);
+	return result;
+}
+
+
+void Core_Reset(Core* core, uint32_t* effects)
+{
+	for (int slot = 0; slot < DEVICE_MAX; slot++)
+	{
+		DeviceKeyState* keys = &core->devices.slots[slot].keys;
+		if (keys->winPressed)
+		{
+			*effects |= CORE_RELEASE_WIN;
+		}
+		memset(keys, 0, sizeof(DeviceKeyState));
+	}
+	Chatter_ResetKeys(&core->chatter);
+	OneShot_Init(&core->oneShot);
+	memset(&core->macroState, 0, sizeof(core->macroState));
+	core->macroKey = 0;
+	core->isWaiting = 0;
+	memset(core->held, 0, sizeof(core->held));
+	memset(core->unseen, 1, sizeof(core->unseen));
+}
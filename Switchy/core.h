@@ -0,0 +1,127 @@
+#pragma once
+#include <stdint.h>
+#include "chatter.h"
+#include "devices.h"
+#include "macro.h"
+#include "oneshot.h"
+
+// The per-key path of the keyboard hook, apart from Windows: the keyboard
+// a key came from, chatter, macros, typing in the other layout and what
+// CapsLock and the left Shift do. The hook translates its event into a
+// CoreInput, returns what Core_Key returns and carries out the effects.
+// With Raw Input the keyboard is known only once the key has passed the
+// hook, so a new press of CapsLock or the left Shift is let through and
+// decided when its raw event arrives (Core_OnRaw), or at the next hook
+// event if that comes first (Core_Flush); a press decided to be swallowed
+// then is taken back.
+// SwitchyTools hookfuzz drives the same function with generated event
+// sequences and checks the invariants below after each event:
+// - the Win key pressed for the pop-up is released with CapsLock,
+// - a key the system saw going down also sees going up, injected or not,
+// - the layout is switched only on a release of a CapsLock press Switchy took,
+// - with every key released, no keyboard keeps any key state,
+// - every key Switchy injects going down also goes up, and it never
+//   releases a key the system saw going down from a finger.
+
+#define CORE_VK_CAPITAL 0x14
+#define CORE_VK_LSHIFT 0xA0
+#define CORE_VK_RSHIFT 0xA1
+
+// Messages, as WM_KEYDOWN, WM_SYSKEYDOWN, WM_KEYUP and WM_SYSKEYUP
+#define CORE_KEY_DOWN 0
+#define CORE_SYSKEY_DOWN 1
+#define CORE_KEY_UP 2
+#define CORE_SYSKEY_UP 3
+
+// Results: pass to the next hook, swallow, let through skipping the next hooks
+#define CORE_NEXT 0
+#define CORE_BLOCK 1
+#define CORE_ALLOW 2
+
+// Effects, carried out in this order
+// Release CoreOutput.vkCode that was let through, and toggle CapsLock back
+// if it was CapsLock; its auto-repeats and release are swallowed
+#define CORE_TAKE_BACK 0x01
+#define CORE_CONVERT 0x02
+#define CORE_TOGGLE_ENABLED 0x04
+#define CORE_RELEASE_WIN 0x08
+#define CORE_SWITCH 0x10
+#define CORE_TOGGLE_CAPS 0x20
+// Win+Space with Win kept down until CORE_RELEASE_WIN
+#define CORE_POPUP 0x40
+#define CORE_ONESHOT_END 0x80
+#define CORE_ONESHOT_BEGIN 0x100
+// Send CoreOutput.ch
+#define CORE_TYPE 0x200
+// Run the macro action CoreOutput.macro
+#define CORE_MACRO 0x400
+
+typedef struct {
+	uint8_t vkCode;
+	uint8_t message;
+	// Switchy is enabled and neither a rule nor the device config turns it off
+	uint8_t active;
+	uint8_t popup;
+	// Either Shift is down
+	uint8_t shiftDown;
+} CoreEvent;
+
+typedef struct {
+	uint8_t vkCode;
+	uint8_t message;
+	// Switchy is enabled and no rule turns it off in the foreground window
+	uint8_t enabled;
+	// Event time in milliseconds
+	uint32_t time;
+} CoreInput;
+
+typedef struct {
+	uint32_t effects;
+	uint16_t ch;
+	uint16_t macro;
+	uint8_t vkCode;
+} CoreOutput;
+
+// Carries out the effects of one decision; returns 0 if they took the hook
+// away, e.g. by turning Switchy off
+typedef int (*CoreApply)(const CoreOutput* output, void* context);
+
+typedef struct {
+	DeviceTracker devices;
+	ChatterFilter chatter;
+	OneShot oneShot;
+	// NULL without macros
+	const MacroSet* macros;
+	MacroState macroState;
+	// The key that completed a macro, swallowed until it is released
+	uint8_t macroKey;
+	// Keys down as the hook saw them; the modifiers come from here
+	uint8_t held[256];
+	// Keys not released since the hook came, which may have gone down before
+	uint8_t unseen[256];
+	// Raw Input tells the keyboards apart; without it every key is keyboard 0
+	uint8_t raw;
+	// A press let through and not decided until its raw event arrives
+	CoreInput waiting;
+	uint8_t isWaiting;
+	uint8_t popup;
+} Core;
+
+void Core_Init(Core* core);
+// Decides a press still waiting for its raw event on the keyboard used
+// last. Called before Core_OnHook; returns 1 if there are effects.
+int Core_Flush(Core* core, CoreOutput* output);
+// Returns CORE_NEXT, CORE_BLOCK or CORE_ALLOW for a key event the hook got
+int Core_OnHook(Core* core, const CoreInput* input, CoreOutput* output);
+// Raw Input event of keyboard `slot`; returns 1 if there are effects
+int Core_OnRaw(Core* core, uint8_t slot, uint8_t vkCode, int down, CoreOutput* output);
+// The hook's whole per-key path: Core_Flush and Core_OnHook, applying the
+// effects of each. Returns what Core_OnHook returns, or CORE_NEXT if the
+// effects of the flushed press took the hook away.
+int Core_Key(Core* core, const CoreInput* input, CoreApply apply, void* context);
+// Forgets every key state when the hook comes or goes, keeping what was
+// learned; the Win key held for a pop-up is released
+void Core_Reset(Core* core, uint32_t* effects);
+// The CapsLock and left Shift state machine on its own. `keys` is the state
+// of the keyboard the event came from. Returns CORE_NEXT for other keys.
+int Core_OnKey(DeviceKeyState* keys, const CoreEvent* event, uint32_t* effects);
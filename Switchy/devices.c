@@ -0,0 +1,217 @@
+#include "devices.h"
+#include <ctype.h>
+#include <stdio.h>
+#include <string.h>
+#include "checked.h"
+
+
+void Devices_Init(DeviceTracker* tracker)
+{
+	memset(tracker, 0, sizeof(*tracker));
+}
+
+
+uint8_t Devices_Slot(DeviceTracker* tracker, uintptr_t handle, int* added)
+{
+	uint8_t oldest = 1;
+	*added = 0;
+	for (uint8_t slot = 1; slot < DEVICE_MAX; slot++)
+	{
+		if (tracker->slots[slot].handle == handle)
+		{
+			tracker->slots[slot].lastUsed = ++tracker->clock;
+			return slot;
+		}
+		if (tracker->slots[slot].lastUsed < tracker->slots[oldest].lastUsed)
+		{
+			oldest = slot;
+		}
+	}
+
+	// Free slots were never used, so they are the oldest
+	DeviceSlot* device = &tracker->slots[oldest];
+	memset(device, 0, sizeof(*device));
+	device->handle = handle;
+	device->lastUsed = ++tracker->clock;
+	*added = 1;
+	return oldest;
+}
+
+
+void Devices_Remove(DeviceTracker* tracker, uintptr_t handle)
+{
+	for (uint8_t slot = 1; slot < DEVICE_MAX; slot++)
+	{
+		if (tracker->slots[slot].handle == handle)
+		{
+			memset(&tracker->slots[slot], 0, sizeof(DeviceSlot));
+			if (tracker->lastSlot == slot)
+			{
+				tracker->lastSlot = DEVICE_UNKNOWN;
+			}
+			for (int vkCode = 0; vkCode < 256; vkCode++)
+			{
+				if (tracker->pressSlot[vkCode] == slot)
+				{
+					tracker->pressSlot[vkCode] = DEVICE_UNKNOWN;
+				}
+			}
+		}
+	}
+}
+
+
+int Devices_OnRaw(DeviceTracker* tracker, uint8_t slot, uint8_t vkCode, int down)
+{
+	int direction = down != 0;
+	tracker->lastSlot = slot;
+	if (tracker->pending[vkCode][direction] == 0)
+	{
+		return 0;
+	}
+	tracker->pending[vkCode][direction]--;
+	return 1;
+}
+
+
+uint8_t Devices_OnHook(DeviceTracker* tracker, uint8_t vkCode, int down)
+{
+	int direction = down != 0;
+	tracker->lastPending = 0;
+	if (tracker->pending[vkCode][direction] < DEVICE_QUEUE)
+	{
+		tracker->pending[vkCode][direction]++;
+		tracker->lastPending = (uint16_t)(vkCode | direction << 8);
+	}
+
+	// Auto-repeats and the release, even one without its raw event like that
+	// of a swallowed key, belong to the keyboard the press was given to, or
+	// its key state is left set
+	if (tracker->held[vkCode] || !direction)
+	{
+		tracker->held[vkCode] = (uint8_t)direction;
+		return tracker->pressSlot[vkCode];
+	}
+	tracker->held[vkCode] = 1;
+	tracker->pressSlot[vkCode] = tracker->lastSlot;
+	return tracker->lastSlot;
+}
+
+
+void Devices_OnBlocked(DeviceTracker* tracker, uint8_t vkCode, int down)
+{
+	int direction = down != 0;
+	if (tracker->lastPending == (uint16_t)(vkCode | direction << 8) && tracker->pending[vkCode][direction] > 0)
+	{
+		tracker->pending[vkCode][direction]--;
+	}
+	tracker->lastPending = 0;
+}
+
+
+static int ContainsNoCase(const char* text, const char* pattern)
+{
+	size_t length = strlen(pattern);
+	for (; *text; text++)
+	{
+		size_t i = 0;
+		while (i < length && tolower((unsigned char)text[i]) == tolower((unsigned char)pattern[i]))
+		{
+			i++;
+		}
+		if (i == length)
+		{
+			return 1;
+		}
+	}
+	return 0;
+}
+
+
+static int IsWord(const char* text, size_t length, const char* word)
+{
+	return length == strlen(word) && memcmp(text, word, length) == 0;
+}
+
+
+int Devices_LoadConfig(DeviceConfig* config, const char* path, char* error, size_t errorSize)
+{
+	memset(config, 0, sizeof(*config));
+	error[0] = 0;
+	FILE* file = fopen(path, "r");
+	if (file == NULL)
+	{
+		snprintf(error, errorSize, "Cannot open \"%s\"", path);
+		return 0;
+	}
+
+	char line[DEVICE_MAX_NAME + 32];
+	int number = 0;
+	int ok = 1;
+	while (ok && fgets(line, sizeof(line), file))
+	{
+		number++;
+		char* start = line;
+		while (*start == ' ' || *start == '\t')
+		{
+			start++;
+		}
+		if (*start == '#' || *start == '\r' || *start == '\n' || *start == 0)
+		{
+			continue;
+		}
+
+		char* equals = strchr(start, '=');
+		char* end = equals;
+		char* action = equals ? equals + 1 : NULL;
+		while (end > start && (end[-1] == ' ' || end[-1] == '\t'))
+		{
+			end--;
+		}
+		while (action && (*action == ' ' || *action == '\t'))
+		{
+			action++;
+		}
+		char* actionEnd = action ? action + strlen(action) : NULL;
+		while (actionEnd > action && (actionEnd[-1] == ' ' || actionEnd[-1] == '\t' || actionEnd[-1] == '\r' || actionEnd[-1] == '\n'))
+		{
+			actionEnd--;
+		}
+		size_t actionLength = (size_t)(actionEnd - action);
+
+		DeviceRule* rule = &config->rules[config->ruleCount];
+		if (equals == NULL || end == start || end - start >= DEVICE_MAX_NAME || config->ruleCount == DEVICE_MAX_RULES)
+		{
+			snprintf(error, errorSize, "Line %d: expected \"<device> = disable\"", number);
+			ok = 0;
+		}
+		else if (IsWord(action, actionLength, "disable") || IsWord(action, actionLength, "enable"))
+		{
+			memcpy(rule->pattern, start, (size_t)(end - start));
+			rule->pattern[end - start] = 0;
+			rule->disabled = action[0] == 'd';
+			config->ruleCount++;
+		}
+		else
+		{
+			snprintf(error, errorSize, "Line %d: unknown action", number);
+			ok = 0;
+		}
+	}
+
+	fclose(file);
+	return ok;
+}
+
+
+int Devices_IsDisabled(const DeviceConfig* config, const char* name)
+{
+	for (int i = 0; i < config->ruleCount; i++)
+	{
+		if (ContainsNoCase(name, config->rules[i].pattern))
+		{
+			return config->rules[i].disabled;
+		}
+	}
+	return 0;
+}
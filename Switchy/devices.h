@@ -0,0 +1,82 @@
+#pragma once
+#include <stddef.h>
+#include <stdint.h>
+#include "sizes.h"
+
+// Attribution of low-level hook events to keyboards. The hook does not say
+// which device a key came from; Raw Input does, but Windows generates it
+// only after every low-level hook has let the key through, so its WM_INPUT
+// always comes after the hook event, and never for a key the hook blocked.
+// A hook event is attributed to the keyboard that was used last; its raw
+// event, matched per (key, direction) in arrival order, tells the real one.
+// The core holds back the decisions that depend on the keyboard until then
+// (see core.h). Each call is a few table lookups.
+//
+// Config syntax, one device per line (lines starting with '#' are comments):
+//   <part of the Raw Input device name> = disable
+//   <part of the Raw Input device name> = enable
+
+#define DEVICE_UNKNOWN 0
+
+// Key state that used to be global, now kept per keyboard
+typedef struct {
+	uint8_t capsProcessed;
+	uint8_t shiftProcessed;
+	uint8_t winPressed;
+	uint8_t capsUsed;
+	// The press of CapsLock went to the system, so does the rest of it
+	uint8_t capsPassed;
+} DeviceKeyState;
+
+typedef struct {
+	// 0 for a free slot
+	uintptr_t handle;
+	uint32_t lastUsed;
+	uint8_t disabled;
+	DeviceKeyState keys;
+} DeviceSlot;
+
+typedef struct {
+	// Slot 0 stands for keys seen before any Raw Input arrived
+	DeviceSlot slots[DEVICE_MAX];
+	// Hook events whose raw event has not arrived yet
+	uint8_t pending[256][2];
+	// Key of the last hook event counted in `pending`, with 0x100 for key down
+	uint16_t lastPending;
+	uint8_t lastSlot;
+	// Slot of the last press of every key; its auto-repeats and release
+	// belong to the same keyboard
+	uint8_t pressSlot[256];
+	uint8_t held[256];
+	uint32_t clock;
+} DeviceTracker;
+
+typedef struct {
+	char pattern[DEVICE_MAX_NAME];
+	uint8_t disabled;
+} DeviceRule;
+
+typedef struct {
+	DeviceRule rules[DEVICE_MAX_RULES];
+	int ruleCount;
+} DeviceConfig;
+
+void Devices_Init(DeviceTracker* tracker);
+// Finds or assigns the slot of a device; `added` is set when the slot is new
+// and must be configured. The least recently used device gives its slot up.
+uint8_t Devices_Slot(DeviceTracker* tracker, uintptr_t handle, int* added);
+void Devices_Remove(DeviceTracker* tracker, uintptr_t handle);
+
+// Raw Input side, returns 1 if the event is that of a hook event passed
+// earlier, 0 for a key the hook never saw
+int Devices_OnRaw(DeviceTracker* tracker, uint8_t slot, uint8_t vkCode, int down);
+// Hook side, returns the slot the key most likely came from
+uint8_t Devices_OnHook(DeviceTracker* tracker, uint8_t vkCode, int down);
+// A blocked key produces no raw event: called right after Devices_OnHook
+// for the same key, forgets the raw event the hook is waiting for
+void Devices_OnBlocked(DeviceTracker* tracker, uint8_t vkCode, int down);
+
+// Returns 0 and describes the first problem in `error` on a syntax error
+int Devices_LoadConfig(DeviceConfig* config, const char* path, char* error, size_t errorSize);
+// Returns 1 if the device with this name is disabled by the config
+int Devices_IsDisabled(const DeviceConfig* config, const char* name);
@@ -0,0 +1,153 @@
+#include "dict.h"
+#include <string.h>
+#ifdef _WIN32
+#include <Windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+#include "checked.h"
+
+
+static int Dict_Validate(Dict* dict)
+{
+	if (dict->size < sizeof(DictHeader))
+	{
+		return 0;
+	}
+
+	const DictHeader* header = (const DictHeader*)dict->view;
+	if (header->magic != DICT_MAGIC || header->version != DICT_VERSION ||
+		header->symbolCount > DICT_MAX_SYMBOLS || header->nodeCount == 0 ||
+		header->root >= header->nodeCount)
+	{
+		return 0;
+	}
+
+	uint64_t expected = sizeof(DictHeader) +
+		(uint64_t)header->nodeCount * sizeof(DictNode) +
+		(uint64_t)header->edgeCount * sizeof(uint32_t);
+	if (expected != dict->size)
+	{
+		return 0;
+	}
+
+	for (int vkCode = 0; vkCode < 256; vkCode++)
+	{
+		if (header->symbolOf[vkCode] >= header->symbolCount && header->symbolOf[vkCode] != DICT_NO_SYMBOL)
+		{
+			return 0;
+		}
+	}
+
+	// Every edge a node can step through lies in the edge table and leads to a node
+	const DictNode* nodes = (const DictNode*)(header + 1);
+	const uint32_t* edges = (const uint32_t*)(nodes + header->nodeCount);
+	uint64_t symbols = header->symbolCount < 64 ? (1ull << header->symbolCount) - 1 : ~0ull;
+	for (uint32_t i = 0; i < header->nodeCount; i++)
+	{
+		if ((nodes[i].mask & ~symbols) != 0 ||
+			(uint64_t)nodes[i].firstEdge + Dict_BitCount(nodes[i].mask) > header->edgeCount)
+		{
+			return 0;
+		}
+	}
+	for (uint32_t i = 0; i < header->edgeCount; i++)
+	{
+		if (edges[i] >= header->nodeCount)
+		{
+			return 0;
+		}
+	}
+
+	dict->header = header;
+	dict->nodes = nodes;
+	dict->edges = edges;
+	return 1;
+}
+
+
+int Dict_Open(Dict* dict, const char* path)
+{
+	memset(dict, 0, sizeof(*dict));
+
+#ifdef _WIN32
+	HANDLE hFile = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+	if (hFile == INVALID_HANDLE_VALUE)
+	{
+		return 0;
+	}
+
+	LARGE_INTEGER size;
+	if (!GetFileSizeEx(hFile, &size) || size.QuadPart == 0)
+	{
+		CloseHandle(hFile);
+		return 0;
+	}
+
+	HANDLE hMapping = CreateFileMappingA(hFile, NULL, PAGE_READONLY, 0, 0, NULL);
+	if (hMapping == NULL)
+	{
+		CloseHandle(hFile);
+		return 0;
+	}
+
+	dict->view = MapViewOfFile(hMapping, FILE_MAP_READ, 0, 0, 0);
+	dict->size = (size_t)size.QuadPart;
+	dict->hFile = hFile;
+	dict->hMapping = hMapping;
+#else
+	int fd = open(path, O_RDONLY);
+	if (fd < 0)
+	{
+		return 0;
+	}
+
+	struct stat st;
+	if (fstat(fd, &st) != 0 || st.st_size == 0)
+	{
+		close(fd);
+		return 0;
+	}
+
+	void* view = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	dict->view = view == MAP_FAILED ? NULL : view;
+	dict->size = (size_t)st.st_size;
+#endif
+
+	if (dict->view == NULL || !Dict_Validate(dict))
+	{
+		Dict_Close(dict);
+		return 0;
+	}
+
+	return 1;
+}
+
+
+void Dict_Close(Dict* dict)
+{
+#ifdef _WIN32
+	if (dict->view)
+	{
+		UnmapViewOfFile(dict->view);
+	}
+	if (dict->hMapping)
+	{
+		CloseHandle(dict->hMapping);
+	}
+	if (dict->hFile)
+	{
+		CloseHandle(dict->hFile);
+	}
+#else
+	if (dict->view)
+	{
+		munmap(dict->view, dict->size);
+	}
+#endif
+	memset(dict, 0, sizeof(*dict));
+}
@@ -0,0 +1,108 @@
+#pragma once
+#include <stddef.h>
+#include <stdint.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+// Compiled word dictionary (DAWG) keyed by virtual-key codes.
+// Words of both layouts are stored as the keys that type them, so a single
+// walk over the typed keys answers "is this a word in layout A or B".
+
+#define DICT_MAGIC 0x47445753u // "SWDG"
+#define DICT_VERSION 1
+#define DICT_MAX_SYMBOLS 64
+#define DICT_MAX_WORD 64
+#define DICT_NO_SYMBOL 0xFF
+#define DICT_NONE 0xFFFFFFFFu
+
+#define DICT_LAYOUT_A 0x1u
+#define DICT_LAYOUT_B 0x2u
+// Node flags: low byte - word ends here, second byte - some word continues from here
+#define DICT_WORD(flags) ((flags) & 0xFFu)
+#define DICT_PREFIX(flags) (((flags) >> 8) & 0xFFu)
+
+typedef struct {
+	uint32_t magic;
+	uint16_t version;
+	uint16_t symbolCount;
+	uint32_t nodeCount;
+	uint32_t edgeCount;
+	uint32_t root;
+	uint32_t reserved;
+	uint8_t symbolOf[256];
+} DictHeader;
+
+typedef struct {
+	uint64_t mask;
+	uint32_t firstEdge;
+	uint32_t flags;
+} DictNode;
+
+typedef struct {
+	const DictHeader* header;
+	const DictNode* nodes;
+	const uint32_t* edges;
+	void* view;
+	size_t size;
+#ifdef _WIN32
+	void* hFile;
+	void* hMapping;
+#endif
+} Dict;
+
+typedef struct {
+	uint32_t node;
+} DictCursor;
+
+// Checks every node and edge of the file once, so stepping through a
+// dictionary that opened never reads outside it
+int Dict_Open(Dict* dict, const char* path);
+void Dict_Close(Dict* dict);
+
+static inline void Dict_Reset(const Dict* dict, DictCursor* cursor)
+{
+	cursor->node = dict->header ? dict->header->root : DICT_NONE;
+}
+
+static inline uint32_t Dict_BitCount(uint64_t mask)
+{
+#if defined(_MSC_VER) && defined(_M_X64)
+	return (uint32_t)__popcnt64(mask);
+#elif defined(_MSC_VER)
+	return __popcnt((uint32_t)mask) + __popcnt((uint32_t)(mask >> 32));
+#else
+	return (uint32_t)__builtin_popcountll(mask);
+#endif
+}
+
+// Advances the cursor by one key and returns the flags of the reached node
+// (0 once the typed keys are no longer a prefix of any word).
+static inline uint32_t Dict_Step(const Dict* dict, DictCursor* cursor, uint8_t vkCode)
+{
+	if (cursor->node == DICT_NONE)
+	{
+		return 0;
+	}
+
+	uint32_t symbol = dict->header->symbolOf[vkCode];
+	const DictNode* node = &dict->nodes[cursor->node];
+	if (symbol == DICT_NO_SYMBOL || !((node->mask >> symbol) & 1))
+	{
+		cursor->node = DICT_NONE;
+		return 0;
+	}
+
+	uint32_t index = Dict_BitCount(node->mask & ((1ull << symbol) - 1));
+	cursor->node = dict->edges[node->firstEdge + index];
+	return dict->nodes[cursor->node].flags;
+}
+
+// Builder used by SwitchyTools to compile word lists into a dictionary file.
+typedef struct DictBuilder DictBuilder;
+
+DictBuilder* DictBuilder_Create();
+// Adds a word given as the virtual-key codes that type it in `layout`.
+int DictBuilder_Add(DictBuilder* builder, const uint8_t* keys, size_t length, uint32_t layout);
+int DictBuilder_Write(DictBuilder* builder, const char* path);
+void DictBuilder_Destroy(DictBuilder* builder);
@@ -0,0 +1,317 @@
+#include "dict.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Words are first inserted into a plain trie, then the trie is minimized
+// bottom-up: every node is replaced with an already emitted node that has
+// the same flags and the same children, which turns it into a DAWG.
+
+typedef struct {
+	uint64_t mask;
+	uint32_t flags;
+	uint32_t count;
+	uint32_t capacity;
+	uint32_t* children;
+} TrieNode;
+
+struct DictBuilder {
+	uint8_t symbolOf[256];
+	uint32_t symbolCount;
+
+	TrieNode* trie;
+	uint32_t trieCount;
+	uint32_t trieCapacity;
+
+	DictNode* nodes;
+	uint32_t nodeCount;
+	uint32_t nodeCapacity;
+	uint32_t* edges;
+	uint32_t edgeCount;
+	uint32_t edgeCapacity;
+
+	uint32_t* registry;
+	uint32_t registryCapacity;
+};
+
+
+static int Grow(void** items, uint32_t* capacity, uint32_t needed, size_t itemSize)
+{
+	if (needed <= *capacity)
+	{
+		return 1;
+	}
+
+	uint32_t newCapacity = *capacity ? *capacity : 64;
+	while (newCapacity < needed)
+	{
+		newCapacity *= 2;
+	}
+
+	void* grown = realloc(*items, (size_t)newCapacity * itemSize);
+	if (grown == NULL)
+	{
+		return 0;
+	}
+
+	*items = grown;
+	*capacity = newCapacity;
+	return 1;
+}
+
+
+static uint32_t PopCount(uint64_t value)
+{
+	uint32_t count = 0;
+	for (; value; value &= value - 1)
+	{
+		count++;
+	}
+	return count;
+}
+
+
+static uint32_t NewTrieNode(DictBuilder* builder)
+{
+	if (!Grow((void**)&builder->trie, &builder->trieCapacity, builder->trieCount + 1, sizeof(TrieNode)))
+	{
+		return DICT_NONE;
+	}
+
+	memset(&builder->trie[builder->trieCount], 0, sizeof(TrieNode));
+	return builder->trieCount++;
+}
+
+
+DictBuilder* DictBuilder_Create()
+{
+	DictBuilder* builder = calloc(1, sizeof(DictBuilder));
+	if (builder == NULL)
+	{
+		return NULL;
+	}
+
+	memset(builder->symbolOf, DICT_NO_SYMBOL, sizeof(builder->symbolOf));
+	if (NewTrieNode(builder) == DICT_NONE)
+	{
+		free(builder);
+		return NULL;
+	}
+
+	return builder;
+}
+
+
+int DictBuilder_Add(DictBuilder* builder, const uint8_t* keys, size_t length, uint32_t layout)
+{
+	if (length == 0 || length > DICT_MAX_WORD || layout == 0 || layout > 0xFF)
+	{
+		return 0;
+	}
+
+	uint32_t current = 0;
+	for (size_t i = 0; i < length; i++)
+	{
+		uint32_t symbol = builder->symbolOf[keys[i]];
+		if (symbol == DICT_NO_SYMBOL)
+		{
+			if (builder->symbolCount == DICT_MAX_SYMBOLS)
+			{
+				return 0;
+			}
+			symbol = builder->symbolCount++;
+			builder->symbolOf[keys[i]] = (uint8_t)symbol;
+		}
+
+		builder->trie[current].flags |= layout << 8;
+
+		uint64_t bit = 1ull << symbol;
+		uint32_t index = PopCount(builder->trie[current].mask & (bit - 1));
+		if (builder->trie[current].mask & bit)
+		{
+			current = builder->trie[current].children[index];
+			continue;
+		}
+
+		uint32_t child = NewTrieNode(builder);
+		if (child == DICT_NONE)
+		{
+			return 0;
+		}
+
+		TrieNode* node = &builder->trie[current];
+		if (!Grow((void**)&node->children, &node->capacity, node->count + 1, sizeof(uint32_t)))
+		{
+			return 0;
+		}
+		memmove(&node->children[index + 1], &node->children[index], (node->count - index) * sizeof(uint32_t));
+		node->children[index] = child;
+		node->count++;
+		node->mask |= bit;
+		current = child;
+	}
+
+	builder->trie[current].flags |= layout;
+	return 1;
+}
+
+
+static uint32_t HashNode(uint64_t mask, uint32_t flags, const uint32_t* children, uint32_t count)
+{
+	uint64_t hash = 1469598103934665603ull ^ mask ^ ((uint64_t)flags << 32);
+	for (uint32_t i = 0; i < count; i++)
+	{
+		hash = (hash ^ children[i]) * 1099511628211ull;
+	}
+	return (uint32_t)(hash ^ (hash >> 32));
+}
+
+
+static int RegistryInsert(DictBuilder* builder, uint32_t node, uint32_t hash)
+{
+	uint32_t mask = builder->registryCapacity - 1;
+	for (uint32_t slot = hash & mask;; slot = (slot + 1) & mask)
+	{
+		if (builder->registry[slot] == DICT_NONE)
+		{
+			builder->registry[slot] = node;
+			return 1;
+		}
+	}
+}
+
+
+static int RegistryReserve(DictBuilder* builder)
+{
+	if ((uint64_t)(builder->nodeCount + 1) * 2 <= builder->registryCapacity)
+	{
+		return 1;
+	}
+
+	uint32_t capacity = builder->registryCapacity ? builder->registryCapacity * 2 : 1024;
+	uint32_t* registry = malloc((size_t)capacity * sizeof(uint32_t));
+	if (registry == NULL)
+	{
+		return 0;
+	}
+
+	free(builder->registry);
+	builder->registry = registry;
+	builder->registryCapacity = capacity;
+	memset(registry, 0xFF, (size_t)capacity * sizeof(uint32_t));
+
+	for (uint32_t i = 0; i < builder->nodeCount; i++)
+	{
+		const DictNode* node = &builder->nodes[i];
+		RegistryInsert(builder, i, HashNode(node->mask, node->flags, &builder->edges[node->firstEdge], PopCount(node->mask)));
+	}
+	return 1;
+}
+
+
+// Returns the index of the minimized node equivalent to the given trie node.
+static uint32_t Minimize(DictBuilder* builder, uint32_t trieIndex)
+{
+	uint32_t children[DICT_MAX_SYMBOLS];
+	TrieNode* node = &builder->trie[trieIndex];
+	uint32_t count = node->count;
+
+	for (uint32_t i = 0; i < count; i++)
+	{
+		children[i] = Minimize(builder, builder->trie[trieIndex].children[i]);
+		if (children[i] == DICT_NONE)
+		{
+			return DICT_NONE;
+		}
+	}
+
+	node = &builder->trie[trieIndex];
+	if (!RegistryReserve(builder))
+	{
+		return DICT_NONE;
+	}
+
+	uint32_t hash = HashNode(node->mask, node->flags, children, count);
+	uint32_t mask = builder->registryCapacity - 1;
+	for (uint32_t slot = hash & mask; builder->registry[slot] != DICT_NONE; slot = (slot + 1) & mask)
+	{
+		const DictNode* existing = &builder->nodes[builder->registry[slot]];
+		if (existing->mask == node->mask && existing->flags == node->flags &&
+			memcmp(&builder->edges[existing->firstEdge], children, count * sizeof(uint32_t)) == 0)
+		{
+			return builder->registry[slot];
+		}
+	}
+
+	if (!Grow((void**)&builder->nodes, &builder->nodeCapacity, builder->nodeCount + 1, sizeof(DictNode)) ||
+		!Grow((void**)&builder->edges, &builder->edgeCapacity, builder->edgeCount + count, sizeof(uint32_t)))
+	{
+		return DICT_NONE;
+	}
+
+	DictNode* out = &builder->nodes[builder->nodeCount];
+	out->mask = node->mask;
+	out->flags = node->flags;
+	out->firstEdge = builder->edgeCount;
+	memcpy(&builder->edges[builder->edgeCount], children, count * sizeof(uint32_t));
+	builder->edgeCount += count;
+
+	RegistryInsert(builder, builder->nodeCount, hash);
+	return builder->nodeCount++;
+}
+
+
+int DictBuilder_Write(DictBuilder* builder, const char* path)
+{
+	builder->nodeCount = 0;
+	builder->edgeCount = 0;
+	free(builder->registry);
+	builder->registry = NULL;
+	builder->registryCapacity = 0;
+
+	uint32_t root = Minimize(builder, 0);
+	if (root == DICT_NONE)
+	{
+		return 0;
+	}
+
+	DictHeader header;
+	memset(&header, 0, sizeof(header));
+	header.magic = DICT_MAGIC;
+	header.version = DICT_VERSION;
+	header.symbolCount = (uint16_t)builder->symbolCount;
+	header.nodeCount = builder->nodeCount;
+	header.edgeCount = builder->edgeCount;
+	header.root = root;
+	memcpy(header.symbolOf, builder->symbolOf, sizeof(header.symbolOf));
+
+	FILE* file = fopen(path, "wb");
+	if (file == NULL)
+	{
+		return 0;
+	}
+
+	int ok = fwrite(&header, sizeof(header), 1, file) == 1 &&
+		fwrite(builder->nodes, sizeof(DictNode), builder->nodeCount, file) == builder->nodeCount &&
+		fwrite(builder->edges, sizeof(uint32_t), builder->edgeCount, file) == builder->edgeCount;
+	return fclose(file) == 0 && ok;
+}
+
+
+void DictBuilder_Destroy(DictBuilder* builder)
+{
+	if (builder == NULL)
+	{
+		return;
+	}
+
+	for (uint32_t i = 0; i < builder->trieCount; i++)
+	{
+		free(builder->trie[i].children);
+	}
+	free(builder->trie);
+	free(builder->nodes);
+	free(builder->edges);
+	free(builder->registry);
+	free(builder);
+}
@@ -0,0 +1,25 @@
+#pragma once
+
+// An engine tells Switchy about its trigger keys. The hook engine sees every
+// keystroke and supports all features; the hotkey engine registers only the
+// trigger combinations with the system and costs nothing per keystroke.
+// Engines of other platforms implement the same interface.
+
+typedef enum {
+	TRIGGER_SWITCH,     // CapsLock
+	TRIGGER_CAPS_LOCK,  // Shift+CapsLock
+	TRIGGER_ENABLE,     // Alt+CapsLock
+	TRIGGER_CONVERT,    // Shift+Alt+CapsLock
+	TRIGGERS
+} EngineTrigger;
+
+typedef void (*EngineHandler)(EngineTrigger trigger);
+
+typedef struct {
+	const char* name;
+	// Returns 0 if the engine cannot run
+	int (*Start)(EngineHandler handler);
+	void (*Stop)(void);
+	// While Switchy is disabled the engine only has to deliver TRIGGER_ENABLE
+	void (*SetEnabled)(int enabled);
+} Engine;
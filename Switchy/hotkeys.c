@@ -0,0 +1,167 @@
+#include "hotkeys.h"
+
+#define ALL_TRIGGERS ((1u << TRIGGERS) - 1)
+// Posted to the hotkey window once a handler has run
+#define WM_TRIGGERS_RESTORE (WM_APP + 1)
+// Hotkeys fire on the press, the layout switches on the release as with
+// the hook: CapsLock is polled until it goes up
+#define RELEASE_TIMER 1
+#define RELEASE_POLL 10
+
+static const UINT triggerModifiers[TRIGGERS] = {
+	0,                    // TRIGGER_SWITCH
+	MOD_SHIFT,            // TRIGGER_CAPS_LOCK
+	MOD_ALT,              // TRIGGER_ENABLE
+	MOD_SHIFT | MOD_ALT,  // TRIGGER_CONVERT
+};
+
+static HWND hWindow = NULL;
+static EngineHandler triggerHandler = NULL;
+static unsigned registered = 0;
+static unsigned requested = 0;
+// From a trigger until the keys its handler injected have gone by
+static BOOL dispatching = FALSE;
+
+
+static BOOL RegisterTriggers(unsigned triggers)
+{
+	BOOL ok = TRUE;
+	for (int trigger = 0; trigger < TRIGGERS; trigger++)
+	{
+		unsigned bit = 1u << trigger;
+		if ((registered & bit) && !(triggers & bit))
+		{
+			UnregisterHotKey(hWindow, trigger);
+			registered &= ~bit;
+		}
+		else if (!(registered & bit) && (triggers & bit))
+		{
+			if (RegisterHotKey(hWindow, trigger, triggerModifiers[trigger] | MOD_NOREPEAT, VK_CAPITAL))
+			{
+				registered |= bit;
+			}
+			else
+			{
+				ok = FALSE;
+			}
+		}
+	}
+	return ok;
+}
+
+
+static void Dispatch(HWND hWnd, EngineTrigger trigger)
+{
+	// Keys the handler injects would fire the hotkeys again. The system
+	// takes them in before this thread gets the message posted after them,
+	// so the hotkeys come back only then.
+	if (!dispatching)
+	{
+		requested = registered;
+		RegisterTriggers(0);
+		dispatching = TRUE;
+	}
+	triggerHandler(trigger);
+	PostMessage(hWnd, WM_TRIGGERS_RESTORE, 0, 0);
+}
+
+
+static LRESULT CALLBACK HotkeyWindowProc(HWND hWnd, UINT message, WPARAM wParam, LPARAM lParam)
+{
+	if (message == WM_HOTKEY && wParam == TRIGGER_SWITCH)
+	{
+		SetTimer(hWnd, RELEASE_TIMER, RELEASE_POLL, NULL);
+		return 0;
+	}
+	if (message == WM_TIMER && wParam == RELEASE_TIMER)
+	{
+		if (!(GetAsyncKeyState(VK_CAPITAL) & 0x8000))
+		{
+			KillTimer(hWnd, RELEASE_TIMER);
+			if (triggerHandler != NULL)
+			{
+				Dispatch(hWnd, TRIGGER_SWITCH);
+			}
+		}
+		return 0;
+	}
+	if (message == WM_HOTKEY && wParam < TRIGGERS && triggerHandler != NULL)
+	{
+		Dispatch(hWnd, (EngineTrigger)wParam);
+		return 0;
+	}
+	if (message == WM_TRIGGERS_RESTORE)
+	{
+		dispatching = FALSE;
+		RegisterTriggers(requested);
+		return 0;
+	}
+	return DefWindowProc(hWnd, message, wParam, lParam);
+}
+
+
+BOOL Hotkeys_Register(unsigned triggers, EngineHandler handler)
+{
+	if (hWindow == NULL)
+	{
+		WNDCLASS windowClass = { 0 };
+		windowClass.lpfnWndProc = HotkeyWindowProc;
+		windowClass.hInstance = GetModuleHandle(NULL);
+		windowClass.lpszClassName = "SwitchyHotkeys";
+		RegisterClass(&windowClass);
+		hWindow = CreateWindowEx(0, "SwitchyHotkeys", "", 0, 0, 0, 0, 0, HWND_MESSAGE, NULL, windowClass.hInstance, NULL);
+		if (hWindow == NULL)
+		{
+			return FALSE;
+		}
+	}
+
+	triggerHandler = handler;
+	// A switch waiting for CapsLock to go up no longer happens
+	if (!(triggers & (1u << TRIGGER_SWITCH)))
+	{
+		KillTimer(hWindow, RELEASE_TIMER);
+	}
+	if (dispatching)
+	{
+		requested = triggers;
+		return TRUE;
+	}
+	return RegisterTriggers(triggers);
+}
+
+
+void Hotkeys_Unregister()
+{
+	if (hWindow != NULL)
+	{
+		KillTimer(hWindow, RELEASE_TIMER);
+	}
+	if (dispatching)
+	{
+		requested = 0;
+		return;
+	}
+	RegisterTriggers(0);
+}
+
+
+static int HotkeyStart(EngineHandler handler)
+{
+	return Hotkeys_Register(ALL_TRIGGERS, handler);
+}
+
+
+static void HotkeyStop()
+{
+	Hotkeys_Unregister();
+}
+
+
+static void HotkeySetEnabled(int enabled)
+{
+	Hotkeys_Register(enabled ? ALL_TRIGGERS : 1u << TRIGGER_ENABLE, triggerHandler);
+}
+
+
+const Engine hotkeyEngine = { "hotkeys", HotkeyStart, HotkeyStop, HotkeySetEnabled };
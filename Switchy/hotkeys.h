@@ -0,0 +1,13 @@
+#pragma once
+#include <Windows.h>
+#include "engine.h"
+
+// System hotkeys for the trigger combinations. Used on its own as the
+// hookless engine, and by the hook engine to wait for Alt+CapsLock while
+// Switchy is disabled and the hook is removed.
+
+extern const Engine hotkeyEngine;
+
+// `triggers` is a mask of (1 << EngineTrigger); replaces the current set
+BOOL Hotkeys_Register(unsigned triggers, EngineHandler handler);
+void Hotkeys_Unregister();
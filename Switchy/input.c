@@ -0,0 +1,49 @@
+#include "input.h"
+#include "checked.h"
+
+
+void PressKey(int keyCode)
+{
+	keybd_event(keyCode, 0, 0, 0);
+}
+
+
+void ReleaseKey(int keyCode)
+{
+	keybd_event(keyCode, 0, KEYEVENTF_KEYUP, 0);
+}
+
+
+void SendText(const WCHAR* text, int length)
+{
+	// Characters go out in batches of key down/up pairs, one SendInput call per batch
+	INPUT inputs[64];
+	int count = 0;
+	for (int i = 0; i < length; i++)
+	{
+		for (int up = 0; up < 2; up++)
+		{
+			ZeroMemory(&inputs[count], sizeof(INPUT));
+			inputs[count].type = INPUT_KEYBOARD;
+			inputs[count].ki.wScan = text[i];
+			inputs[count].ki.dwFlags = KEYEVENTF_UNICODE | (up ? KEYEVENTF_KEYUP : 0);
+			count++;
+		}
+
+		if (count == sizeof(inputs) / sizeof(inputs[0]) || i == length - 1)
+		{
+			SendInput(count, inputs, sizeof(INPUT));
+			count = 0;
+		}
+	}
+}
+
+
+void SelectLayout(HKL hkl)
+{
+	HWND hWnd = GetForegroundWindow();
+	if (hWnd != NULL)
+	{
+		PostMessage(hWnd, WM_INPUTLANGCHANGEREQUEST, 0, (LPARAM)hkl);
+	}
+}
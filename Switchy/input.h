@@ -0,0 +1,7 @@
+#pragma once
+#include <Windows.h>
+
+void PressKey(int keyCode);
+void ReleaseKey(int keyCode);
+void SendText(const WCHAR* text, int length);
+void SelectLayout(HKL hkl);
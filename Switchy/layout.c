@@ -0,0 +1,35 @@
+#include "layout.h"
+#include <string.h>
+
+// Do not change the keyboard state (dead keys) while querying (Windows 10 1607+)
+#define TOUNICODE_NO_STATE_CHANGE 0x4
+
+
+BOOL Layout_Load(KeyLayout* layout, HKL hkl)
+{
+	BYTE keyState[256] = { 0 };
+	int found = 0;
+	memset(layout, 0, sizeof(*layout));
+
+	for (UINT vk = 1; vk < 256; vk++)
+	{
+		UINT scanCode = MapVirtualKeyEx(vk, MAPVK_VK_TO_VSC, hkl);
+		if (scanCode == 0)
+		{
+			continue;
+		}
+
+		for (int shift = LAYOUT_PLAIN; shift <= LAYOUT_SHIFT; shift++)
+		{
+			WCHAR buffer[4];
+			keyState[VK_SHIFT] = shift ? 0x80 : 0;
+			if (ToUnicodeEx(vk, scanCode, keyState, buffer, 4, TOUNICODE_NO_STATE_CHANGE, hkl) == 1 && buffer[0] >= 0x20)
+			{
+				layout->chars[vk][shift] = buffer[0];
+				found++;
+			}
+		}
+	}
+
+	return found > 0;
+}
@@ -0,0 +1,18 @@
+#pragma once
+#include <stdint.h>
+
+// Characters produced by every virtual key of one keyboard layout,
+// without and with Shift. Zero means the key produces no single character.
+
+#define LAYOUT_PLAIN 0
+#define LAYOUT_SHIFT 1
+
+typedef struct {
+	uint16_t chars[256][2];
+} KeyLayout;
+
+#ifdef _WIN32
+#include <Windows.h>
+
+BOOL Layout_Load(KeyLayout* layout, HKL hkl);
+#endif
@@ -0,0 +1,382 @@
+#include "macro.h"
+#include <ctype.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#ifndef _WIN32
+#include <strings.h>
+#endif
+#include "checked.h"
+
+#define MAX_CONFIG (256 * 1024)
+
+typedef struct {
+	const char* name;
+	uint8_t vkCode;
+} KeyName;
+
+// Low-level hooks report the left/right variants of Shift, Ctrl and Alt,
+// so the plain names stand for the left keys.
+static const KeyName keyNames[] = {
+	{ "Backspace", 0x08 }, { "Tab", 0x09 }, { "Enter", 0x0D }, { "Pause", 0x13 },
+	{ "CapsLock", 0x14 }, { "Esc", 0x1B }, { "Space", 0x20 }, { "PageUp", 0x21 },
+	{ "PageDown", 0x22 }, { "End", 0x23 }, { "Home", 0x24 }, { "Left", 0x25 },
+	{ "Up", 0x26 }, { "Right", 0x27 }, { "Down", 0x28 }, { "Insert", 0x2D },
+	{ "Delete", 0x2E }, { "LWin", 0x5B }, { "RWin", 0x5C }, { "Apps", 0x5D },
+	{ "ScrollLock", 0x91 }, { "Shift", 0xA0 }, { "LShift", 0xA0 }, { "RShift", 0xA1 },
+	{ "Ctrl", 0xA2 }, { "LCtrl", 0xA2 }, { "RCtrl", 0xA3 }, { "Alt", 0xA4 },
+	{ "LAlt", 0xA4 }, { "RAlt", 0xA5 },
+};
+
+
+static int ParseKey(const char* token, size_t length, uint8_t* vkCode)
+{
+	char name[16];
+	if (length == 0 || length >= sizeof(name))
+	{
+		return 0;
+	}
+	memcpy(name, token, length);
+	name[length] = 0;
+
+	if (length == 1 && isalnum((unsigned char)name[0]))
+	{
+		*vkCode = (uint8_t)toupper((unsigned char)name[0]);
+		return 1;
+	}
+	if ((name[0] == 'F' || name[0] == 'f') && isdigit((unsigned char)name[1]))
+	{
+		int number = atoi(name + 1);
+		if (number >= 1 && number <= 24)
+		{
+			*vkCode = (uint8_t)(0x70 + number - 1);
+			return 1;
+		}
+	}
+	if (name[0] == '0' && (name[1] == 'x' || name[1] == 'X'))
+	{
+		char* end;
+		long value = strtol(name + 2, &end, 16);
+		if (*end == 0 && value > 0 && value < 0xFF)
+		{
+			*vkCode = (uint8_t)value;
+			return 1;
+		}
+	}
+	for (size_t i = 0; i < sizeof(keyNames) / sizeof(keyNames[0]); i++)
+	{
+#ifdef _WIN32
+		if (_stricmp(keyNames[i].name, name) == 0)
+#else
+		if (strcasecmp(keyNames[i].name, name) == 0)
+#endif
+		{
+			*vkCode = keyNames[i].vkCode;
+			return 1;
+		}
+	}
+	return 0;
+}
+
+
+// Letters, digits, Space, the numeric keypad and the punctuation keys
+static int TypesCharacter(uint8_t vkCode)
+{
+	return vkCode == 0x20 || (vkCode >= '0' && vkCode <= '9') || (vkCode >= 'A' && vkCode <= 'Z') ||
+		(vkCode >= 0x60 && vkCode <= 0x6F) || (vkCode >= 0xBA && vkCode <= 0xC0) ||
+		(vkCode >= 0xDB && vkCode <= 0xDF) || vkCode == 0xE2;
+}
+
+
+// Appends UTF-8 text to the pool as UTF-16
+static int AddText(MacroSet* set, MacroAction* action, const char* text, size_t length)
+{
+	action->textOffset = set->textUsed;
+	for (size_t i = 0; i < length;)
+	{
+		unsigned char lead = (unsigned char)text[i];
+		int extra = lead < 0x80 ? 0 : lead < 0xE0 ? 1 : lead < 0xF0 ? 2 : 3;
+		uint32_t code = extra == 0 ? lead : lead & (0x3F >> extra);
+		if ((lead >= 0x80 && lead < 0xC0) || i + extra >= length)
+		{
+			return 0;
+		}
+		for (int k = 1; k <= extra; k++)
+		{
+			code = (code << 6) | ((unsigned char)text[i + k] & 0x3F);
+		}
+		i += 1 + extra;
+
+		int units = code >= 0x10000 ? 2 : 1;
+		if (set->textUsed + units > MACRO_TEXT_POOL)
+		{
+			return 0;
+		}
+		if (units == 2)
+		{
+			code -= 0x10000;
+			set->text[set->textUsed++] = (uint16_t)(0xD800 | (code >> 10));
+			set->text[set->textUsed++] = (uint16_t)(0xDC00 | (code & 0x3FF));
+		}
+		else
+		{
+			set->text[set->textUsed++] = (uint16_t)code;
+		}
+	}
+
+	action->textLength = (uint16_t)(set->textUsed - action->textOffset);
+	return action->textLength > 0;
+}
+
+
+static const char* SkipSpaces(const char* text, const char* end)
+{
+	while (text < end && (*text == ' ' || *text == '\t'))
+	{
+		text++;
+	}
+	return text;
+}
+
+
+static int ParseAction(MacroSet* set, MacroAction* action, const char* text, const char* end)
+{
+	text = SkipSpaces(text, end);
+	while (end > text && (end[-1] == ' ' || end[-1] == '\t'))
+	{
+		end--;
+	}
+
+	const char* word = text;
+	while (text < end && *text != ' ' && *text != '\t')
+	{
+		text++;
+	}
+	size_t wordLength = (size_t)(text - word);
+	text = SkipSpaces(text, end);
+
+	if (wordLength == 6 && memcmp(word, "switch", 6) == 0 && text == end)
+	{
+		action->type = MACRO_SWITCH;
+		return 1;
+	}
+	if (wordLength == 6 && memcmp(word, "layout", 6) == 0 && end - text == 8)
+	{
+		action->type = MACRO_LAYOUT;
+		memcpy(action->layout, text, 8);
+		action->layout[8] = 0;
+		return 1;
+	}
+	if (wordLength == 4 && memcmp(word, "text", 4) == 0 && text < end)
+	{
+		action->type = MACRO_TEXT;
+		return AddText(set, action, text, (size_t)(end - text));
+	}
+	return 0;
+}
+
+
+static uint16_t NewState(MacroSet* set)
+{
+	if (set->stateCount == MACRO_MAX_STATES)
+	{
+		return MACRO_NONE;
+	}
+
+	uint16_t state = set->stateCount++;
+	for (int symbol = 0; symbol < MACRO_MAX_SYMBOLS; symbol++)
+	{
+		set->next[state][symbol] = MACRO_NONE;
+	}
+	set->output[state] = MACRO_NONE;
+	return state;
+}
+
+
+int Macro_Compile(MacroSet* set, const char* config, char* error, size_t errorSize)
+{
+	static uint8_t keys[MACRO_MAX_ACTIONS][MACRO_MAX_KEYS];
+	static uint8_t keyCount[MACRO_MAX_ACTIONS];
+	uint16_t fail[MACRO_MAX_STATES];
+	uint16_t queue[MACRO_MAX_STATES];
+
+	memset(set, 0, sizeof(*set));
+	set->symbolCount = 1;
+	NewState(set);
+	error[0] = 0;
+
+	// Build the trie of all sequences
+	int line = 0;
+	for (const char* text = config; *text;)
+	{
+		const char* end = text + strcspn(text, "\r\n");
+		const char* next = *end ? end + 1 : end;
+		const char* equals = memchr(text, '=', (size_t)(end - text));
+		const char* first = SkipSpaces(text, end);
+		line++;
+
+		if (first == end || *first == '#')
+		{
+			text = next;
+			continue;
+		}
+		if (equals == NULL || set->actionCount == MACRO_MAX_ACTIONS)
+		{
+			snprintf(error, errorSize, "Line %d: expected \"<keys> = <action>\"", line);
+			return 0;
+		}
+
+		uint16_t index = set->actionCount;
+		MacroAction* action = &set->actions[index];
+		action->line = line;
+		if (!ParseAction(set, action, equals + 1, end))
+		{
+			snprintf(error, errorSize, "Line %d: unknown action", line);
+			return 0;
+		}
+
+		uint16_t state = 0;
+		int typed = 0, lastTyped = 0;
+		keyCount[index] = 0;
+		for (const char* token = SkipSpaces(text, equals); token < equals; token = SkipSpaces(token, equals))
+		{
+			size_t length = strcspn(token, " \t=");
+			uint8_t vkCode;
+			if (!ParseKey(token, length, &vkCode) || keyCount[index] == MACRO_MAX_KEYS)
+			{
+				snprintf(error, errorSize, "Line %d: unknown key \"%.*s\"", line, (int)length, token);
+				return 0;
+			}
+			token += length;
+			lastTyped = TypesCharacter(vkCode);
+			typed += lastTyped;
+
+			if (set->symbolOf[vkCode] == MACRO_OTHER_SYMBOL)
+			{
+				if (set->symbolCount == MACRO_MAX_SYMBOLS)
+				{
+					snprintf(error, errorSize, "Line %d: too many different keys", line);
+					return 0;
+				}
+				set->symbolOf[vkCode] = (uint8_t)set->symbolCount++;
+			}
+
+			uint8_t symbol = set->symbolOf[vkCode];
+			keys[index][keyCount[index]++] = symbol;
+			if (set->next[state][symbol] == MACRO_NONE)
+			{
+				uint16_t child = NewState(set);
+				if (child == MACRO_NONE)
+				{
+					snprintf(error, errorSize, "Line %d: too many macros", line);
+					return 0;
+				}
+				set->next[state][symbol] = child;
+			}
+			state = set->next[state][symbol];
+		}
+
+		if (keyCount[index] == 0)
+		{
+			snprintf(error, errorSize, "Line %d: no keys", line);
+			return 0;
+		}
+		if (set->output[state] != MACRO_NONE)
+		{
+			snprintf(error, errorSize, "Line %d: same keys as line %d", line, set->actions[set->output[state]].line);
+			return 0;
+		}
+		set->output[state] = index;
+		if (action->type == MACRO_TEXT)
+		{
+			action->erase = (uint8_t)(typed - lastTyped);
+		}
+		set->actionCount++;
+		text = next;
+	}
+
+	// Turn the trie into a complete automaton: a missing transition continues
+	// from the longest suffix that is still a prefix of some sequence, and a
+	// state inherits the action of that suffix if it has none of its own.
+	int head = 0, tail = 0;
+	for (int symbol = 0; symbol < MACRO_MAX_SYMBOLS; symbol++)
+	{
+		uint16_t child = set->next[0][symbol];
+		if (child == MACRO_NONE)
+		{
+			set->next[0][symbol] = 0;
+		}
+		else
+		{
+			fail[child] = 0;
+			queue[tail++] = child;
+		}
+	}
+	while (head < tail)
+	{
+		uint16_t state = queue[head++];
+		for (int symbol = 0; symbol < MACRO_MAX_SYMBOLS; symbol++)
+		{
+			uint16_t child = set->next[state][symbol];
+			if (child == MACRO_NONE)
+			{
+				set->next[state][symbol] = set->next[fail[state]][symbol];
+				continue;
+			}
+
+			fail[child] = set->next[fail[state]][symbol];
+			if (set->output[child] == MACRO_NONE)
+			{
+				set->output[child] = set->output[fail[child]];
+			}
+			queue[tail++] = child;
+		}
+	}
+
+	// A sequence is ambiguous if another one fires while it is being typed
+	for (uint16_t index = 0; index < set->actionCount; index++)
+	{
+		uint16_t state = 0;
+		for (int i = 0; i < keyCount[index]; i++)
+		{
+			state = set->next[state][keys[index][i]];
+			uint16_t fired = set->output[state];
+			if (fired != MACRO_NONE && fired != index)
+			{
+				snprintf(error, errorSize, "Line %d never fires: line %d fires first",
+					set->actions[index].line, set->actions[fired].line);
+				return 0;
+			}
+		}
+	}
+
+	return 1;
+}
+
+
+int Macro_LoadFile(MacroSet* set, const char* path, char* error, size_t errorSize)
+{
+	FILE* file = fopen(path, "rb");
+	if (file == NULL)
+	{
+		snprintf(error, errorSize, "Cannot open \"%s\"", path);
+		return 0;
+	}
+
+	char* config = malloc(MAX_CONFIG + 1);
+	size_t size = config ? fread(config, 1, MAX_CONFIG + 1, file) : 0;
+	fclose(file);
+	if (config == NULL || size > MAX_CONFIG)
+	{
+		snprintf(error, errorSize, "\"%s\" is too large", path);
+		free(config);
+		return 0;
+	}
+
+	config[size] = 0;
+	// Skip the UTF-8 byte order mark Notepad likes to add
+	int skip = size >= 3 && memcmp(config, "\xEF\xBB\xBF", 3) == 0 ? 3 : 0;
+	int ok = Macro_Compile(set, config + skip, error, errorSize);
+	free(config);
+	return ok;
+}
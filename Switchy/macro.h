@@ -0,0 +1,90 @@
+#pragma once
+#include <stddef.h>
+#include <stdint.h>
+#include "sizes.h"
+
+// User key sequences ("CapsLock E = layout 00000409") compiled into a single
+// deterministic automaton over key presses. Advancing it is one table lookup
+// per key, with no backtracking and no allocation.
+//
+// Config syntax, one macro per line (lines starting with '#' are comments):
+//   <key> [<key> ...] = switch
+//   <key> [<key> ...] = layout <KLID>
+//   <key> [<key> ...] = text <UTF-8 text>
+
+#define MACRO_NONE 0xFFFF
+#define MACRO_OTHER_SYMBOL 0
+
+typedef enum {
+	MACRO_SWITCH,
+	MACRO_LAYOUT,
+	MACRO_TEXT
+} MacroActionType;
+
+typedef struct {
+	MacroActionType type;
+	int line;
+	char layout[9];
+	// UTF-16 text in the set's text pool
+	uint16_t textOffset;
+	uint16_t textLength;
+	// Only the last key of a sequence is swallowed: the characters the keys
+	// before it typed are erased before the text
+	uint8_t erase;
+} MacroAction;
+
+typedef struct {
+	uint8_t symbolOf[256];
+	uint16_t symbolCount;
+	uint16_t stateCount;
+	uint16_t actionCount;
+	uint16_t textUsed;
+	uint16_t next[MACRO_MAX_STATES][MACRO_MAX_SYMBOLS];
+	uint16_t output[MACRO_MAX_STATES];
+	MacroAction actions[MACRO_MAX_ACTIONS];
+	uint16_t text[MACRO_TEXT_POOL];
+} MacroSet;
+
+typedef struct {
+	uint16_t state;
+	uint8_t heldKey;
+} MacroState;
+
+// Both return 0 and describe the first problem in `error` when the config
+// has a syntax error or a macro that can never fire.
+int Macro_Compile(MacroSet* set, const char* config, char* error, size_t errorSize);
+int Macro_LoadFile(MacroSet* set, const char* path, char* error, size_t errorSize);
+
+static inline int Macro_IsModifier(uint8_t vkCode)
+{
+	return (vkCode >= 0x10 && vkCode <= 0x12) || (vkCode >= 0xA0 && vkCode <= 0xA5) || vkCode == 0x5B || vkCode == 0x5C;
+}
+
+// Feeds one key event, returns the index of the fired action or MACRO_NONE.
+static inline uint16_t Macro_OnKey(const MacroSet* set, MacroState* state, uint8_t vkCode, int down)
+{
+	if (!down)
+	{
+		if (state->heldKey == vkCode)
+		{
+			state->heldKey = 0;
+		}
+		return MACRO_NONE;
+	}
+
+	uint8_t symbol = set->symbolOf[vkCode];
+	// Auto-repeat and modifiers that no macro uses don't break a sequence
+	if (state->heldKey == vkCode || (symbol == MACRO_OTHER_SYMBOL && Macro_IsModifier(vkCode)))
+	{
+		return MACRO_NONE;
+	}
+	state->heldKey = vkCode;
+
+	state->state = set->next[state->state][symbol];
+	uint16_t action = set->output[state->state];
+	if (action != MACRO_NONE)
+	{
+		state->state = 0;
+	}
+	return action;
+}
@@ -1,7 +1,22 @@
 #include <Windows.h>
+#include <stdlib.h>
+#include <string.h>
 #if _DEBUG
 #include <stdio.h>
 #endif // _DEBUG
+#include "converter.h"
+#include "core.h"
+#include "dict.h"
+#include "engine.h"
+#include "hotkeys.h"
+#include "input.h"
+#include "model.h"
+#include "plugins.h"
+#include "rules.h"
+#include "state.h"
+#include "checked.h"
+
+#define STATE_SAVE_INTERVAL 60000
 
 typedef NTSTATUS(WINAPI* RtlGetVersionPtr)(PRTL_OSVERSIONINFOW);
 
@@ -11,17 +26,88 @@ typedef struct {
 
 void ShowError(LPCSTR message);
 DWORD GetOSVersion();
-void PressKey(int keyCode);
-void ReleaseKey(int keyCode);
+void GetAppFilePath(LPCSTR fileName, LPSTR path, DWORD size);
+#if _DEBUG
+void TrackWord(DWORD vkCode);
+#endif // _DEBUG
+void LoadMacros();
+void RunMacro(uint16_t index);
+void LoadRules();
+void LoadPlugins();
+void LoadOneShot();
+const KeyLayout* OneShotTarget();
+void ApplyEffects(const CoreOutput* output);
+int ApplyHookEffects(const CoreOutput* output, void* context);
+BOOL IsFullScreen(HWND hWnd);
+uint32_t MatchWindow(HWND hWnd);
+void ApplyRules(HWND hWnd, BOOL activated);
+uint32_t ForegroundRule();
+void CALLBACK WinEventProc(HWINEVENTHOOK hWinEventHook, DWORD event, HWND hWnd, LONG idObject, LONG idChild, DWORD idEventThread, DWORD time);
+void SwitchLayout();
+void LoadState();
+void SaveState();
+void CALLBACK SaveStateTimer(HWND hWnd, UINT message, UINT_PTR idEvent, DWORD time);
+HWND CreateMainWindow();
+LRESULT CALLBACK WindowProc(HWND hWnd, UINT message, WPARAM wParam, LPARAM lParam);
+void LoadDevices();
+void RegisterKeyboards(BOOL registered);
+void ConfigureDevice(uint8_t slot);
+void ProcessRawInput(HRAWINPUT hRawInput);
 void ToggleCapsLockState();
+void SetEnabled(BOOL enable);
+void OnTrigger(EngineTrigger trigger);
+int HookStart(EngineHandler handler);
+void HookStop();
+void HookSetEnabled(int enable);
+LRESULT HandleKeyboardEvent(int nCode, WPARAM wParam, LPARAM lParam);
 LRESULT CALLBACK LowLevelKeyboardProc(int nCode, WPARAM wParam, LPARAM lParam);
 
 
 HHOOK hHook;
 BOOL enabled = TRUE;
-BOOL keystrokeCapsProcessed = FALSE;
-BOOL keystrokeShiftProcessed = FALSE;
-BOOL winPressed = FALSE;
+const Engine hookEngine = { "hook", HookStart, HookStop, HookSetEnabled };
+const Engine* engine = &hookEngine;
+EngineHandler hookHandler = NULL;
+
+// Everything the hook keeps between key events
+Core core;
+DeviceConfig deviceConfig;
+HWND hMainWindow = NULL;
+
+#if _DEBUG
+// Words are only scored for the debug output so far: nothing decides on them
+Dict dict;
+DictCursor dictCursor;
+DWORD dictMatch = 0;
+
+Model model;
+ModelCursor modelCursor;
+#endif // _DEBUG
+
+HKL oneShotLayouts[2];
+KeyLayout oneShotTables[2];
+
+MacroSet macros;
+HKL macroLayouts[MACRO_MAX_ACTIONS];
+
+RuleSet rules;
+RuleCache ruleCache;
+BOOL rulesLoaded = FALSE;
+// Kept by ApplyRules so the hook doesn't ask for the foreground window
+uint32_t foregroundRule = RULE_NONE;
+HKL* ruleLayouts = NULL;
+HWINEVENTHOOK hForegroundHook;
+HWINEVENTHOOK hNameHook;
+HWINEVENTHOOK hDestroyHook;
+// Set only when a rule has a fullscreen condition
+HWINEVENTHOOK hLocationHook = NULL;
+BOOL foregroundFullscreen = FALSE;
+
+PluginHost plugins;
+
+char statePath[MAX_PATH];
+StateData savedState;
+uint32_t stateSequence = 0;
 
 Settings settings = {
 	.popup = FALSE
@@ -30,31 +116,76 @@ Settings settings = {
 
 int main(int argc, char** argv)
 {
-	if (argc > 1 && strcmp(argv[1], "nopopup") == 0)
-	{
-		settings.popup = FALSE;
-	}
-	else
+	settings.popup = GetOSVersion() >= 10;
+	for (int i = 1; i < argc; i++)
 	{
-		settings.popup = GetOSVersion() >= 10;
+		if (strcmp(argv[i], "nopopup") == 0)
+		{
+			settings.popup = FALSE;
+		}
+		// No hook at all: only the CapsLock combinations, registered as hotkeys
+		else if (strcmp(argv[i], "hotkeys") == 0)
+		{
+			engine = &hotkeyEngine;
+		}
 	}
 #if _DEBUG
 	printf("Pop-up is %s\n", settings.popup ? "enabled" : "disabled");
+	printf("Engine: %s\n", engine->name);
 #endif
 
-	HANDLE hMutex = CreateMutex(0, 0, "Switchy");
+	// One instance per session: every user on a terminal server runs their own
+	HANDLE hMutex = CreateMutex(0, 0, "Local\\Switchy");
 	if (GetLastError() == ERROR_ALREADY_EXISTS)
 	{
 		ShowError("Another instance of Switchy is already running!");
 		return 1;
 	}
 
-	hHook = SetWindowsHookEx(WH_KEYBOARD_LL, LowLevelKeyboardProc, 0, 0);
-	if (hHook == NULL)
+	Core_Init(&core);
+	core.popup = (uint8_t)settings.popup;
+	LoadState();
+
+	// The dictionary and the model only print what they make of typed
+	// words; no decision uses them, so release builds leave them out
+#if _DEBUG
+	char dictPath[MAX_PATH];
+	GetAppFilePath("Switchy.dawg", dictPath, sizeof(dictPath));
+	if (Dict_Open(&dict, dictPath))
 	{
-		ShowError("Error calling \"SetWindowsHookEx(...)\"");
+		Dict_Reset(&dict, &dictCursor);
+		printf("Dictionary loaded: %u nodes\n", dict.header->nodeCount);
+	}
+
+	char modelPath[MAX_PATH];
+	GetAppFilePath("Switchy.model", modelPath, sizeof(modelPath));
+	if (Model_Open(&model, modelPath))
+	{
+		Model_Reset(&modelCursor);
+		printf("Model loaded: %u symbols, %u layouts\n", model.header->symbolCount, model.header->layoutCount);
+	}
+#endif // _DEBUG
+
+	LoadMacros();
+	LoadRules();
+	LoadPlugins();
+	LoadOneShot();
+	Converter_Start();
+	// The hook engine receives Raw Input here
+	hMainWindow = CreateMainWindow();
+	LoadDevices();
+
+	if (!engine->Start(OnTrigger))
+	{
+		ShowError(engine == &hookEngine ? "Error calling \"SetWindowsHookEx(...)\"" : "Error calling \"RegisterHotKey(...)\"");
 		return 1;
 	}
+	if (!enabled)
+	{
+		engine->SetEnabled(FALSE);
+	}
+
+	SetTimer(NULL, 0, STATE_SAVE_INTERVAL, SaveStateTimer);
 
 	MSG messages;
 	while (GetMessage(&messages, NULL, 0, 0))
@@ -63,7 +194,33 @@ int main(int argc, char** argv)
 		DispatchMessage(&messages);
 	}
 
-	UnhookWindowsHookEx(hHook);
+	engine->Stop();
+	if (rulesLoaded)
+	{
+		UnhookWinEvent(hForegroundHook);
+		UnhookWinEvent(hNameHook);
+		UnhookWinEvent(hDestroyHook);
+	}
+	if (hLocationHook != NULL)
+	{
+		UnhookWinEvent(hLocationHook);
+	}
+	SaveState();
+	Plugins_Free(&plugins);
+	Converter_Stop();
+#if _DEBUG
+	Dict_Close(&dict);
+	Model_Close(&model);
+#endif // _DEBUG
+	Rules_Free(&rules);
+	free(ruleLayouts);
+#ifdef SWITCHY_CHECKED
+	char report[256];
+	if (Checked_Report(report, sizeof(report)))
+	{
+		ShowError(report);
+	}
+#endif // SWITCHY_CHECKED
 
 	return 0;
 }
@@ -95,15 +252,221 @@ DWORD GetOSVersion()
 }
 
 
-void PressKey(int keyCode)
+void GetAppFilePath(LPCSTR fileName, LPSTR path, DWORD size)
+{
+	DWORD length = GetModuleFileName(NULL, path, size);
+	while (length > 0 && path[length - 1] != '\\')
+	{
+		length--;
+	}
+	path[length] = 0;
+	strncat_s(path, size, fileName, _TRUNCATE);
+}
+
+
+void LoadState()
+{
+	char localAppData[MAX_PATH];
+	DWORD length = GetEnvironmentVariable("LOCALAPPDATA", localAppData, sizeof(localAppData));
+	if (length == 0 || length >= sizeof(localAppData))
+	{
+		return;
+	}
+
+	strncpy_s(statePath, sizeof(statePath), localAppData, _TRUNCATE);
+	strncat_s(statePath, sizeof(statePath), "\\Switchy", _TRUNCATE);
+	CreateDirectory(statePath, NULL);
+	strncat_s(statePath, sizeof(statePath), "\\state.bin", _TRUNCATE);
+
+	if (State_Load(statePath, &savedState, &stateSequence))
+	{
+		enabled = savedState.enabled != 0;
+		Chatter_Restore(&core.chatter, savedState.chatter);
+#if _DEBUG
+		printf("State restored: Switchy is %s\n", enabled ? "enabled" : "disabled");
+#endif // _DEBUG
+	}
+	else
+	{
+		savedState.enabled = enabled;
+		Chatter_Save(&core.chatter, savedState.chatter);
+	}
+}
+
+
+// Writes the state only when it differs from what is already on disk
+void SaveState()
+{
+	StateData current = savedState;
+	current.enabled = enabled;
+	Chatter_Save(&core.chatter, current.chatter);
+	if (statePath[0] == 0 || memcmp(&current, &savedState, sizeof(current)) == 0)
+	{
+		return;
+	}
+
+	if (State_Save(statePath, &current, stateSequence + 1))
+	{
+		savedState = current;
+		stateSequence++;
+	}
+}
+
+
+void CALLBACK SaveStateTimer(HWND hWnd, UINT message, UINT_PTR idEvent, DWORD time)
+{
+	SaveState();
+}
+
+
+// Hidden top-level window: only top-level windows are told about logoff and shutdown
+HWND CreateMainWindow()
+{
+	WNDCLASS windowClass = { 0 };
+	windowClass.lpfnWndProc = WindowProc;
+	windowClass.hInstance = GetModuleHandle(NULL);
+	windowClass.lpszClassName = "Switchy";
+	RegisterClass(&windowClass);
+
+	return CreateWindowEx(0, "Switchy", "Switchy", 0, 0, 0, 0, 0, NULL, NULL, windowClass.hInstance, NULL);
+}
+
+
+LRESULT CALLBACK WindowProc(HWND hWnd, UINT message, WPARAM wParam, LPARAM lParam)
 {
-	keybd_event(keyCode, 0, 0, 0);
+	switch (message)
+	{
+	case WM_ENDSESSION:
+		if (wParam)
+		{
+			SaveState();
+		}
+		return 0;
+	case WM_CLOSE:
+		PostQuitMessage(0);
+		return 0;
+	case WM_INPUT:
+		ProcessRawInput((HRAWINPUT)lParam);
+		break;
+	case WM_INPUT_DEVICE_CHANGE:
+		if (wParam == GIDC_REMOVAL)
+		{
+			Devices_Remove(&core.devices, (uintptr_t)lParam);
+		}
+		return 0;
+	}
+	return DefWindowProc(hWnd, message, wParam, lParam);
 }
 
 
-void ReleaseKey(int keyCode)
+void LoadDevices()
 {
-	keybd_event(keyCode, 0, KEYEVENTF_KEYUP, 0);
+	char path[MAX_PATH];
+	char error[256];
+	GetAppFilePath("Switchy.devices", path, sizeof(path));
+	if (GetFileAttributes(path) != INVALID_FILE_ATTRIBUTES && !Devices_LoadConfig(&deviceConfig, path, error, sizeof(error)))
+	{
+		ShowError(error);
+	}
+}
+
+
+// Raw Input tells which keyboard a key came from, the hook does not. Only
+// the device config needs it, and only while the hook runs: otherwise no
+// keystroke should wake Switchy up.
+void RegisterKeyboards(BOOL registered)
+{
+	BOOL wanted = registered && hMainWindow != NULL && deviceConfig.ruleCount > 0;
+	if (wanted == (BOOL)core.raw)
+	{
+		return;
+	}
+
+	RAWINPUTDEVICE device = { 0 };
+	device.usUsagePage = 0x01;
+	device.usUsage = 0x06;
+	device.dwFlags = wanted ? RIDEV_INPUTSINK | RIDEV_DEVNOTIFY : RIDEV_REMOVE;
+	device.hwndTarget = wanted ? hMainWindow : NULL;
+	// Keyboards and hook events of an earlier registration are stale
+	Devices_Init(&core.devices);
+	core.raw = (uint8_t)(RegisterRawInputDevices(&device, 1, sizeof(device)) && wanted);
+#if _DEBUG
+	printf("Raw Input is %s\n", core.raw ? "registered" : "not registered");
+#endif // _DEBUG
+}
+
+
+void ConfigureDevice(uint8_t slot)
+{
+	char name[512] = "";
+	UINT size = sizeof(name);
+	DeviceSlot* device = &core.devices.slots[slot];
+	GetRawInputDeviceInfoA((HANDLE)device->handle, RIDI_DEVICENAME, name, &size);
+	device->disabled = (uint8_t)Devices_IsDisabled(&deviceConfig, name);
+#if _DEBUG
+	printf("Keyboard %u: %s%s\n", slot, name, device->disabled ? " (disabled)" : "");
+#endif // _DEBUG
+}
+
+
+void ProcessRawInput(HRAWINPUT hRawInput)
+{
+	// Events queued before Raw Input was removed
+	if (!core.raw)
+	{
+		return;
+	}
+
+	RAWINPUT input;
+	UINT size = sizeof(input);
+	if (GetRawInputData(hRawInput, RID_INPUT, &input, &size, sizeof(RAWINPUTHEADER)) == (UINT)-1 ||
+		input.header.dwType != RIM_TYPEKEYBOARD || input.header.hDevice == NULL)
+	{
+		return;
+	}
+
+	// Raw Input reports Shift, Ctrl and Alt without the side the hook reports
+	const RAWKEYBOARD* keyboard = &input.data.keyboard;
+	USHORT vkCode = keyboard->VKey;
+	switch (vkCode)
+	{
+	case VK_SHIFT:
+		vkCode = keyboard->MakeCode == 0x36 ? VK_RSHIFT : VK_LSHIFT;
+		break;
+	case VK_CONTROL:
+		vkCode = (keyboard->Flags & RI_KEY_E0) ? VK_RCONTROL : VK_LCONTROL;
+		break;
+	case VK_MENU:
+		vkCode = (keyboard->Flags & RI_KEY_E0) ? VK_RMENU : VK_LMENU;
+		break;
+	}
+	// 0xFF marks the extra scan codes of keys like Pause
+	if (vkCode >= 0xFF)
+	{
+		return;
+	}
+
+	int added;
+	uint8_t slot = Devices_Slot(&core.devices, (uintptr_t)input.header.hDevice, &added);
+	if (added)
+	{
+		ConfigureDevice(slot);
+	}
+	CoreOutput output;
+	if (Core_OnRaw(&core, slot, (uint8_t)vkCode, !(keyboard->Flags & RI_KEY_BREAK), &output))
+	{
+		ApplyEffects(&output);
+	}
+}
+
+
+void SwitchLayout()
+{
+	PressKey(VK_MENU);
+	PressKey(VK_LSHIFT);
+	ReleaseKey(VK_MENU);
+	ReleaseKey(VK_LSHIFT);
+	Plugins_Post(&plugins, SWITCHY_ACTION_SWITCH, 0);
 }
 
 
@@ -111,121 +474,576 @@ void ToggleCapsLockState()
 {
 	PressKey(VK_CAPITAL);
 	ReleaseKey(VK_CAPITAL);
+	Plugins_Post(&plugins, SWITCHY_ACTION_CAPS_LOCK, 0);
 #if _DEBUG
 	printf("Caps Lock state has been toggled\n");
 #endif // _DEBUG
 }
 
 
-LRESULT CALLBACK LowLevelKeyboardProc(int nCode, WPARAM wParam, LPARAM lParam)
+void SetEnabled(BOOL enable)
 {
-	KBDLLHOOKSTRUCT* key = (KBDLLHOOKSTRUCT*)lParam;
-	if (nCode == HC_ACTION && !(key->flags & LLKHF_INJECTED))
-	{
+	enabled = enable;
+	engine->SetEnabled(enabled);
+	Plugins_Post(&plugins, SWITCHY_ACTION_ENABLE, enabled ? 1 : 0);
 #if _DEBUG
-		const char* keyStatus = (wParam == WM_KEYDOWN || wParam == WM_SYSKEYDOWN) ? "pressed" : "released";
-		printf("Key %d has been %s\n", key->vkCode, keyStatus);
+	printf("Switchy has been %s\n", enabled ? "enabled" : "disabled");
 #endif // _DEBUG
-		if (key->vkCode == VK_CAPITAL)
+}
+
+
+// Triggers reported by the hotkeys; the hook handles its keys itself
+void OnTrigger(EngineTrigger trigger)
+{
+	uint32_t rule = ForegroundRule();
+	BOOL active = enabled && (rule == RULE_NONE || rules.rules[rule].type != RULE_DISABLE);
+	switch (trigger)
+	{
+	case TRIGGER_SWITCH:
+		if (active && settings.popup)
 		{
-			if (wParam == WM_SYSKEYDOWN && !keystrokeCapsProcessed)
-			{
-				keystrokeCapsProcessed = TRUE;
-				enabled = !enabled;
+			PressKey(VK_LWIN);
+			PressKey(VK_SPACE);
+			ReleaseKey(VK_SPACE);
+			ReleaseKey(VK_LWIN);
+			Plugins_Post(&plugins, SWITCHY_ACTION_SWITCH, 0);
+		}
+		else if (active)
+		{
+			SwitchLayout();
+		}
+		break;
+	case TRIGGER_CAPS_LOCK:
+		if (active)
+		{
+			ToggleCapsLockState();
+		}
+		break;
+	case TRIGGER_ENABLE:
+		SetEnabled(!enabled);
+		break;
+	case TRIGGER_CONVERT:
+		if (active)
+		{
+			Converter_Request();
+			Plugins_Post(&plugins, SWITCHY_ACTION_CONVERT, 0);
+		}
+		break;
+	default:
+		break;
+	}
+}
+
+
+int HookStart(EngineHandler handler)
+{
+	hookHandler = handler;
+	hHook = SetWindowsHookEx(WH_KEYBOARD_LL, LowLevelKeyboardProc, 0, 0);
+	RegisterKeyboards(hHook != NULL);
+	return hHook != NULL;
+}
+
+
+void HookStop()
+{
+	if (hHook != NULL)
+	{
+		UnhookWindowsHookEx(hHook);
+		hHook = NULL;
+	}
+	RegisterKeyboards(FALSE);
+	Hotkeys_Unregister();
+}
+
+
+// A disabled Switchy stays out of the keystroke path entirely and only
+// waits for the Alt+CapsLock hotkey
+void HookSetEnabled(int enable)
+{
+	if (!enable)
+	{
+		// The Win key of a pop-up would never see its CapsLock released
+		CoreOutput output = { 0 };
+		Core_Reset(&core, &output.effects);
+		ApplyEffects(&output);
+		HookStop();
+		Hotkeys_Register(1u << TRIGGER_ENABLE, hookHandler);
+		return;
+	}
+
+	Hotkeys_Unregister();
+	// Keys released while the hook was away never reset their state
+	CoreOutput output = { 0 };
+	Core_Reset(&core, &output.effects);
+	ApplyEffects(&output);
+	if (hHook == NULL)
+	{
+		hHook = SetWindowsHookEx(WH_KEYBOARD_LL, LowLevelKeyboardProc, 0, 0);
+	}
+	RegisterKeyboards(hHook != NULL);
+}
+
+
 #if _DEBUG
-				printf("Switchy has been %s\n", enabled ? "enabled" : "disabled");
+void TrackWord(DWORD vkCode)
+{
+	// A key outside the model alphabet ends the word after scoring it as
+	// a word end, the way the model was counted
+	if (model.header != NULL && (model.header->symbolOf[vkCode & 0xFF] != MODEL_BOUNDARY || modelCursor.second != MODEL_BOUNDARY))
+	{
+		Model_Step(&model, &modelCursor, (uint8_t)vkCode);
+		if (modelCursor.second == MODEL_BOUNDARY)
+		{
+			printf("Word score: A %.1f bits, B %.1f bits\n", (double)modelCursor.score[0] / model.header->scale,
+				(double)modelCursor.score[1] / model.header->scale);
+			Model_Reset(&modelCursor);
+		}
+	}
+
+	if (dict.header == NULL)
+	{
+		return;
+	}
+
+	// Any key outside the dictionary alphabet ends the current word
+	if (dict.header->symbolOf[vkCode & 0xFF] == DICT_NO_SYMBOL)
+	{
+		Dict_Reset(&dict, &dictCursor);
+		dictMatch = 0;
+		return;
+	}
+
+	dictMatch = Dict_Step(&dict, &dictCursor, (uint8_t)vkCode);
+	printf("Word in layout: A %s, B %s\n",
+		(DICT_WORD(dictMatch) & DICT_LAYOUT_A) ? "yes" : (DICT_PREFIX(dictMatch) & DICT_LAYOUT_A) ? "prefix" : "no",
+		(DICT_WORD(dictMatch) & DICT_LAYOUT_B) ? "yes" : (DICT_PREFIX(dictMatch) & DICT_LAYOUT_B) ? "prefix" : "no");
+}
 #endif // _DEBUG
-				return 1;
-			}
 
-			if (wParam == WM_KEYUP || wParam == WM_SYSKEYUP)
-			{
-				keystrokeCapsProcessed = FALSE;
-
-				if (winPressed)
-				{
-					winPressed = FALSE;
-					ReleaseKey(VK_LWIN);
-				}
-
-				if (enabled && !settings.popup)
-				{
-					if (!keystrokeShiftProcessed)
-					{
-						PressKey(VK_MENU);
-						PressKey(VK_LSHIFT);
-						ReleaseKey(VK_MENU);
-						ReleaseKey(VK_LSHIFT);
-					}
-					else
-					{
-						keystrokeShiftProcessed = FALSE;
-					}
-				}
-			}
 
-			if (!enabled)
-			{
-				return CallNextHookEx(hHook, nCode, wParam, lParam);
-			}
+void LoadMacros()
+{
+	char path[MAX_PATH];
+	char error[256];
+	GetAppFilePath("Switchy.macros", path, sizeof(path));
+	if (GetFileAttributes(path) == INVALID_FILE_ATTRIBUTES)
+	{
+		return;
+	}
+
+	if (!Macro_LoadFile(&macros, path, error, sizeof(error)))
+	{
+		ShowError(error);
+		return;
+	}
 
-			if (wParam == WM_KEYDOWN && !keystrokeCapsProcessed)
+	for (uint16_t i = 0; i < macros.actionCount; i++)
+	{
+		if (macros.actions[i].type == MACRO_LAYOUT)
+		{
+			macroLayouts[i] = LoadKeyboardLayout(macros.actions[i].layout, KLF_NOTELLSHELL);
+			if (macroLayouts[i] == NULL)
 			{
-				keystrokeCapsProcessed = TRUE;
-
-				if (keystrokeShiftProcessed == TRUE)
-				{
-					ToggleCapsLockState();
-					return 1;
-				}
-				else
-				{
-					if (settings.popup)
-					{
-						PressKey(VK_LWIN);
-						PressKey(VK_SPACE);
-						ReleaseKey(VK_SPACE);
-						winPressed = TRUE;
-					}
-				}
+				ShowError("Unknown keyboard layout in Switchy.macros");
+				return;
 			}
-			return 1;
 		}
+	}
+
+	core.macros = &macros;
+#if _DEBUG
+	printf("Macros loaded: %u macros, %u states\n", macros.actionCount, macros.stateCount);
+#endif // _DEBUG
+}
+
 
-		else if (key->vkCode == VK_LSHIFT)
+void RunMacro(uint16_t index)
+{
+	const MacroAction* action = &macros.actions[index];
+#if _DEBUG
+	printf("Macro from line %d has fired\n", action->line);
+#endif // _DEBUG
+	switch (action->type)
+	{
+	case MACRO_SWITCH:
+		SwitchLayout();
+		break;
+	case MACRO_LAYOUT:
+		SelectLayout(macroLayouts[index]);
+		Plugins_Post(&plugins, SWITCHY_ACTION_LAYOUT, strtoul(action->layout, NULL, 16));
+		break;
+	case MACRO_TEXT:
+		for (int i = 0; i < action->erase; i++)
 		{
+			PressKey(VK_BACK);
+			ReleaseKey(VK_BACK);
+		}
+		SendText(macros.text + action->textOffset, action->textLength);
+		break;
+	}
+}
 
-			if ((wParam == WM_KEYUP || wParam == WM_SYSKEYUP) && !keystrokeCapsProcessed)
-			{
-				keystrokeShiftProcessed = FALSE;
-			}
 
-			if (!enabled)
-			{
-				return CallNextHookEx(hHook, nCode, wParam, lParam);
-			}
+void LoadRules()
+{
+	char path[MAX_PATH];
+	char error[256];
+	GetAppFilePath("Switchy.rules", path, sizeof(path));
+	if (GetFileAttributes(path) == INVALID_FILE_ATTRIBUTES)
+	{
+		return;
+	}
+
+	if (!Rules_LoadFile(&rules, path, error, sizeof(error)))
+	{
+		ShowError(error);
+		return;
+	}
 
-			if (wParam == WM_KEYDOWN && !keystrokeShiftProcessed)
+	ruleLayouts = (HKL*)calloc(rules.ruleCount + 1, sizeof(HKL));
+	for (uint32_t i = 0; ruleLayouts != NULL && i < rules.ruleCount; i++)
+	{
+		if (rules.rules[i].type == RULE_LAYOUT)
+		{
+			ruleLayouts[i] = LoadKeyboardLayout(rules.rules[i].layout, KLF_NOTELLSHELL);
+			if (ruleLayouts[i] == NULL)
 			{
-				keystrokeShiftProcessed = TRUE;
-
-				if (keystrokeCapsProcessed == TRUE)
-				{
-					ToggleCapsLockState();
-					if (settings.popup)
-					{
-						PressKey(VK_LWIN);
-						PressKey(VK_SPACE);
-						ReleaseKey(VK_SPACE);
-						winPressed = TRUE;
-					}
-
-					return 0;
-				}
+				ShowError("Unknown keyboard layout in Switchy.rules");
+				return;
 			}
+		}
+	}
+
+	// Out-of-context events arrive through the message loop of this thread
+	hForegroundHook = SetWinEventHook(EVENT_SYSTEM_FOREGROUND, EVENT_SYSTEM_FOREGROUND, NULL, WinEventProc, 0, 0, WINEVENT_OUTOFCONTEXT | WINEVENT_SKIPOWNPROCESS);
+	hNameHook = SetWinEventHook(EVENT_OBJECT_NAMECHANGE, EVENT_OBJECT_NAMECHANGE, NULL, WinEventProc, 0, 0, WINEVENT_OUTOFCONTEXT | WINEVENT_SKIPOWNPROCESS);
+	hDestroyHook = SetWinEventHook(EVENT_OBJECT_DESTROY, EVENT_OBJECT_DESTROY, NULL, WinEventProc, 0, 0, WINEVENT_OUTOFCONTEXT | WINEVENT_SKIPOWNPROCESS);
+	rulesLoaded = ruleLayouts != NULL;
+	// Windows move and resize often, so their locations are only followed
+	// when a window entering or leaving full screen can change its rule
+	for (uint32_t i = 0; rulesLoaded && i < rules.ruleCount; i++)
+	{
+		if (rules.rules[i].fullscreen)
+		{
+			hLocationHook = SetWinEventHook(EVENT_OBJECT_LOCATIONCHANGE, EVENT_OBJECT_LOCATIONCHANGE, NULL, WinEventProc, 0, 0, WINEVENT_OUTOFCONTEXT | WINEVENT_SKIPOWNPROCESS);
+			break;
+		}
+	}
+	if (rulesLoaded)
+	{
+		ApplyRules(GetForegroundWindow(), TRUE);
+	}
+#if _DEBUG
+	printf("Rules loaded: %u rules, %u states\n", rules.ruleCount, rules.stateCount);
+#endif // _DEBUG
+}
+
+
+BOOL IsFullScreen(HWND hWnd)
+{
+	MONITORINFO monitor = { sizeof(monitor) };
+	RECT rect;
+	if (hWnd == GetDesktopWindow() || hWnd == GetShellWindow() || !GetWindowRect(hWnd, &rect) ||
+		!GetMonitorInfo(MonitorFromWindow(hWnd, MONITOR_DEFAULTTONEAREST), &monitor))
+	{
+		return FALSE;
+	}
+
+	return rect.left <= monitor.rcMonitor.left && rect.top <= monitor.rcMonitor.top &&
+		rect.right >= monitor.rcMonitor.right && rect.bottom >= monitor.rcMonitor.bottom;
+}
+
+
+uint32_t MatchWindow(HWND hWnd)
+{
+	WCHAR process[MAX_PATH] = L"";
+	WCHAR windowClass[256] = L"";
+	WCHAR title[512] = L"";
+	DWORD processId = 0;
+
+	GetWindowThreadProcessId(hWnd, &processId);
+	HANDLE hProcess = OpenProcess(PROCESS_QUERY_LIMITED_INFORMATION, FALSE, processId);
+	if (hProcess != NULL)
+	{
+		DWORD size = MAX_PATH;
+		QueryFullProcessImageNameW(hProcess, 0, process, &size);
+		CloseHandle(hProcess);
+	}
+	const WCHAR* processName = wcsrchr(process, L'\\');
+	processName = processName ? processName + 1 : process;
+	GetClassNameW(hWnd, windowClass, sizeof(windowClass) / sizeof(WCHAR));
+	GetWindowTextW(hWnd, title, sizeof(title) / sizeof(WCHAR));
+
+	RuleWindow window = { (const uint16_t*)processName, (const uint16_t*)windowClass, (const uint16_t*)title, IsFullScreen(hWnd) };
+	return Rules_Match(&rules, &window);
+}
+
+
+// Matches the window unless its decision is cached and selects the layout
+// a rule asks for when the window is activated or its rule changes
+void ApplyRules(HWND hWnd, BOOL activated)
+{
+	if (hWnd == NULL)
+	{
+		return;
+	}
+
+	uint32_t previous = RULE_NONE;
+	BOOL cached = RuleCache_Lookup(&ruleCache, (uintptr_t)hWnd, &previous);
+	uint32_t rule = previous;
+	if (!cached || !activated)
+	{
+		rule = MatchWindow(hWnd);
+		RuleCache_Store(&ruleCache, (uintptr_t)hWnd, rule);
+	}
+	foregroundRule = rule;
+	foregroundFullscreen = hLocationHook != NULL && IsFullScreen(hWnd);
+	if (rule != RULE_NONE && rules.rules[rule].type == RULE_LAYOUT && (activated || rule != previous))
+	{
+		SelectLayout(ruleLayouts[rule]);
+		Plugins_Post(&plugins, SWITCHY_ACTION_LAYOUT, strtoul(rules.rules[rule].layout, NULL, 16));
+	}
+#if _DEBUG
+	if (rule != RULE_NONE && (activated || rule != previous))
+	{
+		printf("Rule from line %d applies to the foreground window\n", rules.rules[rule].line);
+	}
+#endif // _DEBUG
+}
+
+
+// Decision for the foreground window as made when it was activated
+uint32_t ForegroundRule()
+{
+	return foregroundRule;
+}
+
+
+void CALLBACK WinEventProc(HWINEVENTHOOK hWinEventHook, DWORD event, HWND hWnd, LONG idObject, LONG idChild, DWORD idEventThread, DWORD time)
+{
+	if (idObject != OBJID_WINDOW || idChild != CHILDID_SELF || hWnd == NULL)
+	{
+		return;
+	}
+
+	switch (event)
+	{
+	case EVENT_SYSTEM_FOREGROUND:
+		ApplyRules(hWnd, TRUE);
+		break;
+	case EVENT_OBJECT_NAMECHANGE:
+		// Titles change while a window is in use, e.g. the tabs of a browser
+		if (hWnd == GetForegroundWindow())
+		{
+			ApplyRules(hWnd, FALSE);
+		}
+		break;
+	case EVENT_OBJECT_LOCATIONCHANGE:
+		// A window entering or leaving full screen may fall under another
+		// rule; a background one is matched again when it is activated
+		if (hWnd != GetForegroundWindow())
+		{
+			RuleCache_Invalidate(&ruleCache, (uintptr_t)hWnd);
+		}
+		else if (IsFullScreen(hWnd) != foregroundFullscreen)
+		{
+			ApplyRules(hWnd, FALSE);
+		}
+		break;
+	case EVENT_OBJECT_DESTROY:
+		// Window handles are reused
+		RuleCache_Invalidate(&ruleCache, (uintptr_t)hWnd);
+		break;
+	}
+}
+
+
+void LoadPlugins()
+{
+	char path[MAX_PATH];
+	char error[MAX_PATH + 64];
+	GetAppFilePath("Switchy.plugins", path, sizeof(path));
+	if (GetFileAttributes(path) == INVALID_FILE_ATTRIBUTES)
+	{
+		return;
+	}
+
+	if (!Plugins_LoadFile(&plugins, path, error, sizeof(error)))
+	{
+		ShowError(error);
+		return;
+	}
+#if _DEBUG
+	printf("Plugins loaded: %d\n", plugins.count);
+#endif // _DEBUG
+}
+
+
+// The first two installed layouts, the pair the converter works with too
+void LoadOneShot()
+{
+	if (settings.popup || GetKeyboardLayoutList(2, oneShotLayouts) < 2)
+	{
+		return;
+	}
+
+	if (!Layout_Load(&oneShotTables[0], oneShotLayouts[0]) || !Layout_Load(&oneShotTables[1], oneShotLayouts[1]))
+	{
+		oneShotLayouts[0] = oneShotLayouts[1] = NULL;
+		return;
+	}
+#if _DEBUG
+	printf("One-shot layouts: %p, %p\n", (void*)oneShotLayouts[0], (void*)oneShotLayouts[1]);
+#endif // _DEBUG
+}
+
+
+// Characters of the layout the foreground window is not in
+const KeyLayout* OneShotTarget()
+{
+	HWND hWnd = GetForegroundWindow();
+	HKL current = GetKeyboardLayout(hWnd ? GetWindowThreadProcessId(hWnd, NULL) : 0);
+	for (int i = 0; i < 2; i++)
+	{
+		if (oneShotLayouts[i] != NULL && oneShotLayouts[i] == current)
+		{
+			return &oneShotTables[1 - i];
+		}
+	}
+	return NULL;
+}
+
+
+void ApplyEffects(const CoreOutput* output)
+{
+	uint32_t effects = output->effects;
+	if (effects & CORE_TAKE_BACK)
+	{
+		ReleaseKey(output->vkCode);
+		if (output->vkCode == VK_CAPITAL)
+		{
+			PressKey(VK_CAPITAL);
+			ReleaseKey(VK_CAPITAL);
+		}
+#if _DEBUG
+		printf("Key %d has been taken back\n", output->vkCode);
+#endif // _DEBUG
+	}
+	if (effects & CORE_CONVERT)
+	{
+		Converter_Request();
+		Plugins_Post(&plugins, SWITCHY_ACTION_CONVERT, 0);
+#if _DEBUG
+		printf("Text conversion has been requested\n");
+#endif // _DEBUG
+	}
+	if (effects & CORE_TOGGLE_ENABLED)
+	{
+		SetEnabled(!enabled);
+	}
+	if (effects & CORE_RELEASE_WIN)
+	{
+		ReleaseKey(VK_LWIN);
+	}
+	if (effects & CORE_SWITCH)
+	{
+		SwitchLayout();
+	}
+	if (effects & CORE_TOGGLE_CAPS)
+	{
+		ToggleCapsLockState();
+	}
+	if (effects & CORE_POPUP)
+	{
+		PressKey(VK_LWIN);
+		PressKey(VK_SPACE);
+		ReleaseKey(VK_SPACE);
+		Plugins_Post(&plugins, SWITCHY_ACTION_SWITCH, 0);
+	}
+	if (effects & CORE_ONESHOT_END)
+	{
+		OneShot_End(&core.oneShot);
+	}
+	if (effects & CORE_ONESHOT_BEGIN)
+	{
+		OneShot_Begin(&core.oneShot, OneShotTarget());
+	}
+	if (effects & CORE_TYPE)
+	{
+		SendText((const WCHAR*)&output->ch, 1);
+#if _DEBUG
+		printf("Typed U+%04X of the other layout\n", output->ch);
+#endif // _DEBUG
+	}
+	if (effects & CORE_MACRO)
+	{
+		RunMacro(output->macro);
+	}
+}
+
+
+// A press whose raw event has not come yet is decided before the key the
+// hook got, and can turn Switchy off and take the hook away
+int ApplyHookEffects(const CoreOutput* output, void* context)
+{
+	ApplyEffects(output);
+	return hHook != NULL;
+}
+
+
+LRESULT HandleKeyboardEvent(int nCode, WPARAM wParam, LPARAM lParam)
+{
+	KBDLLHOOKSTRUCT* key = (KBDLLHOOKSTRUCT*)lParam;
+	if (nCode == HC_ACTION && !(key->flags & LLKHF_INJECTED))
+	{
+#if _DEBUG
+		const char* keyStatus = (wParam == WM_KEYDOWN || wParam == WM_SYSKEYDOWN) ? "pressed" : "released";
+		printf("Key %d has been %s\n", key->vkCode, keyStatus);
+		uint32_t dropped = core.chatter.dropped;
+#endif // _DEBUG
+		CoreInput input;
+		input.vkCode = (uint8_t)key->vkCode;
+		input.message = wParam == WM_KEYDOWN ? CORE_KEY_DOWN : wParam == WM_SYSKEYDOWN ? CORE_SYSKEY_DOWN :
+			wParam == WM_KEYUP ? CORE_KEY_UP : CORE_SYSKEY_UP;
+		// A rule can turn Switchy off in the foreground window
+		uint32_t rule = ForegroundRule();
+		input.enabled = enabled && (rule == RULE_NONE || rules.rules[rule].type != RULE_DISABLE);
+		input.time = key->time;
+
+		int result = Core_Key(&core, &input, ApplyHookEffects, NULL);
+#if _DEBUG
+		if (core.chatter.dropped != dropped)
+		{
+			printf("Key %d bounced, dropped (threshold %u ms)\n", key->vkCode, Chatter_Threshold(&core.chatter, (uint8_t)key->vkCode));
+		}
+#endif // _DEBUG
+		if (result == CORE_BLOCK)
+		{
+			return 1;
+		}
+		if (result == CORE_ALLOW)
+		{
 			return 0;
 		}
+
+#if _DEBUG
+		// CapsLock and the left Shift passed by the core are not typing
+		if (wParam == WM_KEYDOWN && key->vkCode != VK_CAPITAL && key->vkCode != VK_LSHIFT &&
+			key->vkCode != VK_SHIFT && key->vkCode != VK_RSHIFT)
+		{
+			TrackWord(key->vkCode);
+		}
+#endif // _DEBUG
 	}
 
 	return CallNextHookEx(hHook, nCode, wParam, lParam);
+}
+
+
+LRESULT CALLBACK LowLevelKeyboardProc(int nCode, WPARAM wParam, LPARAM lParam)
+{
+	CHECKED_ENTER();
+	LRESULT result = HandleKeyboardEvent(nCode, wParam, lParam);
+	CHECKED_LEAVE();
+	return result;
 }
\ No newline at end of file
@@ -217,7 +217,7 @@ int main(int argc, char** argv) {
 #endif
 
     // Создаем мьютекс для обеспечения единственного экземпляра
-    HANDLE hMutex = CreateMutexA(nullptr, FALSE, "Global\\Switchy");
+    HANDLE hMutex = CreateMutexA(nullptr, FALSE, "Local\\Switchy");
     if (GetLastError() == ERROR_ALREADY_EXISTS) {
         ShowError("Another instance of Switchy is already running!");
         return 1;
@@ -0,0 +1,44 @@
+// Switchy for X11 desktops: the CapsLock combinations through the x11
+// engine, nothing else of the Windows build yet.
+//   cc -o switchy-x11 Switchy/main_x11.c Switchy/x11.c -lX11
+#include <stdio.h>
+#include "x11.h"
+
+static int enabled = 1;
+
+
+static void OnTrigger(EngineTrigger trigger)
+{
+	switch (trigger)
+	{
+	case TRIGGER_SWITCH:
+		if (enabled)
+		{
+			X11_SwitchLayout(X11_Engine());
+		}
+		break;
+	case TRIGGER_ENABLE:
+		enabled = !enabled;
+		x11Engine.SetEnabled(enabled);
+		break;
+	// XKB toggles CapsLock for Shift+CapsLock itself; there is no converter
+	default:
+		break;
+	}
+}
+
+
+int main()
+{
+	if (!x11Engine.Start(OnTrigger))
+	{
+		fprintf(stderr, "%s\n", X11_EngineError());
+		return 1;
+	}
+
+	while (X11_Dispatch(X11_Engine(), -1) >= 0);
+
+	fprintf(stderr, "Connection to the X server lost\n");
+	x11Engine.Stop();
+	return 1;
+}
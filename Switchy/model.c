@@ -0,0 +1,129 @@
+#include "model.h"
+#include <string.h>
+#ifdef _WIN32
+#include <Windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+#include "checked.h"
+
+
+static int Model_Validate(Model* model)
+{
+	if (model->size < sizeof(ModelHeader))
+	{
+		return 0;
+	}
+
+	const ModelHeader* header = (const ModelHeader*)model->view;
+	if (header->magic != MODEL_MAGIC || header->version != MODEL_VERSION || header->symbolCount < 2 ||
+		header->symbolCount > MODEL_MAX_SYMBOLS || header->layoutCount == 0 || header->layoutCount > MODEL_MAX_LAYOUTS ||
+		header->scale == 0)
+	{
+		return 0;
+	}
+
+	uint64_t table = (uint64_t)header->symbolCount * header->symbolCount * header->symbolCount;
+	if (sizeof(ModelHeader) + table * header->layoutCount != model->size)
+	{
+		return 0;
+	}
+	for (int vkCode = 0; vkCode < 256; vkCode++)
+	{
+		if (header->symbolOf[vkCode] >= header->symbolCount)
+		{
+			return 0;
+		}
+	}
+
+	model->header = header;
+	model->scores = (const uint8_t*)(header + 1);
+	return 1;
+}
+
+
+int Model_Open(Model* model, const char* path)
+{
+	memset(model, 0, sizeof(*model));
+
+#ifdef _WIN32
+	HANDLE hFile = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+	if (hFile == INVALID_HANDLE_VALUE)
+	{
+		return 0;
+	}
+
+	LARGE_INTEGER size;
+	if (!GetFileSizeEx(hFile, &size) || size.QuadPart == 0)
+	{
+		CloseHandle(hFile);
+		return 0;
+	}
+
+	HANDLE hMapping = CreateFileMappingA(hFile, NULL, PAGE_READONLY, 0, 0, NULL);
+	if (hMapping == NULL)
+	{
+		CloseHandle(hFile);
+		return 0;
+	}
+
+	model->view = MapViewOfFile(hMapping, FILE_MAP_READ, 0, 0, 0);
+	model->size = (size_t)size.QuadPart;
+	model->hFile = hFile;
+	model->hMapping = hMapping;
+#else
+	int fd = open(path, O_RDONLY);
+	if (fd < 0)
+	{
+		return 0;
+	}
+
+	struct stat st;
+	if (fstat(fd, &st) != 0 || st.st_size == 0)
+	{
+		close(fd);
+		return 0;
+	}
+
+	void* view = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	model->view = view == MAP_FAILED ? NULL : view;
+	model->size = (size_t)st.st_size;
+#endif
+
+	if (model->view == NULL || !Model_Validate(model))
+	{
+		Model_Close(model);
+		return 0;
+	}
+
+	return 1;
+}
+
+
+void Model_Close(Model* model)
+{
+#ifdef _WIN32
+	if (model->view)
+	{
+		UnmapViewOfFile(model->view);
+	}
+	if (model->hMapping)
+	{
+		CloseHandle(model->hMapping);
+	}
+	if (model->hFile)
+	{
+		CloseHandle(model->hFile);
+	}
+#else
+	if (model->view)
+	{
+		munmap(model->view, model->size);
+	}
+#endif
+	memset(model, 0, sizeof(*model));
+}
@@ -0,0 +1,100 @@
+#pragma once
+#include <stddef.h>
+#include <stdint.h>
+#include "layout.h"
+
+// Character trigram model of each layout's language, keyed by virtual-key
+// codes like the dictionary: text of every layout is counted as the keys
+// that type it, so one walk over the typed keys scores all layouts at once.
+// The file is built by SwitchyTools from text corpora and mapped read-only;
+// scores are -log2 of the probability of a key given the two before it,
+// quantized to a byte, so a lower total means a more likely layout.
+
+#define MODEL_MAGIC 0x444D5753u // "SWMD"
+#define MODEL_VERSION 1
+#define MODEL_MAX_SYMBOLS 48
+#define MODEL_MAX_LAYOUTS 2
+// Symbol 0 stands for every key outside the model: space, digits, controls
+#define MODEL_BOUNDARY 0
+// Score units per bit
+#define MODEL_SCALE 16
+
+typedef struct {
+	uint32_t magic;
+	uint16_t version;
+	uint16_t symbolCount;
+	uint16_t layoutCount;
+	uint16_t scale;
+	// Layout identifiers, e.g. 0x00000409
+	uint32_t layouts[MODEL_MAX_LAYOUTS];
+	uint8_t symbolOf[256];
+} ModelHeader;
+
+// The header is followed by `layoutCount` tables of symbolCount^3 scores,
+// indexed by ((first * symbolCount) + second) * symbolCount + third
+typedef struct {
+	const ModelHeader* header;
+	const uint8_t* scores;
+	void* view;
+	size_t size;
+#ifdef _WIN32
+	void* hFile;
+	void* hMapping;
+#endif
+} Model;
+
+typedef struct {
+	uint8_t first;
+	uint8_t second;
+	uint32_t score[MODEL_MAX_LAYOUTS];
+} ModelCursor;
+
+int Model_Open(Model* model, const char* path);
+void Model_Close(Model* model);
+
+static inline void Model_Reset(ModelCursor* cursor)
+{
+	cursor->first = MODEL_BOUNDARY;
+	cursor->second = MODEL_BOUNDARY;
+	for (int layout = 0; layout < MODEL_MAX_LAYOUTS; layout++)
+	{
+		cursor->score[layout] = 0;
+	}
+}
+
+// Adds the score of one more key for every layout
+static inline void Model_Step(const Model* model, ModelCursor* cursor, uint8_t vkCode)
+{
+	uint32_t symbols = model->header->symbolCount;
+	uint8_t symbol = model->header->symbolOf[vkCode];
+	size_t index = ((size_t)cursor->first * symbols + cursor->second) * symbols + symbol;
+	size_t table = (size_t)symbols * symbols * symbols;
+	for (uint32_t layout = 0; layout < model->header->layoutCount; layout++)
+	{
+		cursor->score[layout] += model->scores[layout * table + index];
+	}
+	cursor->first = cursor->second;
+	cursor->second = symbol;
+}
+
+// Builder used by SwitchyTools to compile text corpora into a model file.
+// Text is counted in chunks, each into a table of its own, so chunks can be
+// counted on separate threads and the tables merged before writing.
+typedef struct {
+	uint32_t layouts[MODEL_MAX_LAYOUTS];
+	uint16_t layoutCount;
+	uint16_t symbolCount;
+	uint8_t symbolOf[256];
+	// Per layout, the symbol of the key that types each character
+	uint8_t symbolOfChar[MODEL_MAX_LAYOUTS][65536];
+} ModelKeymap;
+
+// Letter keys and the OEM keys between them get a symbol if any of the
+// layouts types a character with them.
+int ModelKeymap_Init(ModelKeymap* keymap, const uint32_t* layouts, const KeyLayout* keyLayouts, int layoutCount);
+// Adds the trigrams of UTF-8 `text` typed in `layout` to `counts`, a table
+// of symbolCount^3 counters, and returns the number of characters read.
+// The caller keeps `size` below 4G so no counter can overflow.
+size_t Model_Count(const ModelKeymap* keymap, int layout, const uint8_t* text, size_t size, uint32_t* counts);
+// `counts` holds the merged symbolCount^3 counters of every layout in turn
+int Model_Write(const ModelKeymap* keymap, const uint64_t* counts, const char* path);
@@ -0,0 +1,164 @@
+#include "model.h"
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Scores are smoothed with a pseudo-count of one half per symbol, so
+// trigrams never seen in the corpus get a finite, large score.
+#define MODEL_PSEUDO_COUNT 0.5
+
+
+static int IsModelKey(int vkCode)
+{
+	return (vkCode >= 'A' && vkCode <= 'Z') ||
+		(vkCode >= 0xBA && vkCode <= 0xC0) || // VK_OEM_1 .. VK_OEM_3
+		(vkCode >= 0xDB && vkCode <= 0xDF) || // VK_OEM_4 .. VK_OEM_8
+		vkCode == 0xE2; // VK_OEM_102
+}
+
+
+int ModelKeymap_Init(ModelKeymap* keymap, const uint32_t* layouts, const KeyLayout* keyLayouts, int layoutCount)
+{
+	if (layoutCount < 1 || layoutCount > MODEL_MAX_LAYOUTS)
+	{
+		return 0;
+	}
+
+	memset(keymap, 0, sizeof(*keymap));
+	keymap->layoutCount = (uint16_t)layoutCount;
+	keymap->symbolCount = 1;
+	for (int vkCode = 0; vkCode < 256; vkCode++)
+	{
+		int typed = 0;
+		for (int layout = 0; layout < layoutCount; layout++)
+		{
+			typed |= keyLayouts[layout].chars[vkCode][LAYOUT_PLAIN] != 0;
+		}
+		if (IsModelKey(vkCode) && typed)
+		{
+			if (keymap->symbolCount == MODEL_MAX_SYMBOLS)
+			{
+				return 0;
+			}
+			keymap->symbolOf[vkCode] = (uint8_t)keymap->symbolCount++;
+		}
+	}
+
+	// A character typed by several keys keeps the one typed without Shift
+	for (int layout = 0; layout < layoutCount; layout++)
+	{
+		keymap->layouts[layout] = layouts[layout];
+		for (int shift = LAYOUT_PLAIN; shift <= LAYOUT_SHIFT; shift++)
+		{
+			for (int vkCode = 0; vkCode < 256; vkCode++)
+			{
+				uint16_t ch = keyLayouts[layout].chars[vkCode][shift];
+				if (ch != 0 && keymap->symbolOfChar[layout][ch] == MODEL_BOUNDARY)
+				{
+					keymap->symbolOfChar[layout][ch] = keymap->symbolOf[vkCode];
+				}
+			}
+		}
+	}
+	return 1;
+}
+
+
+// Runs of boundaries count once and restart the context, the way the
+// cursor is reset at the end of every typed word.
+size_t Model_Count(const ModelKeymap* keymap, int layout, const uint8_t* text, size_t size, uint32_t* counts)
+{
+	const uint8_t* symbolOfChar = keymap->symbolOfChar[layout];
+	size_t symbols = keymap->symbolCount;
+	// (first * symbols + second) * symbols, ready for the third
+	size_t context = 0;
+	uint32_t second = MODEL_BOUNDARY;
+	size_t characters = 0;
+	size_t i = 0;
+	while (i < size)
+	{
+		uint32_t ch = text[i];
+		if (ch < 0x80)
+		{
+			i++;
+		}
+		else if ((ch & 0xE0) == 0xC0 && i + 1 < size)
+		{
+			ch = ((ch & 0x1F) << 6) | (text[i + 1] & 0x3F);
+			i += 2;
+		}
+		else if ((ch & 0xF0) == 0xE0 && i + 2 < size)
+		{
+			ch = ((ch & 0x0F) << 12) | ((text[i + 1] & 0x3F) << 6) | (text[i + 2] & 0x3F);
+			i += 3;
+		}
+		else
+		{
+			// Characters outside the BMP and stray bytes end the word
+			ch = 0;
+			i++;
+		}
+		characters++;
+
+		uint32_t symbol = symbolOfChar[ch & 0xFFFF];
+		if (symbol == MODEL_BOUNDARY && second == MODEL_BOUNDARY)
+		{
+			continue;
+		}
+
+		counts[context + symbol]++;
+		context = symbol == MODEL_BOUNDARY ? 0 : (second * symbols + symbol) * symbols;
+		second = symbol;
+	}
+	return characters;
+}
+
+
+int Model_Write(const ModelKeymap* keymap, const uint64_t* counts, const char* path)
+{
+	size_t symbols = keymap->symbolCount;
+	size_t table = symbols * symbols * symbols;
+	uint8_t* scores = (uint8_t*)malloc(table * keymap->layoutCount);
+	if (scores == NULL)
+	{
+		return 0;
+	}
+
+	for (size_t context = 0; context < table * keymap->layoutCount; context += symbols)
+	{
+		double total = MODEL_PSEUDO_COUNT * symbols;
+		for (size_t symbol = 0; symbol < symbols; symbol++)
+		{
+			total += (double)counts[context + symbol];
+		}
+		for (size_t symbol = 0; symbol < symbols; symbol++)
+		{
+			double bits = -log2(((double)counts[context + symbol] + MODEL_PSEUDO_COUNT) / total);
+			double score = floor(bits * MODEL_SCALE + 0.5);
+			scores[context + symbol] = (uint8_t)(score > 255 ? 255 : score);
+		}
+	}
+
+	ModelHeader header;
+	memset(&header, 0, sizeof(header));
+	header.magic = MODEL_MAGIC;
+	header.version = MODEL_VERSION;
+	header.symbolCount = (uint16_t)symbols;
+	header.layoutCount = keymap->layoutCount;
+	header.scale = MODEL_SCALE;
+	memcpy(header.layouts, keymap->layouts, sizeof(header.layouts));
+	memcpy(header.symbolOf, keymap->symbolOf, sizeof(header.symbolOf));
+
+	FILE* file = fopen(path, "wb");
+	if (file == NULL)
+	{
+		free(scores);
+		return 0;
+	}
+
+	int ok = fwrite(&header, sizeof(header), 1, file) == 1 &&
+		fwrite(scores, 1, table * keymap->layoutCount, file) == table * keymap->layoutCount;
+	free(scores);
+	return fclose(file) == 0 && ok;
+}
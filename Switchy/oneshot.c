@@ -0,0 +1,60 @@
+#include "oneshot.h"
+#include <string.h>
+#include "checked.h"
+
+
+void OneShot_Init(OneShot* oneShot)
+{
+	memset(oneShot, 0, sizeof(*oneShot));
+}
+
+
+void OneShot_Begin(OneShot* oneShot, const KeyLayout* target)
+{
+	oneShot->target = target;
+}
+
+
+void OneShot_End(OneShot* oneShot)
+{
+	oneShot->target = NULL;
+}
+
+
+int OneShot_OnKey(OneShot* oneShot, uint8_t vkCode, int down, uint32_t flags, uint16_t* ch)
+{
+	uint8_t* key = &oneShot->keys[vkCode];
+	if (!down)
+	{
+		int action = *key == ONESHOT_KEY_TYPED ? ONESHOT_DROP : ONESHOT_PASS;
+		*key = ONESHOT_KEY_UP;
+		return action;
+	}
+
+	// Auto-repeat of a key that went through
+	if (*key == ONESHOT_KEY_PASSED)
+	{
+		return ONESHOT_PASS;
+	}
+
+	uint16_t typed = 0;
+	if (oneShot->target != NULL && !(flags & ONESHOT_MODIFIERS))
+	{
+		typed = oneShot->target->chars[vkCode][(flags & ONESHOT_SHIFT) ? LAYOUT_SHIFT : LAYOUT_PLAIN];
+	}
+	if (typed == 0)
+	{
+		// A typed key repeating after CapsLock was released stays silent
+		if (*key == ONESHOT_KEY_TYPED)
+		{
+			return ONESHOT_DROP;
+		}
+		*key = ONESHOT_KEY_PASSED;
+		return ONESHOT_PASS;
+	}
+
+	*key = ONESHOT_KEY_TYPED;
+	*ch = typed;
+	oneShot->typed++;
+	return ONESHOT_TYPE;
+}
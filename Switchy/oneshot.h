@@ -0,0 +1,40 @@
+#pragma once
+#include <stddef.h>
+#include <stdint.h>
+#include "layout.h"
+
+// Typing a word in the other layout while CapsLock is held, without
+// switching to it and back. A key that types a character in the other
+// layout is suppressed and that character is sent instead; keys typing
+// nothing there and keys pressed with Ctrl, Alt or Win pass through. A key
+// is handled the way its press was until it is released, so auto-repeats
+// and releases follow the press even when CapsLock is let go in between.
+
+#define ONESHOT_PASS 0
+#define ONESHOT_TYPE 1
+#define ONESHOT_DROP 2
+
+// Flags of OneShot_OnKey
+#define ONESHOT_SHIFT 0x1
+// Ctrl, Alt or Win is held
+#define ONESHOT_MODIFIERS 0x2
+
+#define ONESHOT_KEY_UP 0
+#define ONESHOT_KEY_PASSED 1
+#define ONESHOT_KEY_TYPED 2
+
+typedef struct {
+	// Characters of the other layout, NULL while CapsLock is not held
+	const KeyLayout* target;
+	// ONESHOT_KEY_* of every key
+	uint8_t keys[256];
+	uint32_t typed;
+} OneShot;
+
+void OneShot_Init(OneShot* oneShot);
+// Starts typing in the layout of `target` (NULL when there is none)
+void OneShot_Begin(OneShot* oneShot, const KeyLayout* target);
+void OneShot_End(OneShot* oneShot);
+// Returns ONESHOT_TYPE with the character to send in `ch` (the key is
+// suppressed), ONESHOT_DROP to suppress the key, ONESHOT_PASS to let it go
+int OneShot_OnKey(OneShot* oneShot, uint8_t vkCode, int down, uint32_t flags, uint16_t* ch);
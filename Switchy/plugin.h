@@ -0,0 +1,50 @@
+#pragma once
+#include <stdint.h>
+
+// The interface between Switchy and plugin libraries (DLL or .so). It only
+// uses fixed-size C types, so plugins built with any compiler keep working:
+// structures only ever grow at the end, and a plugin checks `size` before
+// reading a field added after the version it was built for.
+//
+// A plugin exports SwitchyPluginInit. Its OnAction is called for every
+// action Switchy performs, on a worker thread of its own and never from the
+// keyboard hook, one call at a time. A call that takes longer than the
+// budget set in Switchy.plugins is an overrun. After three overruns, or
+// once a single call has run for ten times the budget, the plugin
+// receives nothing more.
+
+#define SWITCHY_PLUGIN_ABI 1
+#define SWITCHY_PLUGIN_INIT "SwitchyPluginInit"
+
+#ifdef _WIN32
+#define SWITCHY_PLUGIN_EXPORT __declspec(dllexport)
+#else
+#define SWITCHY_PLUGIN_EXPORT __attribute__((visibility("default")))
+#endif
+
+#define SWITCHY_ACTION_SWITCH 1     // Switched to the next layout
+#define SWITCHY_ACTION_CAPS_LOCK 2  // Toggled CapsLock
+#define SWITCHY_ACTION_ENABLE 3     // value: 1 enabled, 0 disabled
+#define SWITCHY_ACTION_CONVERT 4    // Converted the selected text
+#define SWITCHY_ACTION_LAYOUT 5     // value: layout selected by a macro or rule, e.g. 0x00000419
+
+typedef struct {
+	uint32_t size;
+	uint32_t type;
+	uint32_t value;
+	// Milliseconds, same clock as the key event times
+	uint32_t time;
+} SwitchyAction;
+
+typedef struct {
+	uint32_t size;
+	const char* name;
+	void* context;
+	void (*OnAction)(void* context, const SwitchyAction* action);
+	// Called when Switchy exits, on the thread that loaded the plugin. May be NULL.
+	void (*Unload)(void* context);
+} SwitchyPlugin;
+
+// Returns NULL if the plugin doesn't support `abi`. The result must stay
+// valid until Unload.
+typedef const SwitchyPlugin* (*SwitchyPluginInitProc)(uint32_t abi);
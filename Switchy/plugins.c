@@ -0,0 +1,498 @@
+#include "plugins.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#ifdef _WIN32
+#include <Windows.h>
+#else
+#include <dlfcn.h>
+#include <pthread.h>
+#include <semaphore.h>
+#include <time.h>
+#endif
+#include "checked.h"
+
+#define MAX_LINE (PLUGIN_MAX_PATH + 32)
+
+#ifdef _WIN32
+typedef DWORD ThreadResult;
+#define THREAD_CALL WINAPI
+#else
+typedef void* ThreadResult;
+#define THREAD_CALL
+#endif
+
+
+static uint32_t AtomicLoad(volatile uint32_t* value)
+{
+#ifdef _WIN32
+	return (uint32_t)InterlockedCompareExchange((volatile LONG*)value, 0, 0);
+#else
+	return __atomic_load_n(value, __ATOMIC_ACQUIRE);
+#endif
+}
+
+
+static void AtomicStore(volatile uint32_t* value, uint32_t newValue)
+{
+#ifdef _WIN32
+	InterlockedExchange((volatile LONG*)value, (LONG)newValue);
+#else
+	__atomic_store_n(value, newValue, __ATOMIC_RELEASE);
+#endif
+}
+
+
+static uint32_t AtomicExchange(volatile uint32_t* value, uint32_t newValue)
+{
+#ifdef _WIN32
+	return (uint32_t)InterlockedExchange((volatile LONG*)value, (LONG)newValue);
+#else
+	return __atomic_exchange_n(value, newValue, __ATOMIC_ACQ_REL);
+#endif
+}
+
+
+static uint32_t AtomicIncrement(volatile uint32_t* value)
+{
+#ifdef _WIN32
+	return (uint32_t)InterlockedIncrement((volatile LONG*)value);
+#else
+	return __atomic_add_fetch(value, 1, __ATOMIC_ACQ_REL);
+#endif
+}
+
+
+// Milliseconds on the clock of the key event times
+static uint32_t Milliseconds()
+{
+#ifdef _WIN32
+	return GetTickCount();
+#else
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint32_t)((uint64_t)ts.tv_sec * 1000 + (uint64_t)ts.tv_nsec / 1000000);
+#endif
+}
+
+
+static void SleepMilliseconds(uint32_t milliseconds)
+{
+#ifdef _WIN32
+	Sleep(milliseconds);
+#else
+	struct timespec ts = { milliseconds / 1000, (long)(milliseconds % 1000) * 1000000 };
+	nanosleep(&ts, NULL);
+#endif
+}
+
+
+static void* CreateWake()
+{
+#ifdef _WIN32
+	return CreateEvent(NULL, FALSE, FALSE, NULL);
+#else
+	sem_t* semaphore = malloc(sizeof(sem_t));
+	if (semaphore != NULL && sem_init(semaphore, 0, 0) != 0)
+	{
+		free(semaphore);
+		semaphore = NULL;
+	}
+	return semaphore;
+#endif
+}
+
+
+static void Wake(void* wake)
+{
+#ifdef _WIN32
+	SetEvent((HANDLE)wake);
+#else
+	sem_post((sem_t*)wake);
+#endif
+}
+
+
+static void WaitWake(void* wake)
+{
+#ifdef _WIN32
+	WaitForSingleObject((HANDLE)wake, INFINITE);
+#else
+	while (sem_wait((sem_t*)wake) != 0);
+#endif
+}
+
+
+static void DestroyWake(void* wake)
+{
+#ifdef _WIN32
+	CloseHandle((HANDLE)wake);
+#else
+	sem_destroy((sem_t*)wake);
+	free(wake);
+#endif
+}
+
+
+// Threads are never joined: one stuck in a plugin could not be
+static void* StartThread(ThreadResult (THREAD_CALL *proc)(void*), void* param)
+{
+#ifdef _WIN32
+	return CreateThread(NULL, 0, proc, param, 0, NULL);
+#else
+	pthread_t thread;
+	if (pthread_create(&thread, NULL, proc, param) != 0)
+	{
+		return NULL;
+	}
+	pthread_detach(thread);
+	return (void*)1;
+#endif
+}
+
+
+static void CloseThread(void* thread)
+{
+#ifdef _WIN32
+	CloseHandle((HANDLE)thread);
+#else
+	(void)thread;
+#endif
+}
+
+
+static void* OpenLibrary(const char* path)
+{
+#ifdef _WIN32
+	return LoadLibraryA(path);
+#else
+	return dlopen(path, RTLD_NOW | RTLD_LOCAL);
+#endif
+}
+
+
+static SwitchyPluginInitProc FindInit(void* library)
+{
+#ifdef _WIN32
+	return (SwitchyPluginInitProc)GetProcAddress((HMODULE)library, SWITCHY_PLUGIN_INIT);
+#else
+	return (SwitchyPluginInitProc)dlsym(library, SWITCHY_PLUGIN_INIT);
+#endif
+}
+
+
+static void CloseLibrary(void* library)
+{
+#ifdef _WIN32
+	FreeLibrary((HMODULE)library);
+#else
+	dlclose(library);
+#endif
+}
+
+
+// Counts the call once, whether the watchdog or the worker notices it first
+static void CountOverrun(PluginSlot* slot, uint32_t call)
+{
+	if (AtomicExchange(&slot->counted, call) != call && AtomicIncrement(&slot->overruns) >= PLUGIN_MAX_OVERRUNS)
+	{
+		AtomicStore(&slot->disabled, 1);
+	}
+}
+
+
+static ThreadResult THREAD_CALL Worker(void* param)
+{
+	PluginSlot* slot = (PluginSlot*)param;
+	while (!AtomicLoad(slot->stopping))
+	{
+		WaitWake(slot->wake);
+		uint32_t tail = slot->tail;
+		while (!AtomicLoad(slot->stopping) && tail != AtomicLoad(&slot->head))
+		{
+			if (AtomicLoad(&slot->disabled))
+			{
+				slot->discarded++;
+			}
+			else
+			{
+				uint32_t call = slot->call + 1;
+				uint32_t start = Milliseconds();
+				AtomicStore(&slot->call, call);
+				AtomicStore(&slot->callStart, start);
+				AtomicStore(&slot->calling, 1);
+				slot->plugin->OnAction(slot->plugin->context, &slot->queue[tail & (PLUGIN_QUEUE - 1)]);
+				AtomicStore(&slot->calling, 0);
+				if (Milliseconds() - start > slot->budget)
+				{
+					CountOverrun(slot, call);
+				}
+				slot->delivered++;
+			}
+			AtomicStore(&slot->tail, ++tail);
+		}
+	}
+	AtomicStore(&slot->finished, 1);
+	return 0;
+}
+
+
+static ThreadResult THREAD_CALL Watchdog(void* param)
+{
+	PluginHost* host = (PluginHost*)param;
+	while (!AtomicLoad(&host->stopping))
+	{
+		SleepMilliseconds(PLUGIN_WATCHDOG_INTERVAL);
+		uint32_t now = Milliseconds();
+		for (int i = 0; i < host->count; i++)
+		{
+			PluginSlot* slot = &host->slots[i];
+			if (!AtomicLoad(&slot->calling) || AtomicLoad(&slot->disabled))
+			{
+				continue;
+			}
+			uint32_t running = now - AtomicLoad(&slot->callStart);
+			if (running > slot->budget)
+			{
+				CountOverrun(slot, AtomicLoad(&slot->call));
+			}
+			// A call this long may never return
+			if (running > PLUGIN_HANG_BUDGETS * slot->budget)
+			{
+				AtomicStore(&slot->disabled, 1);
+			}
+		}
+	}
+	AtomicStore(&host->watchdogFinished, 1);
+	return 0;
+}
+
+
+int Plugins_Load(PluginHost* host, const char* library, uint32_t budget, char* error, size_t errorSize)
+{
+	if (host->stopping)
+	{
+		snprintf(error, errorSize, "Plugins have been unloaded");
+		return 0;
+	}
+	if (host->count == PLUGIN_MAX)
+	{
+		snprintf(error, errorSize, "No more than %d plugins can be loaded", PLUGIN_MAX);
+		return 0;
+	}
+	if (strlen(library) >= PLUGIN_MAX_PATH)
+	{
+		snprintf(error, errorSize, "Plugin path is too long");
+		return 0;
+	}
+
+	PluginSlot* slot = &host->slots[host->count];
+	memset(slot, 0, sizeof(*slot));
+	strcpy(slot->path, library);
+	slot->budget = budget;
+	slot->library = OpenLibrary(library);
+	if (slot->library == NULL)
+	{
+		snprintf(error, errorSize, "Cannot load plugin \"%s\"", library);
+		return 0;
+	}
+
+	SwitchyPluginInitProc init = FindInit(slot->library);
+	slot->plugin = init ? init(SWITCHY_PLUGIN_ABI) : NULL;
+	if (slot->plugin == NULL || slot->plugin->size < sizeof(SwitchyPlugin) || slot->plugin->OnAction == NULL)
+	{
+		snprintf(error, errorSize, "\"%s\" is not a Switchy plugin of version %d", library, SWITCHY_PLUGIN_ABI);
+		if (slot->plugin != NULL && slot->plugin->size >= sizeof(SwitchyPlugin) && slot->plugin->Unload != NULL)
+		{
+			slot->plugin->Unload(slot->plugin->context);
+		}
+		CloseLibrary(slot->library);
+		return 0;
+	}
+
+	slot->stopping = &host->stopping;
+	slot->wake = CreateWake();
+	slot->thread = slot->wake ? StartThread(Worker, slot) : NULL;
+	if (slot->thread == NULL)
+	{
+		snprintf(error, errorSize, "Cannot start a thread for plugin \"%s\"", library);
+		if (slot->wake != NULL)
+		{
+			DestroyWake(slot->wake);
+		}
+		if (slot->plugin->Unload != NULL)
+		{
+			slot->plugin->Unload(slot->plugin->context);
+		}
+		CloseLibrary(slot->library);
+		return 0;
+	}
+	host->count++;
+
+	if (host->watchdog == NULL)
+	{
+		host->watchdog = StartThread(Watchdog, host);
+	}
+	return 1;
+}
+
+
+int Plugins_LoadFile(PluginHost* host, const char* path, char* error, size_t errorSize)
+{
+	error[0] = 0;
+	FILE* file = fopen(path, "r");
+	if (file == NULL)
+	{
+		snprintf(error, errorSize, "Cannot open \"%s\"", path);
+		return 0;
+	}
+
+	// Relative libraries are looked up next to the config file
+	size_t folderLength = strlen(path);
+	while (folderLength > 0 && path[folderLength - 1] != '/' && path[folderLength - 1] != '\\')
+	{
+		folderLength--;
+	}
+
+	char line[MAX_LINE];
+	char library[PLUGIN_MAX_PATH];
+	int number = 0;
+	int ok = 1;
+	while (ok && fgets(line, sizeof(line), file))
+	{
+		number++;
+		char* start = line;
+		while (*start == ' ' || *start == '\t')
+		{
+			start++;
+		}
+		if (*start == '#' || *start == '\r' || *start == '\n' || *start == 0)
+		{
+			continue;
+		}
+
+		char* equals = strchr(start, '=');
+		char* end = equals ? equals : start + strcspn(start, "\r\n");
+		while (end > start && (end[-1] == ' ' || end[-1] == '\t'))
+		{
+			end--;
+		}
+
+		uint32_t budget = PLUGIN_DEFAULT_BUDGET;
+		if (equals != NULL)
+		{
+			char* budgetEnd;
+			unsigned long value = strtoul(equals + 1, &budgetEnd, 10);
+			while (*budgetEnd == ' ' || *budgetEnd == '\t' || *budgetEnd == '\r' || *budgetEnd == '\n')
+			{
+				budgetEnd++;
+			}
+			if (budgetEnd == equals + 1 || *budgetEnd != 0 || value == 0 || value > 60000)
+			{
+				snprintf(error, errorSize, "Line %d: expected \"<library> = <milliseconds>\"", number);
+				ok = 0;
+				break;
+			}
+			budget = (uint32_t)value;
+		}
+
+		int relative = !(start[0] == '/' || start[0] == '\\' || (start[0] != 0 && start[1] == ':'));
+		size_t prefix = relative ? folderLength : 0;
+		if (end == start || prefix + (size_t)(end - start) >= sizeof(library))
+		{
+			snprintf(error, errorSize, "Line %d: expected \"<library> = <milliseconds>\"", number);
+			ok = 0;
+			break;
+		}
+		memcpy(library, path, prefix);
+		memcpy(library + prefix, start, (size_t)(end - start));
+		library[prefix + (end - start)] = 0;
+
+		char loadError[PLUGIN_MAX_PATH + 64];
+		if (!Plugins_Load(host, library, budget, loadError, sizeof(loadError)))
+		{
+			snprintf(error, errorSize, "Line %d: %s", number, loadError);
+			ok = 0;
+		}
+	}
+
+	fclose(file);
+	if (!ok)
+	{
+		Plugins_Free(host);
+	}
+	return ok;
+}
+
+
+void Plugins_Post(PluginHost* host, uint32_t type, uint32_t value)
+{
+	uint32_t time = Milliseconds();
+	for (int i = 0; i < host->count; i++)
+	{
+		PluginSlot* slot = &host->slots[i];
+		uint32_t head = slot->head;
+		if (AtomicLoad(&slot->disabled) || head - AtomicLoad(&slot->tail) == PLUGIN_QUEUE)
+		{
+			slot->dropped++;
+			continue;
+		}
+
+		SwitchyAction* action = &slot->queue[head & (PLUGIN_QUEUE - 1)];
+		action->size = sizeof(SwitchyAction);
+		action->type = type;
+		action->value = value;
+		action->time = time;
+		AtomicStore(&slot->head, head + 1);
+		Wake(slot->wake);
+	}
+}
+
+
+// Waits up to `timeout` milliseconds for a thread to leave
+static int WaitFinished(volatile uint32_t* finished, uint32_t timeout)
+{
+	uint32_t start = Milliseconds();
+	while (!AtomicLoad(finished))
+	{
+		if (Milliseconds() - start > timeout)
+		{
+			return 0;
+		}
+		SleepMilliseconds(1);
+	}
+	return 1;
+}
+
+
+void Plugins_Free(PluginHost* host)
+{
+	AtomicStore(&host->stopping, 1);
+	for (int i = 0; i < host->count; i++)
+	{
+		Wake(host->slots[i].wake);
+	}
+
+	for (int i = 0; i < host->count; i++)
+	{
+		PluginSlot* slot = &host->slots[i];
+		// A stuck plugin may return any time: it keeps its slot, thread, library and wake object
+		if (!WaitFinished(&slot->finished, slot->budget + PLUGIN_WATCHDOG_INTERVAL))
+		{
+			continue;
+		}
+		CloseThread(slot->thread);
+		DestroyWake(slot->wake);
+		if (slot->plugin->Unload != NULL)
+		{
+			slot->plugin->Unload(slot->plugin->context);
+		}
+		CloseLibrary(slot->library);
+	}
+
+	if (host->watchdog != NULL && WaitFinished(&host->watchdogFinished, 10 * PLUGIN_WATCHDOG_INTERVAL))
+	{
+		CloseThread(host->watchdog);
+	}
+	host->count = 0;
+}
@@ -0,0 +1,69 @@
+#pragma once
+#include <stddef.h>
+#include <stdint.h>
+#include "plugin.h"
+#include "sizes.h"
+
+// Loads the plugins listed in Switchy.plugins and delivers actions to them.
+// Plugins_Post only appends to a per-plugin lock-free ring and wakes the
+// plugin's worker thread, so the keyboard hook never waits for a plugin.
+// Calls running over the budget are counted, by the worker when they
+// return or by a watchdog thread while they run. A plugin is disabled at
+// PLUGIN_MAX_OVERRUNS of them, or as soon as one call has run for
+// PLUGIN_HANG_BUDGETS budgets, so one that hangs is cut off too. Actions
+// for a disabled plugin are dropped, or discarded if they were already
+// queued.
+//
+// Config syntax, one plugin per line (lines starting with '#' are comments):
+//   <library> [= <budget in milliseconds>]
+// Relative library paths are relative to the folder of the config file.
+
+#define PLUGIN_MAX_PATH 260
+#define PLUGIN_MAX_OVERRUNS 3
+#define PLUGIN_HANG_BUDGETS 10
+#define PLUGIN_DEFAULT_BUDGET 50
+#define PLUGIN_WATCHDOG_INTERVAL 5
+
+typedef struct {
+	char path[PLUGIN_MAX_PATH];
+	uint32_t budget;
+	void* library;
+	const SwitchyPlugin* plugin;
+	void* thread;
+	void* wake;
+	volatile uint32_t* stopping;
+	// Written only by Plugins_Post
+	volatile uint32_t head;
+	uint32_t dropped;
+	// Written only by the worker
+	volatile uint32_t tail;
+	volatile uint32_t call;
+	volatile uint32_t callStart;
+	volatile uint32_t calling;
+	volatile uint32_t finished;
+	uint32_t delivered;
+	uint32_t discarded;
+	// Shared by the worker and the watchdog
+	volatile uint32_t counted;
+	volatile uint32_t overruns;
+	volatile uint32_t disabled;
+	SwitchyAction queue[PLUGIN_QUEUE];
+} PluginSlot;
+
+typedef struct {
+	PluginSlot slots[PLUGIN_MAX];
+	int count;
+	void* watchdog;
+	volatile uint32_t stopping;
+	volatile uint32_t watchdogFinished;
+} PluginHost;
+
+// The host starts zeroed. Both return 0 and describe the first problem in
+// `error`; LoadFile then unloads the plugins that were already loaded.
+int Plugins_Load(PluginHost* host, const char* library, uint32_t budget, char* error, size_t errorSize);
+int Plugins_LoadFile(PluginHost* host, const char* path, char* error, size_t errorSize);
+// Never blocks. Must always be called from the same thread.
+void Plugins_Post(PluginHost* host, uint32_t type, uint32_t value);
+// Waits for the workers a little; plugins stuck in a call are abandoned
+// without being unloaded. The host cannot load plugins again.
+void Plugins_Free(PluginHost* host);
@@ -0,0 +1,583 @@
+#include "rules.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "checked.h"
+
+#define MAX_CONFIG (4 * 1024 * 1024)
+#define OTHER_SYMBOL 0
+
+typedef struct {
+	uint8_t* pool;
+	size_t poolUsed;
+	size_t poolSize;
+	uint32_t* offsets;
+	uint32_t* lengths;
+	uint32_t patternSize;
+	uint32_t ruleSize;
+} Parser;
+
+
+// Simple case folding for the scripts window titles are usually in:
+// ASCII, Latin-1 and Cyrillic
+static uint32_t FoldCase(uint32_t code)
+{
+	if ((code >= 'A' && code <= 'Z') || (code >= 0xC0 && code <= 0xDE && code != 0xD7) || (code >= 0x410 && code <= 0x42F))
+	{
+		return code + 0x20;
+	}
+	if (code >= 0x400 && code <= 0x40F)
+	{
+		return code + 0x50;
+	}
+	return code;
+}
+
+
+static int EncodeFolded(uint32_t code, uint8_t* out)
+{
+	code = FoldCase(code);
+	if (code < 0x80)
+	{
+		out[0] = (uint8_t)code;
+		return 1;
+	}
+	if (code < 0x800)
+	{
+		out[0] = (uint8_t)(0xC0 | (code >> 6));
+		out[1] = (uint8_t)(0x80 | (code & 0x3F));
+		return 2;
+	}
+	if (code < 0x10000)
+	{
+		out[0] = (uint8_t)(0xE0 | (code >> 12));
+		out[1] = (uint8_t)(0x80 | ((code >> 6) & 0x3F));
+		out[2] = (uint8_t)(0x80 | (code & 0x3F));
+		return 3;
+	}
+	out[0] = (uint8_t)(0xF0 | (code >> 18));
+	out[1] = (uint8_t)(0x80 | ((code >> 12) & 0x3F));
+	out[2] = (uint8_t)(0x80 | ((code >> 6) & 0x3F));
+	out[3] = (uint8_t)(0x80 | (code & 0x3F));
+	return 4;
+}
+
+
+// Appends the case-folded UTF-8 of a pattern to the pool
+static int AddPattern(RuleSet* set, Parser* parser, const char* text, size_t length, RuleField field)
+{
+	if (set->patternCount == parser->patternSize)
+	{
+		uint32_t size = parser->patternSize ? parser->patternSize * 2 : 64;
+		RulePattern* patterns = realloc(set->patterns, size * sizeof(RulePattern));
+		set->patterns = patterns ? patterns : set->patterns;
+		uint32_t* offsets = realloc(parser->offsets, size * sizeof(uint32_t));
+		parser->offsets = offsets ? offsets : parser->offsets;
+		uint32_t* lengths = realloc(parser->lengths, size * sizeof(uint32_t));
+		parser->lengths = lengths ? lengths : parser->lengths;
+		if (patterns == NULL || offsets == NULL || lengths == NULL)
+		{
+			return 0;
+		}
+		parser->patternSize = size;
+	}
+
+	if (parser->poolUsed + length > parser->poolSize)
+	{
+		size_t poolSize = (parser->poolSize + length) * 2;
+		uint8_t* pool = realloc(parser->pool, poolSize);
+		if (pool == NULL)
+		{
+			return 0;
+		}
+		parser->pool = pool;
+		parser->poolSize = poolSize;
+	}
+
+	uint32_t offset = (uint32_t)parser->poolUsed;
+	for (size_t i = 0; i < length;)
+	{
+		unsigned char lead = (unsigned char)text[i];
+		int extra = lead < 0x80 ? 0 : lead < 0xE0 ? 1 : lead < 0xF0 ? 2 : 3;
+		uint32_t code = extra == 0 ? lead : lead & (0x3F >> extra);
+		if ((lead >= 0x80 && lead < 0xC0) || i + extra >= length)
+		{
+			return 0;
+		}
+		for (int k = 1; k <= extra; k++)
+		{
+			code = (code << 6) | ((unsigned char)text[i + k] & 0x3F);
+		}
+		i += 1 + extra;
+		// Folding never makes a character longer than it was
+		parser->poolUsed += EncodeFolded(code, parser->pool + parser->poolUsed);
+	}
+
+	Rule* rule = &set->rules[set->ruleCount];
+	RulePattern* pattern = &set->patterns[set->patternCount];
+	pattern->rule = set->ruleCount;
+	pattern->field = (uint8_t)field;
+	pattern->bit = rule->patternCount++;
+	parser->offsets[set->patternCount] = offset;
+	parser->lengths[set->patternCount] = (uint32_t)(parser->poolUsed - offset);
+	set->patternCount++;
+	return parser->poolUsed > offset;
+}
+
+
+static const char* SkipSpaces(const char* text, const char* end)
+{
+	while (text < end && (*text == ' ' || *text == '\t'))
+	{
+		text++;
+	}
+	return text;
+}
+
+
+static int IsWord(const char* text, size_t length, const char* word)
+{
+	return length == strlen(word) && memcmp(text, word, length) == 0;
+}
+
+
+static int ParseAction(Rule* rule, const char* text, const char* end)
+{
+	text = SkipSpaces(text, end);
+	while (end > text && (end[-1] == ' ' || end[-1] == '\t'))
+	{
+		end--;
+	}
+
+	const char* word = text;
+	while (text < end && *text != ' ' && *text != '\t')
+	{
+		text++;
+	}
+	size_t wordLength = (size_t)(text - word);
+	text = SkipSpaces(text, end);
+
+	if (IsWord(word, wordLength, "disable") && text == end)
+	{
+		rule->type = RULE_DISABLE;
+		return 1;
+	}
+	if (IsWord(word, wordLength, "layout") && end - text == 8)
+	{
+		rule->type = RULE_LAYOUT;
+		memcpy(rule->layout, text, 8);
+		rule->layout[8] = 0;
+		return 1;
+	}
+	return 0;
+}
+
+
+// Parses the conditions of one rule, returns the position of '=' or NULL
+static const char* ParseConditions(RuleSet* set, Parser* parser, const char* text, const char* end, int line, char* error, size_t errorSize)
+{
+	Rule* rule = &set->rules[set->ruleCount];
+	for (text = SkipSpaces(text, end); text < end && *text != '='; text = SkipSpaces(text, end))
+	{
+		const char* word = text;
+		while (text < end && *text != ' ' && *text != '\t' && *text != '=')
+		{
+			text++;
+		}
+		size_t wordLength = (size_t)(text - word);
+
+		if (IsWord(word, wordLength, "fullscreen"))
+		{
+			rule->fullscreen = 1;
+			continue;
+		}
+
+		RuleField field;
+		if (IsWord(word, wordLength, "process"))
+		{
+			field = RULE_FIELD_PROCESS;
+		}
+		else if (IsWord(word, wordLength, "class"))
+		{
+			field = RULE_FIELD_CLASS;
+		}
+		else if (IsWord(word, wordLength, "title"))
+		{
+			field = RULE_FIELD_TITLE;
+		}
+		else
+		{
+			snprintf(error, errorSize, "Line %d: unknown condition \"%.*s\"", line, (int)wordLength, word);
+			return NULL;
+		}
+
+		const char* pattern = SkipSpaces(text, end);
+		if (pattern < end && *pattern == '"')
+		{
+			pattern++;
+			text = memchr(pattern, '"', (size_t)(end - pattern));
+			if (text == NULL)
+			{
+				snprintf(error, errorSize, "Line %d: missing closing quote", line);
+				return NULL;
+			}
+		}
+		else
+		{
+			for (text = pattern; text < end && *text != ' ' && *text != '\t' && *text != '='; text++);
+		}
+
+		if (rule->patternCount == RULE_MAX_CONDITIONS)
+		{
+			snprintf(error, errorSize, "Line %d: too many conditions", line);
+			return NULL;
+		}
+		if (!AddPattern(set, parser, pattern, (size_t)(text - pattern), field))
+		{
+			snprintf(error, errorSize, "Line %d: empty or invalid pattern", line);
+			return NULL;
+		}
+		if (text < end && *text == '"')
+		{
+			text++;
+		}
+	}
+
+	if (text == end)
+	{
+		snprintf(error, errorSize, "Line %d: expected \"<conditions> = <action>\"", line);
+		return NULL;
+	}
+	if (rule->patternCount == 0 && !rule->fullscreen)
+	{
+		snprintf(error, errorSize, "Line %d: no conditions", line);
+		return NULL;
+	}
+	return text;
+}
+
+
+// Builds the trie of all patterns and turns it into a complete automaton
+static int BuildAutomaton(RuleSet* set, const Parser* parser)
+{
+	for (size_t i = 0; i < parser->poolUsed; i++)
+	{
+		uint8_t byte = parser->pool[i];
+		if (set->symbolOf[byte] == OTHER_SYMBOL)
+		{
+			set->symbolOf[byte] = (uint8_t)set->symbolCount++;
+		}
+	}
+
+	uint32_t symbols = set->symbolCount;
+	size_t maxStates = parser->poolUsed + 1;
+	uint32_t* own = malloc(maxStates * sizeof(uint32_t));
+	uint32_t* nextOwn = malloc((set->patternCount + 1) * sizeof(uint32_t));
+	uint32_t* fail = malloc(maxStates * sizeof(uint32_t));
+	uint32_t* queue = malloc(maxStates * sizeof(uint32_t));
+	set->next = malloc(maxStates * symbols * sizeof(uint32_t));
+	set->outputStart = malloc((maxStates + 1) * sizeof(uint32_t));
+	int ok = own && nextOwn && fail && queue && set->next && set->outputStart;
+	if (!ok)
+	{
+		goto done;
+	}
+
+	memset(set->next, 0xFF, maxStates * symbols * sizeof(uint32_t));
+	own[0] = RULE_NONE;
+	set->stateCount = 1;
+	for (uint32_t index = 0; index < set->patternCount; index++)
+	{
+		uint32_t state = 0;
+		const uint8_t* bytes = parser->pool + parser->offsets[index];
+		for (uint32_t i = 0; i < parser->lengths[index]; i++)
+		{
+			uint32_t* slot = &set->next[state * symbols + set->symbolOf[bytes[i]]];
+			if (*slot == RULE_NONE)
+			{
+				own[set->stateCount] = RULE_NONE;
+				*slot = set->stateCount++;
+			}
+			state = *slot;
+		}
+		nextOwn[index] = own[state];
+		own[state] = index;
+	}
+
+	// A missing transition continues from the longest suffix that is still
+	// a prefix of some pattern; a state reports its own patterns and those
+	// of that suffix
+	uint32_t head = 0, tail = 0;
+	for (uint32_t symbol = 0; symbol < symbols; symbol++)
+	{
+		uint32_t child = set->next[symbol];
+		if (child == RULE_NONE)
+		{
+			set->next[symbol] = 0;
+		}
+		else
+		{
+			fail[child] = 0;
+			queue[tail++] = child;
+		}
+	}
+	while (head < tail)
+	{
+		uint32_t state = queue[head++];
+		for (uint32_t symbol = 0; symbol < symbols; symbol++)
+		{
+			uint32_t* slot = &set->next[state * symbols + symbol];
+			uint32_t fallback = set->next[fail[state] * symbols + symbol];
+			if (*slot == RULE_NONE)
+			{
+				*slot = fallback;
+				continue;
+			}
+			fail[*slot] = fallback;
+			queue[tail++] = *slot;
+		}
+	}
+
+	// Flatten the output lists in BFS order, so the list of a suffix is
+	// complete before the states that copy it
+	uint32_t total = 0;
+	uint32_t* sizes = malloc(set->stateCount * sizeof(uint32_t));
+	ok = sizes != NULL;
+	if (ok)
+	{
+		sizes[0] = 0;
+		for (uint32_t i = 0; i < tail; i++)
+		{
+			uint32_t state = queue[i];
+			uint32_t size = sizes[fail[state]];
+			for (uint32_t index = own[state]; index != RULE_NONE; index = nextOwn[index])
+			{
+				size++;
+			}
+			sizes[state] = size;
+		}
+		for (uint32_t state = 0; state < set->stateCount; state++)
+		{
+			set->outputStart[state] = total;
+			total += sizes[state];
+		}
+		set->outputStart[set->stateCount] = total;
+		set->outputs = malloc((total + 1) * sizeof(uint32_t));
+		ok = set->outputs != NULL;
+	}
+	if (ok)
+	{
+		for (uint32_t i = 0; i < tail; i++)
+		{
+			uint32_t state = queue[i];
+			uint32_t* out = set->outputs + set->outputStart[state];
+			for (uint32_t index = own[state]; index != RULE_NONE; index = nextOwn[index])
+			{
+				*out++ = index;
+			}
+			uint32_t suffix = fail[state];
+			memcpy(out, set->outputs + set->outputStart[suffix], sizes[suffix] * sizeof(uint32_t));
+		}
+
+		uint32_t* next = realloc(set->next, (size_t)set->stateCount * symbols * sizeof(uint32_t));
+		if (next != NULL)
+		{
+			set->next = next;
+		}
+	}
+	free(sizes);
+
+done:
+	free(own);
+	free(nextOwn);
+	free(fail);
+	free(queue);
+	return ok;
+}
+
+
+int Rules_Compile(RuleSet* set, const char* config, char* error, size_t errorSize)
+{
+	Parser parser;
+	memset(&parser, 0, sizeof(parser));
+	memset(set, 0, sizeof(*set));
+	set->symbolCount = 1;
+	error[0] = 0;
+
+	int line = 0;
+	int ok = 1;
+	for (const char* text = config; *text && ok;)
+	{
+		const char* end = text + strcspn(text, "\r\n");
+		const char* next = *end ? end + 1 : end;
+		const char* first = SkipSpaces(text, end);
+		line++;
+		text = next;
+
+		if (first == end || *first == '#')
+		{
+			continue;
+		}
+
+		if (set->ruleCount == parser.ruleSize)
+		{
+			parser.ruleSize = parser.ruleSize ? parser.ruleSize * 2 : 64;
+			Rule* rules = realloc(set->rules, parser.ruleSize * sizeof(Rule));
+			if (rules == NULL)
+			{
+				snprintf(error, errorSize, "Out of memory");
+				ok = 0;
+				break;
+			}
+			set->rules = rules;
+		}
+		memset(&set->rules[set->ruleCount], 0, sizeof(Rule));
+		set->rules[set->ruleCount].line = line;
+
+		const char* equals = ParseConditions(set, &parser, first, end, line, error, errorSize);
+		if (equals == NULL)
+		{
+			ok = 0;
+			break;
+		}
+		if (!ParseAction(&set->rules[set->ruleCount], equals + 1, end))
+		{
+			snprintf(error, errorSize, "Line %d: unknown action", line);
+			ok = 0;
+			break;
+		}
+		set->ruleCount++;
+	}
+
+	if (ok)
+	{
+		set->matched = calloc(set->ruleCount + 1, 1);
+		set->touched = malloc((set->ruleCount + 1) * sizeof(uint32_t));
+		ok = set->matched && set->touched && BuildAutomaton(set, &parser);
+		if (!ok)
+		{
+			snprintf(error, errorSize, "Out of memory");
+		}
+	}
+	set->fullscreenRule = RULE_NONE;
+	for (uint32_t index = 0; ok && index < set->ruleCount; index++)
+	{
+		if (set->rules[index].patternCount == 0)
+		{
+			set->fullscreenRule = index;
+			break;
+		}
+	}
+
+	free(parser.pool);
+	free(parser.offsets);
+	free(parser.lengths);
+	if (!ok)
+	{
+		Rules_Free(set);
+	}
+	return ok;
+}
+
+
+int Rules_LoadFile(RuleSet* set, const char* path, char* error, size_t errorSize)
+{
+	FILE* file = fopen(path, "rb");
+	if (file == NULL)
+	{
+		snprintf(error, errorSize, "Cannot open \"%s\"", path);
+		return 0;
+	}
+
+	char* config = malloc(MAX_CONFIG + 1);
+	size_t size = config ? fread(config, 1, MAX_CONFIG + 1, file) : 0;
+	fclose(file);
+	if (config == NULL || size > MAX_CONFIG)
+	{
+		snprintf(error, errorSize, "\"%s\" is too large", path);
+		free(config);
+		return 0;
+	}
+
+	config[size] = 0;
+	// Skip the UTF-8 byte order mark Notepad likes to add
+	int skip = size >= 3 && memcmp(config, "\xEF\xBB\xBF", 3) == 0 ? 3 : 0;
+	int ok = Rules_Compile(set, config + skip, error, errorSize);
+	free(config);
+	return ok;
+}
+
+
+void Rules_Free(RuleSet* set)
+{
+	free(set->next);
+	free(set->outputStart);
+	free(set->outputs);
+	free(set->patterns);
+	free(set->rules);
+	free(set->matched);
+	free(set->touched);
+	memset(set, 0, sizeof(*set));
+}
+
+
+uint32_t Rules_Match(RuleSet* set, const RuleWindow* window)
+{
+	const uint16_t* fields[RULE_FIELDS] = { window->process, window->windowClass, window->title };
+	uint32_t touchedCount = 0;
+	uint32_t best = RULE_NONE;
+	if (set->stateCount == 0)
+	{
+		return RULE_NONE;
+	}
+
+	for (int field = 0; field < RULE_FIELDS; field++)
+	{
+		const uint16_t* text = fields[field];
+		uint32_t state = 0;
+		for (size_t i = 0; text != NULL && text[i]; i++)
+		{
+			uint32_t code = text[i];
+			if (code >= 0xD800 && code < 0xDC00 && text[i + 1] >= 0xDC00 && text[i + 1] < 0xE000)
+			{
+				code = 0x10000 + ((code - 0xD800) << 10) + (text[++i] - 0xDC00);
+			}
+
+			uint8_t bytes[4];
+			int length = EncodeFolded(code, bytes);
+			for (int k = 0; k < length; k++)
+			{
+				state = set->next[state * set->symbolCount + set->symbolOf[bytes[k]]];
+				for (uint32_t out = set->outputStart[state]; out < set->outputStart[state + 1]; out++)
+				{
+					const RulePattern* pattern = &set->patterns[set->outputs[out]];
+					if (pattern->field != field)
+					{
+						continue;
+					}
+					if (set->matched[pattern->rule] == 0)
+					{
+						set->touched[touchedCount++] = pattern->rule;
+					}
+					set->matched[pattern->rule] |= (uint8_t)(1u << pattern->bit);
+				}
+			}
+		}
+	}
+
+	for (uint32_t i = 0; i < touchedCount; i++)
+	{
+		uint32_t index = set->touched[i];
+		const Rule* rule = &set->rules[index];
+		if (index < best && set->matched[index] == (uint8_t)((1u << rule->patternCount) - 1) && (!rule->fullscreen || window->fullscreen))
+		{
+			best = index;
+		}
+		set->matched[index] = 0;
+	}
+	if (window->fullscreen && set->fullscreenRule < best)
+	{
+		best = set->fullscreenRule;
+	}
+	return best;
+}
@@ -0,0 +1,126 @@
+#pragma once
+#include <stddef.h>
+#include <stdint.h>
+#include "sizes.h"
+
+// Per-application rules ("process mstsc.exe = disable") compiled into a
+// single Aho-Corasick automaton over the case-folded UTF-8 of the process
+// name, window class and title. The result for a window is kept in a small
+// cache keyed by its handle, so key events never match strings.
+//
+// Config syntax, one rule per line (lines starting with '#' are comments):
+//   <condition> [<condition> ...] = disable
+//   <condition> [<condition> ...] = layout <KLID>
+// where a condition is one of
+//   process <pattern>, class <pattern>, title <pattern>, fullscreen
+// Patterns are case-insensitive substrings and may be put in double quotes.
+// All conditions of a rule must hold; the first matching rule wins.
+
+#define RULE_NONE 0xFFFFFFFFu
+#define RULE_CACHE_SIZE (1 << RULE_CACHE_BITS)
+
+typedef enum {
+	RULE_FIELD_PROCESS,
+	RULE_FIELD_CLASS,
+	RULE_FIELD_TITLE,
+	RULE_FIELDS
+} RuleField;
+
+typedef enum {
+	RULE_DISABLE,
+	RULE_LAYOUT
+} RuleActionType;
+
+typedef struct {
+	RuleActionType type;
+	int line;
+	char layout[9];
+	uint8_t patternCount;
+	uint8_t fullscreen;
+} Rule;
+
+typedef struct {
+	uint32_t rule;
+	uint8_t field;
+	uint8_t bit;
+} RulePattern;
+
+typedef struct {
+	uint8_t symbolOf[256];
+	uint32_t symbolCount;
+	uint32_t stateCount;
+	uint32_t ruleCount;
+	uint32_t patternCount;
+	// next[state * symbolCount + symbol]
+	uint32_t* next;
+	// Patterns ending in a state: outputs[outputStart[state] .. outputStart[state + 1]]
+	uint32_t* outputStart;
+	uint32_t* outputs;
+	RulePattern* patterns;
+	Rule* rules;
+	// First rule with no condition but "fullscreen"
+	uint32_t fullscreenRule;
+	// Scratch space of Rules_Match
+	uint8_t* matched;
+	uint32_t* touched;
+} RuleSet;
+
+// UTF-16, zero-terminated; any string may be NULL
+typedef struct {
+	const uint16_t* process;
+	const uint16_t* windowClass;
+	const uint16_t* title;
+	int fullscreen;
+} RuleWindow;
+
+// Both return 0 and describe the first problem in `error` on a syntax error
+int Rules_Compile(RuleSet* set, const char* config, char* error, size_t errorSize);
+int Rules_LoadFile(RuleSet* set, const char* path, char* error, size_t errorSize);
+void Rules_Free(RuleSet* set);
+// Returns the index of the first matching rule or RULE_NONE
+uint32_t Rules_Match(RuleSet* set, const RuleWindow* window);
+
+// Direct-mapped cache of decisions by window handle: a collision simply
+// evicts the older window, which is matched again when it comes back.
+typedef struct {
+	uintptr_t window;
+	uint32_t rule;
+} RuleCacheEntry;
+
+typedef struct {
+	RuleCacheEntry entries[RULE_CACHE_SIZE];
+} RuleCache;
+
+static inline RuleCacheEntry* RuleCache_Slot(RuleCache* cache, uintptr_t window)
+{
+	uint32_t hash = ((uint32_t)window ^ (uint32_t)((uint64_t)window >> 32)) * 0x9E3779B1u;
+	return &cache->entries[hash >> (32 - RULE_CACHE_BITS)];
+}
+
+// Returns 0 if the window is not cached
+static inline int RuleCache_Lookup(RuleCache* cache, uintptr_t window, uint32_t* rule)
+{
+	RuleCacheEntry* entry = RuleCache_Slot(cache, window);
+	if (window == 0 || entry->window != window)
+	{
+		return 0;
+	}
+	*rule = entry->rule;
+	return 1;
+}
+
+static inline void RuleCache_Store(RuleCache* cache, uintptr_t window, uint32_t rule)
+{
+	RuleCacheEntry* entry = RuleCache_Slot(cache, window);
+	entry->window = window;
+	entry->rule = rule;
+}
+
+static inline void RuleCache_Invalidate(RuleCache* cache, uintptr_t window)
+{
+	RuleCacheEntry* entry = RuleCache_Slot(cache, window);
+	if (entry->window == window)
+	{
+		entry->window = 0;
+	}
+}
@@ -0,0 +1,185 @@
+#include "shared.h"
+#include <stdio.h>
+#include <string.h>
+#ifdef _WIN32
+#include <Windows.h>
+#include <sddl.h>
+#pragma comment(lib, "advapi32.lib")
+#else
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+#endif
+
+#define WAIT_STEP 5
+
+// Full access for SYSTEM and administrators, read access for every signed-in user
+#define SHARED_SDDL "D:(A;;GA;;;SY)(A;;GA;;;BA)(A;;GR;;;AU)"
+
+
+static void Pause(int ms)
+{
+#ifdef _WIN32
+	Sleep(ms);
+#else
+	struct timespec delay = { 0, ms * 1000000L };
+	nanosleep(&delay, NULL);
+#endif
+}
+
+
+#ifdef _WIN32
+static HANDLE CreateSection(const char* name, size_t size, BOOL* existed)
+{
+	SECURITY_ATTRIBUTES attributes = { sizeof(attributes), NULL, FALSE };
+	ConvertStringSecurityDescriptorToSecurityDescriptorA(SHARED_SDDL, SDDL_REVISION_1, &attributes.lpSecurityDescriptor, NULL);
+
+	HANDLE hMapping = CreateFileMappingA(INVALID_HANDLE_VALUE, &attributes, PAGE_READWRITE,
+		(DWORD)((uint64_t)size >> 32), (DWORD)size, name);
+	*existed = GetLastError() == ERROR_ALREADY_EXISTS;
+	LocalFree(attributes.lpSecurityDescriptor);
+	return hMapping;
+}
+#endif
+
+
+int Shared_Open(SharedSection* section, const char* name, size_t size)
+{
+	size_t total = sizeof(SharedHeader) + size;
+	memset(section, 0, sizeof(*section));
+
+#ifdef _WIN32
+	char fullName[MAX_PATH];
+	BOOL existed = FALSE;
+	snprintf(fullName, sizeof(fullName), "Global\\%s", name);
+	HANDLE hMapping = OpenFileMappingA(FILE_MAP_READ, FALSE, fullName);
+	if (hMapping == NULL)
+	{
+		// Creating global objects needs SeCreateGlobalPrivilege, fall back to the session
+		hMapping = CreateSection(fullName, total, &existed);
+		if (hMapping == NULL)
+		{
+			snprintf(fullName, sizeof(fullName), "Local\\%s", name);
+			hMapping = CreateSection(fullName, total, &existed);
+		}
+		if (hMapping == NULL)
+		{
+			return 0;
+		}
+		section->created = !existed;
+	}
+
+	section->hMapping = hMapping;
+	section->header = (SharedHeader*)MapViewOfFile(hMapping, section->created ? FILE_MAP_WRITE : FILE_MAP_READ, 0, 0, total);
+#else
+	snprintf(section->name, sizeof(section->name), "/%s", name);
+	int fd = shm_open(section->name, O_RDWR | O_CREAT | O_EXCL, 0644);
+	if (fd >= 0)
+	{
+		section->created = 1;
+		if (ftruncate(fd, (off_t)total) != 0)
+		{
+			close(fd);
+			shm_unlink(section->name);
+			return 0;
+		}
+	}
+	else if (errno == EEXIST)
+	{
+		fd = shm_open(section->name, O_RDONLY, 0);
+		struct stat st;
+		// The creator may not have sized it yet
+		for (int waited = 0; fd >= 0 && fstat(fd, &st) == 0 && (size_t)st.st_size < total && waited < 1000; waited += WAIT_STEP)
+		{
+			Pause(WAIT_STEP);
+		}
+		// Pages past the end of a short object fault with SIGBUS when read
+		if (fd >= 0 && (fstat(fd, &st) != 0 || (size_t)st.st_size < total))
+		{
+			close(fd);
+			return 0;
+		}
+	}
+	if (fd < 0)
+	{
+		return 0;
+	}
+
+	void* view = mmap(NULL, total, section->created ? PROT_READ | PROT_WRITE : PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	section->header = view == MAP_FAILED ? NULL : (SharedHeader*)view;
+#endif
+
+	if (section->header == NULL)
+	{
+		Shared_Close(section);
+		return 0;
+	}
+
+	section->data = section->header + 1;
+	section->size = size;
+	return 1;
+}
+
+
+void Shared_Publish(SharedSection* section)
+{
+	section->header->magic = SHARED_MAGIC;
+	section->header->size = (uint32_t)section->size;
+#ifdef _WIN32
+	InterlockedExchange((volatile LONG*)&section->header->ready, 1);
+#else
+	__atomic_store_n(&section->header->ready, 1, __ATOMIC_RELEASE);
+#endif
+}
+
+
+int Shared_WaitReady(SharedSection* section, int timeoutMs)
+{
+	for (int waited = 0;; waited += WAIT_STEP)
+	{
+#ifdef _WIN32
+		uint32_t ready = (uint32_t)InterlockedCompareExchange((volatile LONG*)&section->header->ready, 0, 0);
+#else
+		uint32_t ready = __atomic_load_n(&section->header->ready, __ATOMIC_ACQUIRE);
+#endif
+		if (ready)
+		{
+			return section->header->magic == SHARED_MAGIC && section->header->size == section->size;
+		}
+		if (waited >= timeoutMs)
+		{
+			return 0;
+		}
+		Pause(WAIT_STEP);
+	}
+}
+
+
+void Shared_Close(SharedSection* section)
+{
+#ifdef _WIN32
+	if (section->header)
+	{
+		UnmapViewOfFile(section->header);
+	}
+	if (section->hMapping)
+	{
+		CloseHandle(section->hMapping);
+	}
+#else
+	if (section->header)
+	{
+		munmap(section->header, sizeof(SharedHeader) + section->size);
+	}
+	// POSIX sections outlive their users; the creator removes the name
+	if (section->created)
+	{
+		shm_unlink(section->name);
+	}
+#endif
+	memset(section, 0, sizeof(*section));
+}
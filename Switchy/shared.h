@@ -0,0 +1,39 @@
+#pragma once
+#include <stddef.h>
+#include <stdint.h>
+
+// Named shared memory for large read-only tables. The first instance
+// creates the section, fills it and publishes it; instances in other
+// sessions map the same pages read-only instead of building their own copy.
+// On Windows the section lives in the Global namespace when the creator is
+// allowed to create it there, otherwise it is shared within the session only.
+
+#define SHARED_MAGIC 0x48535753u // "SWSH"
+
+typedef struct {
+	uint32_t magic;
+	uint32_t size;
+	volatile uint32_t ready;
+	uint32_t reserved;
+} SharedHeader;
+
+typedef struct {
+	SharedHeader* header;
+	void* data;
+	size_t size;
+	int created;
+#ifdef _WIN32
+	void* hMapping;
+#else
+	char name[64];
+#endif
+} SharedSection;
+
+// Creates the section (created = 1, data writable) or opens an existing
+// one read-only (created = 0). Returns 0 on failure.
+int Shared_Open(SharedSection* section, const char* name, size_t size);
+// Makes the data written by the creator visible to the other instances
+void Shared_Publish(SharedSection* section);
+// Waits until the creator has published the data
+int Shared_WaitReady(SharedSection* section, int timeoutMs);
+void Shared_Close(SharedSection* section);
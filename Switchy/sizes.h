@@ -0,0 +1,67 @@
+#pragma once
+
+// Sizes of the fixed tables and buffers used while handling key events, in
+// one place. Nothing on that path is allocated: each structure below has its
+// size set here at compile time, and any of them can be changed for a
+// smaller build on the compiler command line, e.g. -DMACRO_MAX_STATES=256.
+
+// Keyboards told apart at once, including the "unknown" slot 0
+#ifndef DEVICE_MAX
+#define DEVICE_MAX 8
+#endif
+// Hook events of one key waiting for their Raw Input event
+#ifndef DEVICE_QUEUE
+#define DEVICE_QUEUE 4
+#endif
+#ifndef DEVICE_MAX_RULES
+#define DEVICE_MAX_RULES 16
+#endif
+#ifndef DEVICE_MAX_NAME
+#define DEVICE_MAX_NAME 128
+#endif
+
+#ifndef MACRO_MAX_STATES
+#define MACRO_MAX_STATES 1024
+#endif
+#ifndef MACRO_MAX_SYMBOLS
+#define MACRO_MAX_SYMBOLS 64
+#endif
+#ifndef MACRO_MAX_ACTIONS
+#define MACRO_MAX_ACTIONS 128
+#endif
+#ifndef MACRO_MAX_KEYS
+#define MACRO_MAX_KEYS 16
+#endif
+#ifndef MACRO_TEXT_POOL
+#define MACRO_TEXT_POOL 4096
+#endif
+
+// Conditions of one rule, each a bit of a byte while matching
+#ifndef RULE_MAX_CONDITIONS
+#define RULE_MAX_CONDITIONS 8
+#endif
+// Windows whose rule is remembered, as a power of two
+#ifndef RULE_CACHE_BITS
+#define RULE_CACHE_BITS 8
+#endif
+
+#ifndef PLUGIN_MAX
+#define PLUGIN_MAX 8
+#endif
+// Actions waiting for one plugin, a power of two
+#ifndef PLUGIN_QUEUE
+#define PLUGIN_QUEUE 256
+#endif
+
+// A size that does not fit the types it is stored in fails the build
+#define SIZE_CHECK(name, condition) typedef char name[(condition) ? 1 : -1]
+
+SIZE_CHECK(DeviceSlotsFitByte, DEVICE_MAX >= 2 && DEVICE_MAX <= 255);
+SIZE_CHECK(DeviceQueueFitsByte, DEVICE_QUEUE >= 1 && DEVICE_QUEUE <= 255);
+SIZE_CHECK(MacroStatesFitIndex, MACRO_MAX_STATES >= 1 && MACRO_MAX_STATES < 0xFFFF);
+SIZE_CHECK(MacroSymbolsFitByte, MACRO_MAX_SYMBOLS >= 2 && MACRO_MAX_SYMBOLS <= 256);
+SIZE_CHECK(MacroActionsFitIndex, MACRO_MAX_ACTIONS >= 1 && MACRO_MAX_ACTIONS < 0xFFFF);
+SIZE_CHECK(MacroTextFitsIndex, MACRO_TEXT_POOL >= 1 && MACRO_TEXT_POOL <= 0xFFFF);
+SIZE_CHECK(RuleConditionsFitByte, RULE_MAX_CONDITIONS >= 1 && RULE_MAX_CONDITIONS <= 8);
+SIZE_CHECK(RuleCacheBitsInRange, RULE_CACHE_BITS >= 1 && RULE_CACHE_BITS <= 16);
+SIZE_CHECK(PluginQueueIsPowerOfTwo, PLUGIN_QUEUE >= 2 && (PLUGIN_QUEUE & (PLUGIN_QUEUE - 1)) == 0);
@@ -0,0 +1,149 @@
+#include "state.h"
+#include <stddef.h>
+#include <stdio.h>
+#include <string.h>
+#ifdef _WIN32
+#include <Windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#define STATE_MAX_PATH 512
+#define STATE_CHECKED_SIZE (uint32_t)(sizeof(StateFile) - offsetof(StateFile, sequence))
+
+
+// CRC-32 (IEEE), bitwise: the state is a few kilobytes saved once a minute at most
+uint32_t State_Checksum(const void* data, uint32_t size)
+{
+	const uint8_t* bytes = (const uint8_t*)data;
+	uint32_t crc = 0xFFFFFFFFu;
+	for (uint32_t i = 0; i < size; i++)
+	{
+		crc ^= bytes[i];
+		for (int bit = 0; bit < 8; bit++)
+		{
+			crc = (crc >> 1) ^ (0xEDB88320u & (0u - (crc & 1)));
+		}
+	}
+	return ~crc;
+}
+
+
+static int State_Validate(const StateFile* file, StateData* data, uint32_t* sequence)
+{
+	if (file->magic != STATE_MAGIC || file->version != STATE_VERSION || file->size != sizeof(StateFile) ||
+		file->checksum != State_Checksum(&file->sequence, STATE_CHECKED_SIZE))
+	{
+		return 0;
+	}
+
+	*data = file->data;
+	*sequence = file->sequence;
+	return 1;
+}
+
+
+int State_Load(const char* path, StateData* data, uint32_t* sequence)
+{
+	int ok = 0;
+#ifdef _WIN32
+	HANDLE hFile = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+	if (hFile == INVALID_HANDLE_VALUE)
+	{
+		return 0;
+	}
+
+	LARGE_INTEGER size;
+	if (GetFileSizeEx(hFile, &size) && size.QuadPart == sizeof(StateFile))
+	{
+		HANDLE hMapping = CreateFileMappingA(hFile, NULL, PAGE_READONLY, 0, 0, NULL);
+		if (hMapping != NULL)
+		{
+			const StateFile* file = (const StateFile*)MapViewOfFile(hMapping, FILE_MAP_READ, 0, 0, 0);
+			if (file != NULL)
+			{
+				ok = State_Validate(file, data, sequence);
+				UnmapViewOfFile(file);
+			}
+			CloseHandle(hMapping);
+		}
+	}
+	CloseHandle(hFile);
+#else
+	int fd = open(path, O_RDONLY);
+	if (fd < 0)
+	{
+		return 0;
+	}
+
+	struct stat st;
+	if (fstat(fd, &st) == 0 && st.st_size == sizeof(StateFile))
+	{
+		const StateFile* file = (const StateFile*)mmap(NULL, sizeof(StateFile), PROT_READ, MAP_SHARED, fd, 0);
+		if (file != MAP_FAILED)
+		{
+			ok = State_Validate(file, data, sequence);
+			munmap((void*)file, sizeof(StateFile));
+		}
+	}
+	close(fd);
+#endif
+	return ok;
+}
+
+
+int State_Save(const char* path, const StateData* data, uint32_t sequence)
+{
+	StateFile file;
+	memset(&file, 0, sizeof(file));
+	file.magic = STATE_MAGIC;
+	file.version = STATE_VERSION;
+	file.size = sizeof(StateFile);
+	file.sequence = sequence;
+	file.data = *data;
+	file.checksum = State_Checksum(&file.sequence, STATE_CHECKED_SIZE);
+
+	char temporary[STATE_MAX_PATH];
+	if (snprintf(temporary, sizeof(temporary), "%s.tmp", path) >= (int)sizeof(temporary))
+	{
+		return 0;
+	}
+
+	// The new contents must be on disk before the rename makes them visible,
+	// so a crash leaves either the old file or the new one
+#ifdef _WIN32
+	HANDLE hFile = CreateFileA(temporary, GENERIC_WRITE, 0, NULL, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+	if (hFile == INVALID_HANDLE_VALUE)
+	{
+		return 0;
+	}
+
+	DWORD written = 0;
+	BOOL ok = WriteFile(hFile, &file, sizeof(file), &written, NULL) && written == sizeof(file) && FlushFileBuffers(hFile);
+	CloseHandle(hFile);
+	if (!ok || !MoveFileExA(temporary, path, MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH))
+	{
+		DeleteFileA(temporary);
+		return 0;
+	}
+	return 1;
+#else
+	int fd = open(temporary, O_WRONLY | O_CREAT | O_TRUNC, 0600);
+	if (fd < 0)
+	{
+		return 0;
+	}
+
+	int ok = write(fd, &file, sizeof(file)) == (ssize_t)sizeof(file) && fsync(fd) == 0;
+	ok = close(fd) == 0 && ok;
+	if (!ok || rename(temporary, path) != 0)
+	{
+		unlink(temporary);
+		return 0;
+	}
+	return 1;
+#endif
+}
@@ -0,0 +1,36 @@
+#pragma once
+#include <stdint.h>
+#include "chatter.h"
+#include "sizes.h"
+
+// Runtime state kept across restarts in a fixed-layout binary file.
+// The file is mapped and validated in place, there is nothing to parse.
+// New fields go to the end of StateData together with a version bump.
+
+#define STATE_MAGIC 0x54535753u // "SWST"
+#define STATE_VERSION 2
+
+typedef struct {
+	uint32_t enabled;
+	uint32_t reserved;
+	// Chatter thresholds and the intervals they were learned from, per key
+	ChatterLearned chatter[256];
+} StateData;
+
+typedef struct {
+	uint32_t magic;
+	uint16_t version;
+	uint16_t size;
+	// Of everything after it, the sequence included
+	uint32_t checksum;
+	uint32_t sequence;
+	StateData data;
+} StateFile;
+
+SIZE_CHECK(StateFileFitsSize, sizeof(StateFile) <= 0xFFFF);
+
+uint32_t State_Checksum(const void* data, uint32_t size);
+// Returns 0 if the file is missing, truncated, of another version or corrupt
+int State_Load(const char* path, StateData* data, uint32_t* sequence);
+// Writes a temporary file next to `path` and atomically replaces `path` with it
+int State_Save(const char* path, const StateData* data, uint32_t sequence);
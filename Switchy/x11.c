@@ -0,0 +1,257 @@
+#include "x11.h"
+#include <poll.h>
+#include <string.h>
+#include <X11/XKBlib.h>
+#include <X11/keysym.h>
+
+#define ALL_TRIGGERS ((1u << TRIGGERS) - 1)
+
+static const unsigned triggerModifiers[TRIGGERS] = {
+	0,                     // TRIGGER_SWITCH
+	ShiftMask,             // TRIGGER_CAPS_LOCK
+	Mod1Mask,              // TRIGGER_ENABLE
+	ShiftMask | Mod1Mask,  // TRIGGER_CONVERT
+};
+
+// Grabs must also match with CapsLock and NumLock on
+static const unsigned ignoredModifiers[] = { 0, LockMask, Mod2Mask, LockMask | Mod2Mask };
+
+static X11Keyboard engineKeyboard;
+static const char* engineError = NULL;
+// Set by TrapGrabError while grabs are being made
+static int grabRefused = 0;
+
+
+int X11_Open(X11Keyboard* keyboard, const char* displayName)
+{
+	int major = XkbMajorVersion, minor = XkbMinorVersion, error, reason;
+	memset(keyboard, 0, sizeof(*keyboard));
+	keyboard->display = XkbOpenDisplay((char*)displayName, &keyboard->xkbEventBase, &error, &major, &minor, &reason);
+	if (keyboard->display == NULL)
+	{
+		return 0;
+	}
+
+	XkbStateRec state;
+	XkbDescPtr xkb = XkbGetKeyboard(keyboard->display, XkbControlsMask, XkbUseCoreKbd);
+	if (xkb == NULL || xkb->ctrls == NULL || XkbGetState(keyboard->display, XkbUseCoreKbd, &state) != Success)
+	{
+		if (xkb != NULL)
+		{
+			XkbFreeKeyboard(xkb, 0, True);
+		}
+		X11_Close(keyboard);
+		return 0;
+	}
+
+	keyboard->groupCount = xkb->ctrls->num_groups ? xkb->ctrls->num_groups : 1;
+	keyboard->group = state.locked_group;
+	keyboard->capsLock = XKeysymToKeycode(keyboard->display, XK_Caps_Lock);
+	XkbFreeKeyboard(xkb, 0, True);
+
+	// Only group changes are of interest
+	XkbSelectEventDetails(keyboard->display, XkbUseCoreKbd, XkbStateNotify, XkbGroupLockMask, XkbGroupLockMask);
+	XFlush(keyboard->display);
+	return 1;
+}
+
+
+void X11_Close(X11Keyboard* keyboard)
+{
+	if (keyboard->display != NULL)
+	{
+		XCloseDisplay(keyboard->display);
+	}
+	memset(keyboard, 0, sizeof(*keyboard));
+}
+
+
+int X11_LockGroup(X11Keyboard* keyboard, unsigned group)
+{
+	if (group >= keyboard->groupCount || !XkbLockGroup(keyboard->display, XkbUseCoreKbd, group))
+	{
+		return 0;
+	}
+	XFlush(keyboard->display);
+	return 1;
+}
+
+
+int X11_SwitchLayout(X11Keyboard* keyboard)
+{
+	return X11_LockGroup(keyboard, (keyboard->group + 1) % keyboard->groupCount);
+}
+
+
+// Another client holding a grab answers with BadAccess, which the default
+// handler would turn into an exit
+static int TrapGrabError(Display* display, XErrorEvent* error)
+{
+	(void)display;
+	grabRefused |= error->error_code == BadAccess;
+	return 0;
+}
+
+
+// Returns 0 if another client has grabbed one of the combinations; the
+// triggers are then left as they were
+static int GrabTriggers(X11Keyboard* keyboard, unsigned triggers)
+{
+	Window root = DefaultRootWindow(keyboard->display);
+	if (keyboard->capsLock == 0)
+	{
+		return 0;
+	}
+
+	// Errors of earlier requests still go to the handler they were made under
+	XSync(keyboard->display, False);
+	grabRefused = 0;
+	int (*previous)(Display*, XErrorEvent*) = XSetErrorHandler(TrapGrabError);
+
+	for (int trigger = 0; trigger < TRIGGERS; trigger++)
+	{
+		unsigned bit = 1u << trigger;
+		for (size_t i = 0; i < sizeof(ignoredModifiers) / sizeof(ignoredModifiers[0]); i++)
+		{
+			unsigned modifiers = triggerModifiers[trigger] | ignoredModifiers[i];
+			if ((keyboard->grabbed & bit) && !(triggers & bit))
+			{
+				XUngrabKey(keyboard->display, keyboard->capsLock, modifiers, root);
+			}
+			else if (!(keyboard->grabbed & bit) && (triggers & bit))
+			{
+				XGrabKey(keyboard->display, keyboard->capsLock, modifiers, root, True, GrabModeAsync, GrabModeAsync);
+			}
+		}
+	}
+	XSync(keyboard->display, False);
+	XSetErrorHandler(previous);
+
+	if (grabRefused)
+	{
+		// Releasing a grab this client does not hold is no error
+		unsigned added = triggers & ~keyboard->grabbed;
+		for (int trigger = 0; trigger < TRIGGERS; trigger++)
+		{
+			for (size_t i = 0; (added & (1u << trigger)) && i < sizeof(ignoredModifiers) / sizeof(ignoredModifiers[0]); i++)
+			{
+				XUngrabKey(keyboard->display, keyboard->capsLock, triggerModifiers[trigger] | ignoredModifiers[i], root);
+			}
+		}
+		keyboard->grabbed &= triggers;
+		XFlush(keyboard->display);
+		return 0;
+	}
+	keyboard->grabbed = triggers;
+	return 1;
+}
+
+
+static void HandleKey(X11Keyboard* keyboard, const XKeyEvent* key)
+{
+	unsigned modifiers = key->state & (ShiftMask | Mod1Mask);
+	for (int trigger = 0; trigger < TRIGGERS; trigger++)
+	{
+		if (triggerModifiers[trigger] != modifiers || !(keyboard->grabbed & (1u << trigger)))
+		{
+			continue;
+		}
+
+		// XKB has already toggled CapsLock, which only Shift+CapsLock should do
+		if (trigger != TRIGGER_CAPS_LOCK)
+		{
+			XkbLockModifiers(keyboard->display, XkbUseCoreKbd, LockMask, key->state & LockMask);
+		}
+		if (keyboard->handler != NULL)
+		{
+			keyboard->handler((EngineTrigger)trigger);
+		}
+		return;
+	}
+}
+
+
+int X11_Dispatch(X11Keyboard* keyboard, int timeoutMs)
+{
+	struct pollfd fd = { ConnectionNumber(keyboard->display), POLLIN, 0 };
+	if (XPending(keyboard->display) == 0 && poll(&fd, 1, timeoutMs) <= 0)
+	{
+		return 0;
+	}
+	if (fd.revents & (POLLHUP | POLLERR))
+	{
+		return -1;
+	}
+
+	int handled = 0;
+	while (XPending(keyboard->display) > 0)
+	{
+		XEvent event;
+		XNextEvent(keyboard->display, &event);
+		if (event.type == keyboard->xkbEventBase + XkbEventCode)
+		{
+			const XkbEvent* xkbEvent = (const XkbEvent*)&event;
+			if (xkbEvent->any.xkb_type == XkbStateNotify)
+			{
+				keyboard->group = (unsigned)xkbEvent->state.locked_group;
+			}
+		}
+		else if (event.type == KeyPress && event.xkey.keycode == keyboard->capsLock)
+		{
+			HandleKey(keyboard, &event.xkey);
+		}
+		handled++;
+	}
+	XFlush(keyboard->display);
+	return handled;
+}
+
+
+static int X11EngineStart(EngineHandler handler)
+{
+	if (!X11_Open(&engineKeyboard, NULL))
+	{
+		engineError = "Cannot open the display or it has no XKB";
+		return 0;
+	}
+	engineKeyboard.handler = handler;
+	if (!GrabTriggers(&engineKeyboard, ALL_TRIGGERS))
+	{
+		engineError = engineKeyboard.capsLock ? "CapsLock already grabbed" : "No CapsLock key in the keymap";
+		X11_Close(&engineKeyboard);
+		return 0;
+	}
+	engineError = NULL;
+	return 1;
+}
+
+
+static void X11EngineStop()
+{
+	if (engineKeyboard.display != NULL)
+	{
+		GrabTriggers(&engineKeyboard, 0);
+		X11_Close(&engineKeyboard);
+	}
+}
+
+
+static void X11EngineSetEnabled(int enabled)
+{
+	GrabTriggers(&engineKeyboard, enabled ? ALL_TRIGGERS : 1u << TRIGGER_ENABLE);
+}
+
+
+const Engine x11Engine = { "x11", X11EngineStart, X11EngineStop, X11EngineSetEnabled };
+
+
+X11Keyboard* X11_Engine()
+{
+	return &engineKeyboard;
+}
+
+
+const char* X11_EngineError()
+{
+	return engineError;
+}
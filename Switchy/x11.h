@@ -0,0 +1,39 @@
+#pragma once
+#include <X11/Xlib.h>
+#include "engine.h"
+
+// Layout switching for X11 desktops through XKB: the layout is the locked
+// keyboard group, set directly with XkbLockGroup instead of simulated
+// Alt+Shift presses, and followed through XkbStateNotify events.
+//
+// Not part of the Windows build. Build with -lX11, and with
+// -DSWITCHY_XTEST -lXtst for the virtual keyboard used by SwitchyTools.
+
+typedef struct {
+	Display* display;
+	int xkbEventBase;
+	// Current group as last reported by the server
+	unsigned group;
+	unsigned groupCount;
+	KeyCode capsLock;
+	EngineHandler handler;
+	// Mask of (1 << EngineTrigger) currently grabbed
+	unsigned grabbed;
+} X11Keyboard;
+
+// Grabs the CapsLock combinations and reports them to the handler from
+// X11_Dispatch. The connection is kept in a keyboard returned by X11_Engine.
+extern const Engine x11Engine;
+X11Keyboard* X11_Engine();
+// Why x11Engine.Start failed, e.g. another client has grabbed CapsLock
+const char* X11_EngineError();
+
+// `displayName` NULL means $DISPLAY. Returns 0 without an X server with XKB.
+int X11_Open(X11Keyboard* keyboard, const char* displayName);
+void X11_Close(X11Keyboard* keyboard);
+// Requests the group; `group` changes when the server confirms it
+int X11_LockGroup(X11Keyboard* keyboard, unsigned group);
+int X11_SwitchLayout(X11Keyboard* keyboard);
+// Handles the pending events, waiting up to `timeoutMs` for the first one.
+// Returns the number of events handled or -1 if the connection is lost.
+int X11_Dispatch(X11Keyboard* keyboard, int timeoutMs);
@@ -0,0 +1,39 @@
+// Sample plugin that takes SWITCHY_SLOW_MS (100 by default) milliseconds per
+// action, to see the budget at work.
+//   cc -shared -fPIC -o slow.so SwitchyPlugins/slow.c
+#include <stdlib.h>
+#ifdef _WIN32
+#include <Windows.h>
+#else
+#include <time.h>
+#endif
+#include "../Switchy/plugin.h"
+
+static unsigned delay = 100;
+
+
+static void OnAction(void* context, const SwitchyAction* action)
+{
+	(void)context;
+	(void)action;
+#ifdef _WIN32
+	Sleep(delay);
+#else
+	struct timespec ts = { delay / 1000, (long)(delay % 1000) * 1000000 };
+	nanosleep(&ts, NULL);
+#endif
+}
+
+
+static const SwitchyPlugin plugin = { sizeof(SwitchyPlugin), "slow", NULL, OnAction, NULL };
+
+
+SWITCHY_PLUGIN_EXPORT const SwitchyPlugin* SwitchyPluginInit(uint32_t abi)
+{
+	const char* value = getenv("SWITCHY_SLOW_MS");
+	if (value != NULL)
+	{
+		delay = (unsigned)atoi(value);
+	}
+	return abi == SWITCHY_PLUGIN_ABI ? &plugin : NULL;
+}
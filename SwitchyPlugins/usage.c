@@ -0,0 +1,38 @@
+// Sample plugin: counts the actions and prints them when Switchy exits.
+//   cc -shared -fPIC -o usage.so SwitchyPlugins/usage.c
+#include <stdio.h>
+#include "../Switchy/plugin.h"
+
+#define ACTION_TYPES 6
+
+static const char* actionNames[ACTION_TYPES] = { "", "switch", "caps lock", "enable", "convert", "layout" };
+static unsigned counts[ACTION_TYPES];
+
+
+static void OnAction(void* context, const SwitchyAction* action)
+{
+	(void)context;
+	if (action->type < ACTION_TYPES)
+	{
+		counts[action->type]++;
+	}
+}
+
+
+static void Unload(void* context)
+{
+	(void)context;
+	for (int type = 1; type < ACTION_TYPES; type++)
+	{
+		fprintf(stderr, "usage: %s %u\n", actionNames[type], counts[type]);
+	}
+}
+
+
+static const SwitchyPlugin plugin = { sizeof(SwitchyPlugin), "usage", NULL, OnAction, Unload };
+
+
+SWITCHY_PLUGIN_EXPORT const SwitchyPlugin* SwitchyPluginInit(uint32_t abi)
+{
+	return abi == SWITCHY_PLUGIN_ABI ? &plugin : NULL;
+}
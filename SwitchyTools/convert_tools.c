@@ -0,0 +1,243 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <wchar.h>
+#include "../Switchy/convert.h"
+#include "../Switchy/core.h"
+#include "../Switchy/oneshot.h"
+#include "tools.h"
+#include "../Switchy/checked.h"
+
+
+// Checks the vectorized conversion against the scalar one and measures both
+// on random English/Russian text, using built-in tables of the letter keys.
+int ConversionBenchmark(int argc, char** argv)
+{
+	size_t keys = wcslen(sampleEnglish) / 2;
+	size_t count = (argc > 0 ? (size_t)atoi(argv[0]) : 16) * 1024 * 1024 / sizeof(uint16_t);
+
+	KeyLayout en, ru;
+	SampleLayouts(&en, &ru);
+
+	static ConvertTable table;
+	uint16_t* text = malloc(count * sizeof(uint16_t));
+	uint16_t* scalar = malloc(count * sizeof(uint16_t));
+	uint16_t* vector = malloc(count * sizeof(uint16_t));
+	if (!Convert_Build(&table, &ru, &en) || text == NULL || scalar == NULL || vector == NULL)
+	{
+		printf("Cannot build the conversion table\n");
+		return 1;
+	}
+
+	srand(1);
+	for (size_t i = 0; i < count; i++)
+	{
+		// Mostly Cyrillic words separated by spaces, with occasional digits and symbols
+		int kind = rand() % 256;
+		text[i] = kind < 208 ? (uint16_t)sampleRussian[rand() % (2 * keys)] : kind < 248 ? ' ' : kind < 255 ? (uint16_t)('0' + rand() % 10) : 0x2116;
+	}
+
+	// Untimed pass so both runs start with the output pages mapped in, then
+	// the best of several runs of each, alternating, so a busy moment of the
+	// machine does not decide the ratio
+	Convert_TextScalar(&table, text, scalar, count);
+	Convert_Text(&table, text, vector, count);
+	double scalarTime = 0;
+	double vectorTime = 0;
+	for (int run = 0; run < 5; run++)
+	{
+		double start = Now();
+		Convert_TextScalar(&table, text, scalar, count);
+		double time = Now() - start;
+		scalarTime = run == 0 || time < scalarTime ? time : scalarTime;
+		start = Now();
+		Convert_Text(&table, text, vector, count);
+		time = Now() - start;
+		vectorTime = run == 0 || time < vectorTime ? time : vectorTime;
+	}
+
+	size_t mismatch = 0;
+	while (mismatch < count && scalar[mismatch] == vector[mismatch])
+	{
+		mismatch++;
+	}
+
+	double megabytes = (double)count * sizeof(uint16_t) / (1024 * 1024);
+	printf("%.0f MB, best of 5: scalar %.0f MB/s, vectorized %.0f MB/s (%.2fx), %s\n", megabytes,
+		megabytes / scalarTime, megabytes / vectorTime, scalarTime / vectorTime, mismatch == count ? "results match" : "RESULTS DIFFER");
+
+	free(text);
+	free(scalar);
+	free(vector);
+	return mismatch == count ? 0 : 1;
+}
+
+
+typedef struct {
+	const char* name;
+	uint8_t vkCode;
+	uint8_t down;
+	// 1 - CapsLock held, 2 - CapsLock released, 0 - unchanged
+	uint8_t caps;
+	uint32_t flags;
+	int action;
+	wchar_t ch;
+} OneShotStep;
+
+// English keys held with CapsLock in the Russian layout type Russian
+// letters; 0x08 (Backspace) types nothing in either layout
+static const OneShotStep oneShotSteps[] = {
+	{ "letter without CapsLock", 'Q', 1, 0, 0, ONESHOT_PASS, 0 },
+	{ "its release", 'Q', 0, 0, 0, ONESHOT_PASS, 0 },
+	{ "key held before CapsLock", 'W', 1, 0, 0, ONESHOT_PASS, 0 },
+	{ "letter with CapsLock", 'Q', 1, 1, 0, ONESHOT_TYPE, L'й' },
+	{ "its auto-repeat", 'Q', 1, 0, 0, ONESHOT_TYPE, L'й' },
+	{ "its release", 'Q', 0, 0, 0, ONESHOT_DROP, 0 },
+	{ "auto-repeat of the key held before", 'W', 1, 0, 0, ONESHOT_PASS, 0 },
+	{ "release of the key held before", 'W', 0, 0, 0, ONESHOT_PASS, 0 },
+	{ "letter with Shift", 0xBC, 1, 0, ONESHOT_SHIFT, ONESHOT_TYPE, L'Б' },
+	{ "its release", 0xBC, 0, 0, 0, ONESHOT_DROP, 0 },
+	{ "letter with Ctrl", 'C', 1, 0, ONESHOT_MODIFIERS, ONESHOT_PASS, 0 },
+	{ "its release", 'C', 0, 0, 0, ONESHOT_PASS, 0 },
+	{ "key typing nothing", 0x08, 1, 0, 0, ONESHOT_PASS, 0 },
+	{ "its release", 0x08, 0, 0, 0, ONESHOT_PASS, 0 },
+	{ "letter held over CapsLock release", 'E', 1, 0, 0, ONESHOT_TYPE, L'у' },
+	{ "its auto-repeat without CapsLock", 'E', 1, 2, 0, ONESHOT_DROP, 0 },
+	{ "its release", 'E', 0, 0, 0, ONESHOT_DROP, 0 },
+	{ "letter after CapsLock release", 'E', 1, 0, 0, ONESHOT_PASS, 0 },
+	{ "its release", 'E', 0, 0, 0, ONESHOT_PASS, 0 },
+};
+
+typedef struct {
+	const char* name;
+	uint8_t vkCode;
+	uint8_t down;
+	int result;
+	uint32_t effects;
+	wchar_t ch;
+} OneShotCoreStep;
+
+// The same through the hook's per-key path, with the modifiers it tracks:
+// the left Shift held with CapsLock types capitals instead of toggling
+// CapsLock, and does toggle it when held before CapsLock
+static const OneShotCoreStep oneShotCoreSteps[] = {
+	{ "CapsLock", 0x14, 1, CORE_BLOCK, CORE_ONESHOT_BEGIN, 0 },
+	{ "left Shift with CapsLock", 0xA0, 1, CORE_NEXT, 0, 0 },
+	{ "letter with both", 0xBC, 1, CORE_BLOCK, CORE_TYPE, L'Б' },
+	{ "its release", 0xBC, 0, CORE_BLOCK, 0, 0 },
+	{ "left Shift release", 0xA0, 0, CORE_ALLOW, 0, 0 },
+	{ "letter after the Shift release", 'Q', 1, CORE_BLOCK, CORE_TYPE, L'й' },
+	{ "its release", 'Q', 0, CORE_BLOCK, 0, 0 },
+	{ "Ctrl with CapsLock", 0xA2, 1, CORE_NEXT, 0, 0 },
+	{ "letter with Ctrl", 'C', 1, CORE_NEXT, 0, 0 },
+	{ "its release", 'C', 0, CORE_NEXT, 0, 0 },
+	{ "Ctrl release", 0xA2, 0, CORE_NEXT, 0, 0 },
+	{ "CapsLock release after typing", 0x14, 0, CORE_BLOCK, CORE_ONESHOT_END, 0 },
+	{ "left Shift without CapsLock", 0xA0, 1, CORE_ALLOW, 0, 0 },
+	{ "CapsLock with Shift held", 0x14, 1, CORE_BLOCK, CORE_TOGGLE_CAPS, 0 },
+	{ "letter", 'Q', 1, CORE_NEXT, 0, 0 },
+	{ "its release", 'Q', 0, CORE_NEXT, 0, 0 },
+	{ "its release", 0x14, 0, CORE_BLOCK, CORE_ONESHOT_END, 0 },
+	{ "left Shift release", 0xA0, 0, CORE_ALLOW, 0, 0 },
+};
+
+
+// Walks the one-shot state through the cases above, then measures the time
+// it adds to every key event on a random stream typed with CapsLock held
+int OneShotCheck(int argc, char** argv)
+{
+	int events = argc > 0 ? atoi(argv[0]) : 10000000;
+	if (events <= 0)
+	{
+		PrintUsage();
+		return 1;
+	}
+
+	static KeyLayout en, ru;
+	static OneShot oneShot;
+	LoadKeyLayout("00000409", &en);
+	LoadKeyLayout("00000419", &ru);
+	OneShot_Init(&oneShot);
+
+	int failed = 0;
+	for (size_t i = 0; i < sizeof(oneShotSteps) / sizeof(oneShotSteps[0]); i++)
+	{
+		const OneShotStep* step = &oneShotSteps[i];
+		if (step->caps == 1)
+		{
+			OneShot_Begin(&oneShot, &ru);
+		}
+		else if (step->caps == 2)
+		{
+			OneShot_End(&oneShot);
+		}
+
+		uint16_t ch = 0;
+		int action = OneShot_OnKey(&oneShot, step->vkCode, step->down, step->flags, &ch);
+		if (action != step->action || (action == ONESHOT_TYPE && ch != (uint16_t)step->ch))
+		{
+			printf("Failed: %s (key %d %s): action %d, U+%04X\n", step->name, step->vkCode, step->down ? "down" : "up", action, ch);
+			failed++;
+		}
+	}
+	printf("%d of %d steps passed, %u characters typed\n", (int)(sizeof(oneShotSteps) / sizeof(oneShotSteps[0])) - failed,
+		(int)(sizeof(oneShotSteps) / sizeof(oneShotSteps[0])), oneShot.typed);
+
+	static Core core;
+	Core_Init(&core);
+	// Every key starts released
+	memset(core.unseen, 0, sizeof(core.unseen));
+	int coreFailed = 0;
+	for (size_t i = 0; i < sizeof(oneShotCoreSteps) / sizeof(oneShotCoreSteps[0]); i++)
+	{
+		const OneShotCoreStep* step = &oneShotCoreSteps[i];
+		CoreInput input = { step->vkCode, step->down ? CORE_KEY_DOWN : CORE_KEY_UP, 1, (uint32_t)i * 150 };
+		CoreOutput output;
+		int result = Core_OnHook(&core, &input, &output);
+		if (output.effects & CORE_ONESHOT_END)
+		{
+			OneShot_End(&core.oneShot);
+		}
+		if (output.effects & CORE_ONESHOT_BEGIN)
+		{
+			OneShot_Begin(&core.oneShot, &ru);
+		}
+		if (result != step->result || output.effects != step->effects || ((output.effects & CORE_TYPE) && output.ch != (uint16_t)step->ch))
+		{
+			printf("Failed: %s (key %d %s): result %d, effects 0x%X, U+%04X\n", step->name, step->vkCode, step->down ? "down" : "up",
+				result, output.effects, output.ch);
+			coreFailed++;
+		}
+	}
+	printf("%d of %d steps through the hook's path passed\n", (int)(sizeof(oneShotCoreSteps) / sizeof(oneShotCoreSteps[0])) - coreFailed,
+		(int)(sizeof(oneShotCoreSteps) / sizeof(oneShotCoreSteps[0])));
+	failed += coreFailed;
+
+	uint8_t* keys = malloc((size_t)events);
+	if (keys == NULL)
+	{
+		printf("Out of memory\n");
+		return 1;
+	}
+	srand(1);
+	for (int i = 0; i < events; i++)
+	{
+		keys[i] = sampleKeys[rand() % sizeof(sampleKeys)];
+	}
+
+	OneShot_Init(&oneShot);
+	OneShot_Begin(&oneShot, &ru);
+	unsigned long long sum = 0;
+	double start = Now();
+	for (int i = 0; i < events; i++)
+	{
+		uint16_t ch = 0;
+		int down = i % 2 == 0;
+		sum += (unsigned)OneShot_OnKey(&oneShot, keys[i & ~1], down, 0, &ch) + ch;
+	}
+	double time = Now() - start;
+	printf("%d events, %u typed: %.1f ns per event (checksum %llu)\n", events, oneShot.typed, time / events * 1e9, sum);
+
+	free(keys);
+	return failed == 0 ? 0 : 1;
+}
@@ -0,0 +1,300 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "../Switchy/chatter.h"
+#include "../Switchy/core.h"
+#include "../Switchy/devices.h"
+#include "tools.h"
+#include "../Switchy/checked.h"
+
+
+// Replays key streams of several keyboards through the hook's per-key path
+// the way Windows delivers them: every key the hook lets through is
+// followed, after up to `maxLag` more hook events, by its Raw Input event.
+// Returns the share of CapsLock and left Shift presses decided on the right
+// keyboard; `others` gets that of the other keys the hook passed, which can
+// only be given to the keyboard used last.
+static double ReplayDevices(const uint8_t* devicesOf, const uint8_t* keys, const uint8_t* downs, int count, int maxLag,
+	double* others, int* leaks, double* elapsed)
+{
+	static Core core;
+	int* rawAt = malloc((size_t)count * sizeof(int));
+	uint8_t* passed = calloc((size_t)count, 1);
+	int pressIndex[256] = { 0 };
+	int correct = 0, decided = 0, otherCorrect = 0, otherPassed = 0;
+	Core_Init(&core);
+	core.raw = 1;
+	memset(core.unseen, 0, sizeof(core.unseen));
+	for (int device = 0; device < 3; device++)
+	{
+		int added;
+		Devices_Slot(&core.devices, (uintptr_t)(device + 1) * 0x100, &added);
+	}
+
+	// Raw events keep their order
+	for (int i = 0; i < count; i++)
+	{
+		int at = i + rand() % (maxLag + 1);
+		rawAt[i] = i > 0 && at < rawAt[i - 1] ? rawAt[i - 1] : at;
+	}
+
+	int next = 0;
+	CoreOutput output;
+	double start = Now();
+	for (int t = 0; t < count || next < count; t++)
+	{
+		if (t < count)
+		{
+			uint8_t vkCode = keys[t];
+			int deferred = vkCode == CORE_VK_CAPITAL || vkCode == CORE_VK_LSHIFT;
+			CoreInput input = { vkCode, downs[t] ? CORE_KEY_DOWN : CORE_KEY_UP, 1, (uint32_t)t * 100 };
+			Core_Flush(&core, &output);
+			// The release tells which keyboard its press was decided on
+			if (!downs[t] && deferred)
+			{
+				uint8_t slot = core.devices.pressSlot[vkCode];
+				correct += core.devices.slots[slot].handle == (uintptr_t)(devicesOf[pressIndex[vkCode]] + 1) * 0x100;
+				decided++;
+			}
+			pressIndex[vkCode] = downs[t] ? t : pressIndex[vkCode];
+			uint8_t slot = core.devices.lastSlot;
+			passed[t] = Core_OnHook(&core, &input, &output) != CORE_BLOCK;
+			if (passed[t] && !deferred)
+			{
+				otherCorrect += core.devices.slots[downs[t] ? slot : core.devices.pressSlot[vkCode]].handle ==
+					(uintptr_t)(devicesOf[downs[t] ? t : pressIndex[vkCode]] + 1) * 0x100;
+				otherPassed++;
+			}
+		}
+		for (; next < count && rawAt[next] <= t; next++)
+		{
+			if (passed[next])
+			{
+				int added;
+				uint8_t slot = Devices_Slot(&core.devices, (uintptr_t)(devicesOf[next] + 1) * 0x100, &added);
+				Core_OnRaw(&core, slot, keys[next], downs[next], &output);
+			}
+		}
+	}
+	*elapsed = Now() - start;
+
+	*leaks = core.isWaiting;
+	for (int vk = 0; vk < 256; vk++)
+	{
+		*leaks += core.devices.pending[vk][0] + core.devices.pending[vk][1];
+	}
+	free(rawAt);
+	free(passed);
+	*others = otherPassed > 0 ? (double)otherCorrect / otherPassed : 1.0;
+	return decided > 0 ? (double)correct / decided : 1.0;
+}
+
+
+// Interleaved streams of three keyboards, typed in bursts or key by key.
+// With the raw event of each key before the next hook event, as it comes
+// when the main thread keeps up, CapsLock and Shift must never be decided
+// on the wrong keyboard.
+int DeviceCheck(int argc, char** argv)
+{
+	enum { KEYBOARDS = 3 };
+	static const uint8_t keySet[] = { 0x14, 0xA0, 0xA1, 'A', 'E', 'O', 'T', ' ', 0x0D };
+	int count = argc > 0 ? atoi(argv[0]) : 1 << 20;
+	uint8_t* devicesOf = malloc((size_t)count);
+	uint8_t* keys = malloc((size_t)count);
+	uint8_t* downs = malloc((size_t)count);
+	if (devicesOf == NULL || keys == NULL || downs == NULL)
+	{
+		printf("Out of memory\n");
+		return 1;
+	}
+
+	int ok = 1;
+	for (int bursts = 1; bursts >= 0; bursts--)
+	{
+		srand(1);
+		int device = 0;
+		for (int i = 0; i + 1 < count; i += 2)
+		{
+			if (!bursts || rand() % 64 == 0)
+			{
+				device = rand() % KEYBOARDS;
+			}
+			devicesOf[i] = devicesOf[i + 1] = (uint8_t)device;
+			keys[i] = keys[i + 1] = keySet[rand() % sizeof(keySet)];
+			downs[i] = 1;
+			downs[i + 1] = 0;
+		}
+
+		for (int lag = 0; lag <= 2; lag++)
+		{
+			int leaks;
+			double others, elapsed;
+			double share = ReplayDevices(devicesOf, keys, downs, count & ~1, lag, &others, &leaks, &elapsed);
+			printf("%s, raw input after up to %d more hook events: CapsLock and Shift %.2f%% on the right keyboard, "
+				"other keys %.2f%%, %d left pending",
+				bursts ? "Bursts" : "Key by key", lag, share * 100, others * 100, leaks);
+			if (lag == 0)
+			{
+				printf(", %.1f ns per event", elapsed * 1e9 / count);
+			}
+			printf("\n");
+			ok &= leaks == 0 && (lag > 0 || share == 1.0);
+		}
+	}
+
+	free(devicesOf);
+	free(keys);
+	free(downs);
+	return ok ? 0 : 1;
+}
+
+
+typedef struct {
+	uint32_t time;
+	uint8_t vkCode;
+	uint8_t down;
+	uint8_t bounce;
+} TraceEvent;
+
+typedef struct {
+	uint32_t presses;
+	uint32_t bounces;
+	uint32_t lost;
+	uint32_t missed;
+} ChatterStats;
+
+
+static uint32_t RandomBetween(uint32_t low, uint32_t high)
+{
+	return low + (uint32_t)rand() % (high - low + 1);
+}
+
+
+static void AddEvent(TraceEvent* trace, int* count, uint32_t time, uint8_t vkCode, int down, int bounce)
+{
+	TraceEvent event = { time, vkCode, (uint8_t)down, (uint8_t)bounce };
+	trace[(*count)++] = event;
+}
+
+
+// Synthetic typing with two worn keys: CapsLock bounces 1-5 ms after 40% of
+// its presses or releases, E bounces 10-20 ms after 30% of them. Double
+// letters come as fast as 35 ms apart and must all pass.
+static int GenerateChatter(TraceEvent* trace, int presses)
+{
+	int count = 0;
+	uint32_t time = 1000;
+	uint8_t previous = 'A';
+	for (int i = 0; i < presses; i++)
+	{
+		int kind = rand() % 100;
+		int repeat = rand() % 100 < 15;
+		uint8_t vkCode = repeat ? previous : kind < 10 ? 0x14 : kind < 20 ? 'E' : (uint8_t)('A' + rand() % 26);
+		time += vkCode == previous ? RandomBetween(35, 150) : RandomBetween(20, 300);
+
+		uint32_t hold = RandomBetween(30, 150);
+		int worn = (vkCode == 0x14 && rand() % 100 < 40) || (vkCode == 'E' && rand() % 100 < 30);
+		uint32_t gap = vkCode == 0x14 ? RandomBetween(1, 5) : RandomBetween(10, 20);
+		uint32_t contact = RandomBetween(1, 3);
+
+		AddEvent(trace, &count, time, vkCode, 1, 0);
+		if (worn && rand() % 2)
+		{
+			AddEvent(trace, &count, time + contact, vkCode, 0, 1);
+			AddEvent(trace, &count, time + contact + gap, vkCode, 1, 1);
+			AddEvent(trace, &count, time + hold, vkCode, 0, 0);
+			time += hold;
+		}
+		else if (worn)
+		{
+			AddEvent(trace, &count, time + hold, vkCode, 0, 0);
+			AddEvent(trace, &count, time + hold + gap, vkCode, 1, 1);
+			AddEvent(trace, &count, time + hold + gap + contact, vkCode, 0, 1);
+			time += hold + gap + contact;
+		}
+		else
+		{
+			AddEvent(trace, &count, time + hold, vkCode, 0, 0);
+			time += hold;
+		}
+		previous = vkCode;
+	}
+	return count;
+}
+
+
+static void PrintChatterStats(const char* title, const ChatterStats* stats)
+{
+	printf("%s: %u presses, %u bounces, %u real presses lost, %u bounces passed (%.2f%%)\n", title,
+		stats->presses, stats->bounces, stats->lost, stats->missed, stats->bounces ? 100.0 * stats->missed / stats->bounces : 0.0);
+}
+
+
+// Replays synthetic traces through the chatter filter: the first half while
+// it learns the thresholds, the second half with them learned
+int ChatterCheck(int argc, char** argv)
+{
+	int presses = argc > 0 ? atoi(argv[0]) : 20000;
+	if (presses < 2)
+	{
+		PrintUsage();
+		return 1;
+	}
+
+	TraceEvent* trace = malloc((size_t)presses * 4 * sizeof(TraceEvent));
+	uint8_t* dropped = malloc((size_t)presses * 4);
+	static ChatterFilter filter;
+	if (trace == NULL || dropped == NULL)
+	{
+		printf("Out of memory\n");
+		free(trace);
+		free(dropped);
+		return 1;
+	}
+
+	srand(1);
+	int count = GenerateChatter(trace, presses);
+	Chatter_Init(&filter);
+	double start = Now();
+	for (int i = 0; i < count; i++)
+	{
+		dropped[i] = (uint8_t)Chatter_OnKey(&filter, trace[i].vkCode, trace[i].down, trace[i].time);
+	}
+	double time = Now() - start;
+
+	ChatterStats phases[2] = { { 0 } };
+	int balance[256] = { 0 };
+	int downs = 0;
+	for (int i = 0; i < count; i++)
+	{
+		if (trace[i].down)
+		{
+			ChatterStats* stats = &phases[downs++ < count / 4 ? 0 : 1];
+			stats->presses += !trace[i].bounce;
+			stats->bounces += trace[i].bounce;
+			stats->lost += !trace[i].bounce && dropped[i];
+			stats->missed += trace[i].bounce && !dropped[i];
+		}
+		if (!dropped[i])
+		{
+			balance[trace[i].vkCode] += trace[i].down ? 1 : -1;
+		}
+	}
+
+	int unbalanced = 0;
+	for (int vkCode = 0; vkCode < 256; vkCode++)
+	{
+		unbalanced += balance[vkCode] != 0;
+	}
+
+	PrintChatterStats("Learning", &phases[0]);
+	PrintChatterStats("Learned", &phases[1]);
+	printf("Thresholds: CapsLock %u ms, E %u ms, A %u ms; %d keys left down; %.1f ns per event\n",
+		Chatter_Threshold(&filter, 0x14), Chatter_Threshold(&filter, 'E'), Chatter_Threshold(&filter, 'A'),
+		unbalanced, time / count * 1e9);
+
+	int ok = phases[0].lost == 0 && phases[1].lost == 0 && unbalanced == 0 && phases[1].missed * 100 <= phases[1].bounces;
+	free(trace);
+	free(dropped);
+	return ok ? 0 : 1;
+}
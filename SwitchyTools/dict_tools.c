@@ -0,0 +1,247 @@
+#ifdef _WIN32
+#include <Windows.h>
+#endif
+#include <stdio.h>
+#include <string.h>
+#include "../Switchy/dict.h"
+#include "tools.h"
+#include "../Switchy/checked.h"
+
+#define MAX_LINE 1024
+
+
+static int ReadWord(FILE* file, char* line, size_t size)
+{
+	while (fgets(line, (int)size, file))
+	{
+		if ((unsigned char)line[0] == 0xEF && (unsigned char)line[1] == 0xBB && (unsigned char)line[2] == 0xBF)
+		{
+			memmove(line, line + 3, strlen(line + 3) + 1);
+		}
+		line[strcspn(line, "\r\n")] = 0;
+		if (line[0])
+		{
+			return 1;
+		}
+	}
+	return 0;
+}
+
+
+// Translates a word into the virtual keys that type it in the given layout.
+static int WordToKeys(const char* layout, const char* word, uint8_t* keys, size_t* length)
+{
+#ifdef _WIN32
+	HKL hkl = LoadKeyboardLayoutA(layout, KLF_NOTELLSHELL);
+	WCHAR wide[DICT_MAX_WORD + 1];
+	int count = MultiByteToWideChar(CP_UTF8, MB_ERR_INVALID_CHARS, word, -1, wide, DICT_MAX_WORD + 1) - 1;
+	if (hkl == NULL || count <= 0)
+	{
+		return 0;
+	}
+
+	for (int i = 0; i < count; i++)
+	{
+		SHORT scan = VkKeyScanExW(wide[i], hkl);
+		if (scan == -1)
+		{
+			return 0;
+		}
+		keys[i] = LOBYTE(scan);
+	}
+	*length = (size_t)count;
+	return 1;
+#else
+	// Without system keyboard layouts the built-in English and Russian
+	// tables give the keys; digits are typed by the same keys in both.
+	static char loaded[sizeof("00000409")];
+	static uint8_t keyOfChar[0x10000];
+	if (strcmp(loaded, layout) != 0)
+	{
+		KeyLayout keyLayout;
+		if (strlen(layout) >= sizeof(loaded) || !LoadKeyLayout(layout, &keyLayout))
+		{
+			return 0;
+		}
+		memset(keyOfChar, 0, sizeof(keyOfChar));
+		for (int shift = LAYOUT_SHIFT; shift >= LAYOUT_PLAIN; shift--)
+		{
+			for (int vkCode = 0; vkCode < 256; vkCode++)
+			{
+				keyOfChar[keyLayout.chars[vkCode][shift]] = (uint8_t)vkCode;
+			}
+		}
+		keyOfChar[0] = 0;
+		for (int digit = '0'; digit <= '9'; digit++)
+		{
+			keyOfChar[digit] = (uint8_t)digit;
+		}
+		strcpy(loaded, layout);
+	}
+
+	size_t count = 0;
+	const uint8_t* text = (const uint8_t*)word;
+	while (*text)
+	{
+		uint32_t ch = *text;
+		if (ch < 0x80)
+		{
+			text++;
+		}
+		else if ((ch & 0xE0) == 0xC0 && text[1])
+		{
+			ch = ((ch & 0x1F) << 6) | (text[1] & 0x3F);
+			text += 2;
+		}
+		else if ((ch & 0xF0) == 0xE0 && text[1] && text[2])
+		{
+			ch = ((ch & 0x0F) << 12) | ((text[1] & 0x3F) << 6) | (text[2] & 0x3F);
+			text += 3;
+		}
+		else
+		{
+			return 0;
+		}
+
+		if (count == DICT_MAX_WORD || keyOfChar[ch] == 0)
+		{
+			return 0;
+		}
+		keys[count++] = keyOfChar[ch];
+	}
+	*length = count;
+	return count > 0;
+#endif
+}
+
+
+int CompileDictionary(int argc, char** argv)
+{
+	if (argc != 3 && argc != 5)
+	{
+		PrintUsage();
+		return 1;
+	}
+
+	DictBuilder* builder = DictBuilder_Create();
+	if (builder == NULL)
+	{
+		printf("Out of memory\n");
+		return 1;
+	}
+
+	char line[MAX_LINE];
+	uint8_t keys[DICT_MAX_WORD];
+	for (int i = 1; i < argc; i += 2)
+	{
+		FILE* file = fopen(argv[i + 1], "rb");
+		if (file == NULL)
+		{
+			printf("Cannot open \"%s\"\n", argv[i + 1]);
+			DictBuilder_Destroy(builder);
+			return 1;
+		}
+
+		unsigned long added = 0, skipped = 0;
+		uint32_t layout = i == 1 ? DICT_LAYOUT_A : DICT_LAYOUT_B;
+		while (ReadWord(file, line, sizeof(line)))
+		{
+			size_t length;
+			if (WordToKeys(argv[i], line, keys, &length) && DictBuilder_Add(builder, keys, length, layout))
+			{
+				added++;
+			}
+			else
+			{
+				skipped++;
+			}
+		}
+		fclose(file);
+		printf("%s: %lu words added, %lu skipped\n", argv[i + 1], added, skipped);
+		if (added == 0)
+		{
+			printf("No word of \"%s\" can be typed in layout %s\n", argv[i + 1], argv[i]);
+			DictBuilder_Destroy(builder);
+			return 1;
+		}
+	}
+
+	int ok = DictBuilder_Write(builder, argv[0]);
+	DictBuilder_Destroy(builder);
+	if (!ok)
+	{
+		printf("Cannot write \"%s\"\n", argv[0]);
+		return 1;
+	}
+
+	return DictionaryStats(1, argv);
+}
+
+
+int DictionaryStats(int argc, char** argv)
+{
+	if (argc < 1)
+	{
+		PrintUsage();
+		return 1;
+	}
+
+	Dict dict;
+	double start = Now();
+	if (!Dict_Open(&dict, argv[0]))
+	{
+		printf("Cannot open dictionary \"%s\"\n", argv[0]);
+		return 1;
+	}
+	double opened = Now() - start;
+
+	printf("%s: %zu bytes, %u nodes, %u edges, %u symbols, opened in %.1f us\n",
+		argv[0], dict.size, dict.header->nodeCount, dict.header->edgeCount, dict.header->symbolCount, opened * 1e6);
+
+	FILE* file = argc > 1 ? fopen(argv[1], "rb") : NULL;
+	if (file != NULL)
+	{
+		// Lookups run over Latin words so the timing is comparable between platforms.
+		char line[MAX_LINE];
+		uint8_t keys[DICT_MAX_WORD];
+		static uint8_t stream[1 << 20];
+		size_t streamLength = 0;
+		while (ReadWord(file, line, sizeof(line)))
+		{
+			size_t length;
+			if (WordToKeys("00000409", line, keys, &length) && streamLength + length + 1 <= sizeof(stream))
+			{
+				memcpy(stream + streamLength, keys, length);
+				streamLength += length;
+				stream[streamLength++] = 0;
+			}
+		}
+		fclose(file);
+
+		unsigned long found = 0;
+		unsigned long long steps = 0;
+		start = Now();
+		for (int round = 0; round < 16; round++)
+		{
+			DictCursor cursor;
+			uint32_t flags = 0;
+			Dict_Reset(&dict, &cursor);
+			for (size_t i = 0; i < streamLength; i++)
+			{
+				if (stream[i] == 0)
+				{
+					found += DICT_WORD(flags) != 0;
+					Dict_Reset(&dict, &cursor);
+					continue;
+				}
+				flags = Dict_Step(&dict, &cursor, stream[i]);
+				steps++;
+			}
+		}
+		double elapsed = Now() - start;
+		printf("%llu key steps, %lu words found, %.1f M steps/s\n", steps, found, elapsed > 0 ? steps / elapsed / 1e6 : 0.0);
+	}
+
+	Dict_Close(&dict);
+	return 0;
+}
@@ -0,0 +1,744 @@
+#ifdef _WIN32
+#include <Windows.h>
+#else
+#include <pthread.h>
+#endif
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "../Switchy/core.h"
+#include "../Switchy/devices.h"
+#include "../Switchy/macro.h"
+#include "../Switchy/oneshot.h"
+#include "tools.h"
+#include "../Switchy/checked.h"
+
+
+// The hook engine around Core_Key: keys as the system sees them, Raw
+// Input arriving after the hook, the keys Switchy injects coming back
+// through the hook, the Alt+CapsLock hotkey while disabled. Keyboard 2 is
+// disabled by the device config.
+#define FUZZ_KEYS 6
+#define FUZZ_SLOTS 3
+#define FUZZ_DISABLED_SLOT 2
+#define FUZZ_MAX_EVENTS 32
+#define FUZZ_MAX_RAW 64
+
+#define FUZZ_VK_BACK 0x08
+#define FUZZ_VK_SPACE 0x20
+#define FUZZ_VK_LWIN 0x5B
+#define FUZZ_VK_LCONTROL 0xA2
+#define FUZZ_VK_LMENU 0xA4
+#define FUZZ_VK_PACKET 0xE7
+
+// A press of a held key is its auto-repeat, a release of a key that is not
+// held one whose press was never seen
+#define FUZZ_PRESS 0
+#define FUZZ_RELEASE 1
+// Press, or release of a pressed key, injected by another program
+#define FUZZ_INJECTED 2
+// The foreground window changes and a rule turns Switchy off or back on
+#define FUZZ_RULE 3
+// The oldest Raw Input event still queued arrives
+#define FUZZ_RAW 4
+
+#define FUZZ_WIN_HELD 1
+#define FUZZ_KEY_STUCK 2
+#define FUZZ_STRAY_SWITCH 3
+#define FUZZ_STATE_LEFT 4
+#define FUZZ_UNBALANCED 5
+
+typedef struct {
+	uint8_t kind;
+	uint8_t key;
+	uint8_t slot;
+	// Comes 2 ms after the event before it instead of 150 ms, as a bounce
+	uint8_t fast;
+} FuzzEvent;
+
+typedef struct {
+	FuzzEvent events[FUZZ_MAX_EVENTS];
+	int count;
+	uint8_t popup;
+	// Raw Input is registered and keyboards are told apart
+	uint8_t raw;
+} FuzzSequence;
+
+typedef struct {
+	uint8_t slot;
+	uint8_t vkCode;
+	uint8_t down;
+} FuzzRaw;
+
+typedef struct {
+	Core core;
+	uint8_t popup;
+	uint8_t enabled;
+	uint8_t ruleOff;
+	uint8_t capsTaken;
+	uint32_t time;
+	// By virtual-key code: held by a finger, on which keyboard, held by the
+	// injection of another program, down as the system sees it
+	uint8_t held[256];
+	uint8_t pressSlot[256];
+	uint8_t foreign[256];
+	uint8_t systemDown[256];
+	// Down as Switchy injected it
+	uint8_t injected[256];
+	// Switchy released a key it did not press that the system saw down
+	uint8_t strayRelease;
+	// The event is a CapsLock release: only one whose press Switchy took
+	// may switch
+	uint8_t capsRelease;
+	uint8_t straySwitch;
+	FuzzRaw raw[FUZZ_MAX_RAW];
+	int rawHead;
+	int rawCount;
+} FuzzWorld;
+
+typedef struct {
+	uint32_t seed;
+	unsigned long long sequences;
+	unsigned long long done;
+	unsigned long long events;
+	int invariant;
+	FuzzSequence failure;
+	// Its thread could be created; if not, the caller runs it
+	int started;
+} FuzzSlice;
+
+static const uint8_t fuzzKeys[FUZZ_KEYS] = { CORE_VK_CAPITAL, CORE_VK_LSHIFT, CORE_VK_RSHIFT, FUZZ_VK_LMENU, FUZZ_VK_LCONTROL, 'A' };
+static const char* fuzzKeyNames[FUZZ_KEYS] = { "CapsLock", "LShift", "RShift", "Alt", "Ctrl", "A" };
+static const char* fuzzInvariants[] = {
+	"", "Win key held after CapsLock was released", "key left down for the system",
+	"layout switched without a CapsLock press Switchy took", "key state left with every key released",
+	"key Switchy pressed and did not release, or released under a finger"
+};
+static MacroSet fuzzMacros;
+static KeyLayout fuzzLayout;
+static volatile uint32_t fuzzStop;
+
+
+static uint32_t LoadStop()
+{
+#ifdef _WIN32
+	return (uint32_t)InterlockedCompareExchange((volatile LONG*)&fuzzStop, 0, 0);
+#else
+	return __atomic_load_n(&fuzzStop, __ATOMIC_ACQUIRE);
+#endif
+}
+
+
+static void StoreStop()
+{
+#ifdef _WIN32
+	InterlockedExchange((volatile LONG*)&fuzzStop, 1);
+#else
+	__atomic_store_n(&fuzzStop, 1, __ATOMIC_RELEASE);
+#endif
+}
+
+
+static uint32_t FuzzRandom(uint32_t* state)
+{
+	// xorshift32: each thread draws from its own state
+	*state ^= *state << 13;
+	*state ^= *state >> 17;
+	*state ^= *state << 5;
+	return *state;
+}
+
+
+// A key Switchy injects goes through the hook, which lets it pass. A second
+// press is an auto-repeat to the system.
+static void FuzzInject(FuzzWorld* world, uint8_t vkCode, int down)
+{
+	if (!down && !world->injected[vkCode] && world->systemDown[vkCode])
+	{
+		world->strayRelease = 1;
+	}
+	world->injected[vkCode] = (uint8_t)down;
+	world->systemDown[vkCode] = (uint8_t)down;
+}
+
+
+static void FuzzSwitchLayout(FuzzWorld* world)
+{
+	FuzzInject(world, FUZZ_VK_LMENU, 1);
+	FuzzInject(world, CORE_VK_LSHIFT, 1);
+	FuzzInject(world, FUZZ_VK_LMENU, 0);
+	FuzzInject(world, CORE_VK_LSHIFT, 0);
+}
+
+
+// What ApplyEffects does, in the same order
+static void FuzzEffects(FuzzWorld* world, const CoreOutput* output)
+{
+	uint32_t effects = output->effects;
+	if (effects & CORE_TAKE_BACK)
+	{
+		// Released under the finger on purpose: the real release is swallowed
+		world->systemDown[output->vkCode] = 0;
+		if (output->vkCode == CORE_VK_CAPITAL)
+		{
+			FuzzInject(world, CORE_VK_CAPITAL, 1);
+			FuzzInject(world, CORE_VK_CAPITAL, 0);
+			world->capsTaken = 1;
+		}
+	}
+	if (effects & CORE_TOGGLE_ENABLED)
+	{
+		world->enabled = !world->enabled;
+		if (!world->enabled)
+		{
+			Core_Reset(&world->core, &effects);
+		}
+	}
+	if (effects & CORE_RELEASE_WIN)
+	{
+		FuzzInject(world, FUZZ_VK_LWIN, 0);
+	}
+	if (effects & CORE_SWITCH)
+	{
+		FuzzSwitchLayout(world);
+	}
+	if (effects & CORE_TOGGLE_CAPS)
+	{
+		FuzzInject(world, CORE_VK_CAPITAL, 1);
+		FuzzInject(world, CORE_VK_CAPITAL, 0);
+	}
+	if (effects & CORE_POPUP)
+	{
+		FuzzInject(world, FUZZ_VK_LWIN, 1);
+		FuzzInject(world, FUZZ_VK_SPACE, 1);
+		FuzzInject(world, FUZZ_VK_SPACE, 0);
+	}
+	if (effects & CORE_ONESHOT_END)
+	{
+		OneShot_End(&world->core.oneShot);
+	}
+	if (effects & CORE_ONESHOT_BEGIN)
+	{
+		OneShot_Begin(&world->core.oneShot, world->popup ? NULL : &fuzzLayout);
+	}
+	if (effects & CORE_TYPE)
+	{
+		FuzzInject(world, FUZZ_VK_PACKET, 1);
+		FuzzInject(world, FUZZ_VK_PACKET, 0);
+	}
+	if ((effects & CORE_MACRO) && fuzzMacros.actions[output->macro].type == MACRO_SWITCH)
+	{
+		FuzzSwitchLayout(world);
+	}
+	if ((effects & CORE_MACRO) && fuzzMacros.actions[output->macro].type == MACRO_TEXT)
+	{
+		for (int i = 0; i < fuzzMacros.actions[output->macro].erase; i++)
+		{
+			FuzzInject(world, FUZZ_VK_BACK, 1);
+			FuzzInject(world, FUZZ_VK_BACK, 0);
+		}
+		for (int i = 0; i < fuzzMacros.actions[output->macro].textLength; i++)
+		{
+			FuzzInject(world, FUZZ_VK_PACKET, 1);
+			FuzzInject(world, FUZZ_VK_PACKET, 0);
+		}
+	}
+}
+
+
+// Core_Key's callback: like ApplyHookEffects, it reports whether the
+// hook is still installed
+static int FuzzApply(const CoreOutput* output, void* context)
+{
+	FuzzWorld* world = (FuzzWorld*)context;
+	if ((output->effects & CORE_SWITCH) && !(world->capsRelease && world->capsTaken))
+	{
+		world->straySwitch = 1;
+	}
+	FuzzEffects(world, output);
+	return world->enabled;
+}
+
+
+static void FuzzQueueRaw(FuzzWorld* world, uint8_t slot, uint8_t vkCode, int down)
+{
+	if (world->rawCount < FUZZ_MAX_RAW)
+	{
+		FuzzRaw* raw = &world->raw[(world->rawHead + world->rawCount++) % FUZZ_MAX_RAW];
+		raw->slot = slot;
+		raw->vkCode = vkCode;
+		raw->down = (uint8_t)down;
+	}
+}
+
+
+static void FuzzDeliverRaw(FuzzWorld* world)
+{
+	CoreOutput output;
+	if (world->rawCount > 0)
+	{
+		const FuzzRaw* raw = &world->raw[world->rawHead];
+		world->rawHead = (world->rawHead + 1) % FUZZ_MAX_RAW;
+		world->rawCount--;
+		// Keyboard n of the sequence has device slot n + 1
+		if (Core_OnRaw(&world->core, (uint8_t)(raw->slot + 1), raw->vkCode, raw->down, &output))
+		{
+			FuzzEffects(world, &output);
+		}
+	}
+}
+
+
+// Checks the invariants that hold between any two events
+static int FuzzCheck(const FuzzWorld* world)
+{
+	int popupWin = world->injected[FUZZ_VK_LWIN] && world->held[CORE_VK_CAPITAL];
+	if (world->injected[FUZZ_VK_LWIN] && !world->held[CORE_VK_CAPITAL])
+	{
+		return FUZZ_WIN_HELD;
+	}
+	if (world->strayRelease)
+	{
+		return FUZZ_UNBALANCED;
+	}
+	for (int vkCode = 0; vkCode < 256; vkCode++)
+	{
+		if (world->systemDown[vkCode] && !world->held[vkCode] && !world->foreign[vkCode] &&
+			!(vkCode == FUZZ_VK_LWIN && popupWin))
+		{
+			return FUZZ_KEY_STUCK;
+		}
+		if (world->injected[vkCode] && !(vkCode == FUZZ_VK_LWIN && popupWin))
+		{
+			return FUZZ_UNBALANCED;
+		}
+	}
+	return 0;
+}
+
+
+// Returns the invariant broken by the event, 0 if none
+static int FuzzStep(FuzzWorld* world, FuzzEvent event)
+{
+	switch (event.kind)
+	{
+	case FUZZ_RULE:
+		world->ruleOff = !world->ruleOff;
+		return 0;
+	case FUZZ_RAW:
+		FuzzDeliverRaw(world);
+		return FuzzCheck(world);
+	case FUZZ_INJECTED:
+		// The hook lets the keys of other programs through untouched
+		world->foreign[fuzzKeys[event.key]] = !world->foreign[fuzzKeys[event.key]];
+		world->systemDown[fuzzKeys[event.key]] = world->foreign[fuzzKeys[event.key]];
+		return FuzzCheck(world);
+	}
+
+	uint8_t vkCode = fuzzKeys[event.key];
+	int down = event.kind == FUZZ_PRESS;
+	int repeat = down && world->held[vkCode];
+	if (down && !repeat)
+	{
+		world->pressSlot[vkCode] = event.slot;
+	}
+	uint8_t slot = world->held[vkCode] ? world->pressSlot[vkCode] : event.slot;
+	world->held[vkCode] = (uint8_t)down;
+	world->time += event.fast ? 2 : 150;
+
+	const uint8_t* system = world->systemDown;
+	int alt = system[FUZZ_VK_LMENU] && !system[FUZZ_VK_LCONTROL];
+	int passed = 1;
+	if (world->enabled)
+	{
+		CoreInput input;
+		input.vkCode = vkCode;
+		input.message = (uint8_t)(down ? (alt ? CORE_SYSKEY_DOWN : CORE_KEY_DOWN) : (alt ? CORE_SYSKEY_UP : CORE_KEY_UP));
+		input.enabled = !world->ruleOff;
+		input.time = world->time;
+		world->capsRelease = vkCode == CORE_VK_CAPITAL && !down;
+		world->straySwitch = 0;
+		// The press waiting for its raw event can turn Switchy off; the key
+		// then passes the hook that is no longer there
+		passed = Core_Key(&world->core, &input, FuzzApply, world) != CORE_BLOCK;
+		if (world->straySwitch)
+		{
+			return FUZZ_STRAY_SWITCH;
+		}
+		if (vkCode == CORE_VK_CAPITAL && down && !repeat)
+		{
+			world->capsTaken = !passed;
+		}
+	}
+	if (!world->enabled && passed)
+	{
+		// Without the hook only the Alt+CapsLock hotkey is registered
+		int shift = system[CORE_VK_LSHIFT] || system[CORE_VK_RSHIFT];
+		if (vkCode == CORE_VK_CAPITAL && down && !repeat && alt && !shift)
+		{
+			CoreOutput output = { 0 };
+			passed = 0;
+			world->enabled = 1;
+			Core_Reset(&world->core, &output.effects);
+			FuzzEffects(world, &output);
+		}
+	}
+
+	// Raw Input reports what got past the hook, after the hook has run
+	if (passed)
+	{
+		world->systemDown[vkCode] = (uint8_t)down;
+		if (world->core.raw)
+		{
+			FuzzQueueRaw(world, slot, vkCode, down);
+		}
+	}
+	return FuzzCheck(world);
+}
+
+
+// Runs a sequence, then delivers the queued Raw Input and releases every
+// key still held. Returns the broken invariant and the event it broke at
+// (`count` and up for the releases).
+static int FuzzRun(const FuzzSequence* sequence, int* at)
+{
+	static const DeviceKeyState clear = { 0 };
+	FuzzWorld world;
+	memset(&world, 0, sizeof(world));
+	Core_Init(&world.core);
+	world.core.macros = &fuzzMacros;
+	world.core.raw = sequence->raw;
+	world.core.popup = sequence->popup;
+	world.popup = sequence->popup;
+	world.enabled = 1;
+	for (int slot = 0; slot < FUZZ_SLOTS; slot++)
+	{
+		int added;
+		uint8_t deviceSlot = Devices_Slot(&world.core.devices, (uintptr_t)(slot + 1), &added);
+		world.core.devices.slots[deviceSlot].disabled = slot == FUZZ_DISABLED_SLOT;
+	}
+
+	for (int i = 0; i < sequence->count; i++)
+	{
+		int invariant = FuzzStep(&world, sequence->events[i]);
+		if (invariant)
+		{
+			*at = i;
+			return invariant;
+		}
+	}
+
+	*at = sequence->count;
+	for (int key = 0; key < FUZZ_KEYS; key++)
+	{
+		uint8_t vkCode = fuzzKeys[key];
+		FuzzEvent release = { FUZZ_RELEASE, (uint8_t)key, 0, 0 };
+		FuzzEvent foreign = { FUZZ_INJECTED, (uint8_t)key, 0, 0 };
+		int invariant = world.held[vkCode] ? FuzzStep(&world, release) : 0;
+		invariant = !invariant && world.foreign[vkCode] ? FuzzStep(&world, foreign) : invariant;
+		if (invariant)
+		{
+			return invariant;
+		}
+	}
+	while (world.rawCount > 0)
+	{
+		FuzzDeliverRaw(&world);
+	}
+
+	for (int vkCode = 0; vkCode < 256; vkCode++)
+	{
+		if (world.systemDown[vkCode])
+		{
+			return FUZZ_KEY_STUCK;
+		}
+		if (world.injected[vkCode])
+		{
+			return FUZZ_UNBALANCED;
+		}
+	}
+	for (int slot = 0; slot < DEVICE_MAX; slot++)
+	{
+		if (memcmp(&world.core.devices.slots[slot].keys, &clear, sizeof(clear)) != 0)
+		{
+			return FUZZ_STATE_LEFT;
+		}
+	}
+	if (world.core.oneShot.target != NULL || world.core.macroKey != 0)
+	{
+		return FUZZ_STATE_LEFT;
+	}
+	return 0;
+}
+
+
+static FuzzEvent FuzzRandomEvent(uint32_t* state)
+{
+	FuzzEvent event;
+	uint32_t value = FuzzRandom(state);
+	uint32_t kind = value % 100;
+	event.kind = kind < 35 ? FUZZ_PRESS : kind < 65 ? FUZZ_RELEASE : kind < 88 ? FUZZ_RAW : kind < 94 ? FUZZ_INJECTED : FUZZ_RULE;
+	event.key = (uint8_t)((value >> 8) % FUZZ_KEYS);
+	event.slot = (uint8_t)((value >> 16) % FUZZ_SLOTS);
+	event.fast = (value >> 24) % 8 == 0;
+	return event;
+}
+
+
+static void FuzzGenerate(FuzzSequence* sequence, uint32_t* state)
+{
+	uint32_t modes = FuzzRandom(state);
+	sequence->popup = modes % 2;
+	sequence->raw = (modes >> 1) % 4 != 0;
+	sequence->count = 1 + FuzzRandom(state) % FUZZ_MAX_EVENTS;
+	for (int i = 0; i < sequence->count; i++)
+	{
+		sequence->events[i] = FuzzRandomEvent(state);
+	}
+}
+
+
+// Replaces, inserts, removes or swaps events, or flips a mode
+static void FuzzMutate(FuzzSequence* sequence, uint32_t* state)
+{
+	int i = (int)(FuzzRandom(state) % sequence->count);
+	switch (FuzzRandom(state) % 6)
+	{
+	case 0:
+		sequence->events[i] = FuzzRandomEvent(state);
+		break;
+	case 1:
+		if (sequence->count < FUZZ_MAX_EVENTS)
+		{
+			memmove(&sequence->events[i + 1], &sequence->events[i], (sequence->count - i) * sizeof(FuzzEvent));
+			sequence->events[i] = FuzzRandomEvent(state);
+			sequence->count++;
+		}
+		break;
+	case 2:
+		if (sequence->count > 1)
+		{
+			memmove(&sequence->events[i], &sequence->events[i + 1], (sequence->count - i - 1) * sizeof(FuzzEvent));
+			sequence->count--;
+		}
+		break;
+	case 3:
+		if (i + 1 < sequence->count)
+		{
+			FuzzEvent swapped = sequence->events[i];
+			sequence->events[i] = sequence->events[i + 1];
+			sequence->events[i + 1] = swapped;
+		}
+		break;
+	case 4:
+		sequence->raw = !sequence->raw;
+		break;
+	default:
+		sequence->popup = !sequence->popup;
+		break;
+	}
+}
+
+
+// Drops events, moves keys to keyboard 0 and slows bounces down while the
+// same invariant still breaks, until nothing more can go
+static void FuzzShrink(FuzzSequence* sequence, int invariant)
+{
+	int at;
+	for (int changed = 1; changed;)
+	{
+		changed = 0;
+		for (int i = sequence->count - 1; i >= 0; i--)
+		{
+			FuzzSequence shorter = *sequence;
+			memmove(&shorter.events[i], &shorter.events[i + 1], (shorter.count - i - 1) * sizeof(FuzzEvent));
+			shorter.count--;
+			if (shorter.count > 0 && FuzzRun(&shorter, &at) == invariant)
+			{
+				*sequence = shorter;
+				changed = 1;
+			}
+		}
+		for (int i = 0; i < sequence->count; i++)
+		{
+			FuzzSequence simpler = *sequence;
+			simpler.events[i].slot = 0;
+			simpler.events[i].fast = 0;
+			if ((sequence->events[i].slot != 0 || sequence->events[i].fast) && FuzzRun(&simpler, &at) == invariant)
+			{
+				*sequence = simpler;
+				changed = 1;
+			}
+		}
+	}
+}
+
+
+#ifdef _WIN32
+static DWORD WINAPI FuzzThread(LPVOID param)
+#else
+static void* FuzzThread(void* param)
+#endif
+{
+	FuzzSlice* slice = (FuzzSlice*)param;
+	uint32_t state = slice->seed;
+	FuzzSequence sequence;
+	FuzzGenerate(&sequence, &state);
+	for (slice->done = 0; slice->done < slice->sequences; slice->done++)
+	{
+		// Mostly mutations of the last sequence, a fresh one now and then
+		if (slice->done % 8 == 0)
+		{
+			FuzzGenerate(&sequence, &state);
+		}
+		else
+		{
+			FuzzMutate(&sequence, &state);
+		}
+
+		int at;
+		slice->events += (unsigned long long)sequence.count;
+		int invariant = FuzzRun(&sequence, &at);
+		if (invariant)
+		{
+			slice->invariant = invariant;
+			slice->failure = sequence;
+			StoreStop();
+			break;
+		}
+		if (slice->done % 4096 == 0 && LoadStop())
+		{
+			break;
+		}
+	}
+	return 0;
+}
+
+
+static void PrintFuzzSequence(const FuzzSequence* sequence, int invariant)
+{
+	int at = 0;
+	FuzzRun(sequence, &at);
+	printf("Invariant broken: %s\n", fuzzInvariants[invariant]);
+	printf("Pop-up %s, Raw Input %s:\n", sequence->popup ? "on" : "off", sequence->raw ? "on" : "off");
+	for (int i = 0; i < sequence->count; i++)
+	{
+		const FuzzEvent* event = &sequence->events[i];
+		const char* mark = i == at ? "  <--" : "";
+		if (event->kind == FUZZ_RULE)
+		{
+			printf("%3d. a rule turns Switchy on or off%s\n", i + 1, mark);
+		}
+		else if (event->kind == FUZZ_RAW)
+		{
+			printf("%3d. the oldest queued Raw Input event arrives%s\n", i + 1, mark);
+		}
+		else if (event->kind == FUZZ_INJECTED)
+		{
+			printf("%3d. another program injects %s%s\n", i + 1, fuzzKeyNames[event->key], mark);
+		}
+		else
+		{
+			printf("%3d. %s %s on keyboard %d%s%s\n", i + 1, fuzzKeyNames[event->key],
+				event->kind == FUZZ_RELEASE ? "up" : "down", event->slot, event->fast ? " 2 ms later" : "", mark);
+		}
+	}
+	printf("     then every key still held is released%s\n", at >= sequence->count ? "  <--" : "");
+}
+
+
+// Property-based fuzzing of the hook's per-key path: random and mutated
+// sequences of presses, auto-repeats, bounces, stray releases, late Raw
+// Input, keys other programs inject and rule changes go through Core_Key
+// and are checked against the invariants in core.h on every thread. The
+// first failure is shrunk to a minimal sequence.
+int HookFuzz(int argc, char** argv)
+{
+	double sequences = argc > 0 ? atof(argv[0]) : 1e7;
+	int threads = argc > 1 ? atoi(argv[1]) : CpuCount();
+	if (sequences < 1 || threads < 1)
+	{
+		PrintUsage();
+		return 1;
+	}
+
+	// A macro on CapsLock and one on a modifier, and the other layout typing
+	// 'A' as a Cyrillic letter
+	char error[256];
+	if (!Macro_Compile(&fuzzMacros, "Ctrl A = switch\nCapsLock A A = text ab\n", error, sizeof(error)))
+	{
+		printf("%s\n", error);
+		return 1;
+	}
+	fuzzLayout.chars['A'][LAYOUT_PLAIN] = 0x0444;
+	fuzzLayout.chars['A'][LAYOUT_SHIFT] = 0x0424;
+
+	FuzzSlice* slices = calloc((size_t)threads, sizeof(FuzzSlice));
+#ifdef _WIN32
+	HANDLE* handles = malloc((size_t)threads * sizeof(HANDLE));
+#else
+	pthread_t* handles = malloc((size_t)threads * sizeof(pthread_t));
+#endif
+	if (slices == NULL || handles == NULL)
+	{
+		printf("Out of memory\n");
+		free(slices);
+		free(handles);
+		return 1;
+	}
+
+	unsigned long long total = (unsigned long long)sequences;
+	double start = Now();
+	for (int i = 0; i < threads; i++)
+	{
+		slices[i].seed = 2463534242u + (uint32_t)i * 0x9E3779B9u;
+		slices[i].sequences = total / threads + ((unsigned long long)i < total % threads);
+#ifdef _WIN32
+		handles[i] = CreateThread(NULL, 0, FuzzThread, &slices[i], 0, NULL);
+		slices[i].started = handles[i] != NULL;
+#else
+		slices[i].started = pthread_create(&handles[i], NULL, FuzzThread, &slices[i]) == 0;
+#endif
+	}
+
+	// Slices whose thread cannot be created run here, on fewer threads
+	unsigned long long done = 0, events = 0;
+	const FuzzSlice* failed = NULL;
+	int started = 0;
+	for (int i = 0; i < threads; i++)
+	{
+		started += slices[i].started;
+		if (!slices[i].started)
+		{
+			FuzzThread(&slices[i]);
+		}
+		else
+		{
+#ifdef _WIN32
+			WaitForSingleObject(handles[i], INFINITE);
+			CloseHandle(handles[i]);
+#else
+			pthread_join(handles[i], NULL);
+#endif
+		}
+		done += slices[i].done;
+		events += slices[i].events;
+		failed = failed == NULL && slices[i].invariant ? &slices[i] : failed;
+	}
+	double time = Now() - start;
+
+	threads = started > 0 ? started : 1;
+	printf("%llu sequences (%llu events) on %d threads in %.2f s: %.1f M sequences per minute, %.1f M per minute per thread\n",
+		done, events, threads, time, done / time * 60 / 1e6, done / time * 60 / 1e6 / threads);
+
+	int ok = failed == NULL;
+	if (!ok)
+	{
+		FuzzSequence sequence = failed->failure;
+		FuzzShrink(&sequence, failed->invariant);
+		PrintFuzzSequence(&sequence, failed->invariant);
+	}
+	free(slices);
+	free(handles);
+	return ok ? 0 : 1;
+}
@@ -0,0 +1,454 @@
+#ifdef _WIN32
+#include <Windows.h>
+#endif
+#include <stdio.h>
+#include <stdlib.h>
+#include "../Switchy/core.h"
+#include "../Switchy/devices.h"
+#ifdef _WIN32
+#include "../Switchy/hotkeys.h"
+#endif
+#include "../Switchy/macro.h"
+#include "../Switchy/plugins.h"
+#ifdef SWITCHY_X11
+#include <X11/XKBlib.h>
+#include "../Switchy/x11.h"
+#ifdef SWITCHY_XTEST
+#include <X11/extensions/XTest.h>
+#endif
+#endif
+#include "tools.h"
+#include "../Switchy/checked.h"
+
+
+#ifdef _WIN32
+static LRESULT CALLBACK EmptyHook(int nCode, WPARAM wParam, LPARAM lParam)
+{
+	return CallNextHookEx(NULL, nCode, wParam, lParam);
+}
+
+
+// A low-level hook is called in the thread that installed it, which must
+// be waiting for messages like Switchy's main thread
+static DWORD WINAPI HookThread(LPVOID param)
+{
+	MSG message;
+	HHOOK hHook = SetWindowsHookEx(WH_KEYBOARD_LL, EmptyHook, GetModuleHandle(NULL), 0);
+	SetEvent((HANDLE)param);
+	while (GetMessage(&message, NULL, 0, 0) > 0);
+	if (hHook != NULL)
+	{
+		UnhookWindowsHookEx(hHook);
+	}
+	return 0;
+}
+
+
+// Time for one injected key to pass the input system: SendInput, then wait
+// until the asynchronous key state shows it. F24 is on no real keyboard.
+static double KeyRoundTrip(int count)
+{
+	INPUT input;
+	ZeroMemory(&input, sizeof(input));
+	input.type = INPUT_KEYBOARD;
+	input.ki.wVk = VK_F24;
+
+	double start = Now();
+	for (int i = 0; i < count; i++)
+	{
+		input.ki.dwFlags = 0;
+		SendInput(1, &input, sizeof(INPUT));
+		while (!(GetAsyncKeyState(VK_F24) & 0x8000))
+		{
+			Sleep(0);
+		}
+		input.ki.dwFlags = KEYEVENTF_KEYUP;
+		SendInput(1, &input, sizeof(INPUT));
+		while (GetAsyncKeyState(VK_F24) & 0x8000)
+		{
+			Sleep(0);
+		}
+	}
+	return (Now() - start) / (2.0 * count);
+}
+
+
+static void IgnoreTrigger(EngineTrigger trigger)
+{
+}
+#endif
+
+
+// Per-keystroke cost the engines add to every application: the key round
+// trip with no engine, with the hotkeys registered and with a low-level hook
+int HookBenchmark(int argc, char** argv)
+{
+#ifdef _WIN32
+	int count = argc > 0 ? atoi(argv[0]) : 2000;
+	KeyRoundTrip(count / 10 + 1);
+	double none = KeyRoundTrip(count);
+
+	hotkeyEngine.Start(IgnoreTrigger);
+	double hotkeys = KeyRoundTrip(count);
+	hotkeyEngine.Stop();
+
+	HANDLE hReady = CreateEvent(NULL, TRUE, FALSE, NULL);
+	DWORD threadId;
+	HANDLE hThread = CreateThread(NULL, 0, HookThread, hReady, 0, &threadId);
+	WaitForSingleObject(hReady, INFINITE);
+	double hook = KeyRoundTrip(count);
+	PostThreadMessage(threadId, WM_QUIT, 0, 0);
+	WaitForSingleObject(hThread, INFINITE);
+	CloseHandle(hThread);
+	CloseHandle(hReady);
+
+	printf("%d keys: no engine %.1f us, hotkeys %.1f us, low-level hook %.1f us per key event\n",
+		count, none * 1e6, hotkeys * 1e6, hook * 1e6);
+	return 0;
+#else
+	(void)argc;
+	(void)argv;
+	printf("hookbench needs Windows\n");
+	return 1;
+#endif
+}
+
+
+#ifdef SWITCHY_X11
+// Waits for the server to confirm `group`; returns 0 after a second
+static int WaitGroup(X11Keyboard* keyboard, unsigned group)
+{
+	double deadline = Now() + 1.0;
+	while (keyboard->group != group)
+	{
+		if (Now() > deadline || X11_Dispatch(keyboard, 100) < 0)
+		{
+			return 0;
+		}
+	}
+	return 1;
+}
+
+
+#ifdef SWITCHY_XTEST
+static void SwitchTrigger(EngineTrigger trigger)
+{
+	if (trigger == TRIGGER_SWITCH)
+	{
+		X11_SwitchLayout(X11_Engine());
+	}
+}
+
+
+// CapsLock pressed on a virtual keyboard through the x11 engine, until the
+// engine sees the new group. CapsLock itself must stay off.
+static int EngineRoundTrip(int count, double* time)
+{
+	X11Keyboard* keyboard = X11_Engine();
+	Display* input = XOpenDisplay(NULL);
+	int event, error, major, minor;
+	if (input == NULL || !XTestQueryExtension(input, &event, &error, &major, &minor))
+	{
+		printf("No XTest extension\n");
+		return 0;
+	}
+	if (!x11Engine.Start(SwitchTrigger))
+	{
+		XCloseDisplay(input);
+		return 0;
+	}
+	// The grabs must be active before the first press
+	XSync(keyboard->display, False);
+
+	int ok = 1;
+	double start = Now();
+	for (int i = 0; i < count && ok; i++)
+	{
+		unsigned next = (keyboard->group + 1) % keyboard->groupCount;
+		XTestFakeKeyEvent(input, keyboard->capsLock, True, CurrentTime);
+		XTestFakeKeyEvent(input, keyboard->capsLock, False, CurrentTime);
+		XFlush(input);
+		ok = WaitGroup(keyboard, next);
+	}
+	*time = (Now() - start) / count;
+
+	XkbStateRec state;
+	if (ok && XkbGetState(keyboard->display, XkbUseCoreKbd, &state) == Success && (state.locked_mods & LockMask))
+	{
+		printf("CapsLock was toggled by the switch trigger\n");
+		ok = 0;
+	}
+	x11Engine.Stop();
+	XCloseDisplay(input);
+	return ok;
+}
+#endif
+#endif
+
+
+// Switch latency on an X server, e.g. Xvfb with two layouts:
+//   Xvfb :99 & setxkbmap -display :99 us,ru && DISPLAY=:99 SwitchyTools x11bench
+int X11Benchmark(int argc, char** argv)
+{
+#ifdef SWITCHY_X11
+	int count = argc > 0 ? atoi(argv[0]) : 1000;
+	X11Keyboard keyboard;
+	if (!X11_Open(&keyboard, NULL))
+	{
+		printf("Cannot open the display or it has no XKB\n");
+		return 1;
+	}
+	if (keyboard.groupCount < 2)
+	{
+		printf("The keyboard has one layout\n");
+		X11_Close(&keyboard);
+		return 1;
+	}
+
+	unsigned initial = keyboard.group;
+	double worst = 0;
+	double start = Now();
+	for (int i = 0; i < count; i++)
+	{
+		unsigned next = (keyboard.group + 1) % keyboard.groupCount;
+		double switchStart = Now();
+		if (!X11_LockGroup(&keyboard, next) || !WaitGroup(&keyboard, next))
+		{
+			printf("Group %u was not confirmed\n", next);
+			X11_Close(&keyboard);
+			return 1;
+		}
+		double time = Now() - switchStart;
+		worst = time > worst ? time : worst;
+	}
+	double average = (Now() - start) / count;
+	printf("%d switches between %u layouts: %.1f us average, %.1f us worst until XkbStateNotify\n",
+		count, keyboard.groupCount, average * 1e6, worst * 1e6);
+
+#ifdef SWITCHY_XTEST
+	double engine;
+	if (!EngineRoundTrip(count, &engine))
+	{
+		X11_LockGroup(&keyboard, initial);
+		X11_Close(&keyboard);
+		return 1;
+	}
+	printf("%d CapsLock presses through the x11 engine: %.1f us per switch\n", count, engine * 1e6);
+#endif
+
+	X11_LockGroup(&keyboard, initial);
+	X11_Close(&keyboard);
+	return 0;
+#else
+	(void)argc;
+	(void)argv;
+	printf("x11bench needs building with -DSWITCHY_X11 and -lX11\n");
+	return 1;
+#endif
+}
+
+
+#ifdef SWITCHY_CHECKED
+typedef enum {
+	EVENT_KEY_DOWN,
+	EVENT_KEY_UP,
+	EVENT_RAW_DOWN,
+	EVENT_RAW_UP,
+	EVENT_TYPES
+} HotPathEvent;
+
+static const char* eventNames[EVENT_TYPES] = {
+	"key down", "key up", "Raw Input key down", "Raw Input key up"
+};
+
+typedef struct {
+	Core core;
+	PluginHost plugins;
+	const KeyLayout* target;
+	uint32_t time;
+	// Characters that would go to SendText
+	uint32_t sent;
+	uint32_t events[EVENT_TYPES];
+	uint32_t allocations[EVENT_TYPES];
+	uint32_t blocks[EVENT_TYPES];
+} HotPath;
+
+
+// The hook's ApplyEffects without the keys it injects: SendText gets
+// counted characters instead
+static int HotPathEffects(const CoreOutput* output, void* context)
+{
+	HotPath* path = (HotPath*)context;
+	uint32_t effects = output->effects;
+	if (effects & CORE_CONVERT)
+	{
+		Plugins_Post(&path->plugins, SWITCHY_ACTION_CONVERT, 0);
+	}
+	if (effects & CORE_TOGGLE_ENABLED)
+	{
+		Plugins_Post(&path->plugins, SWITCHY_ACTION_ENABLE, 1);
+	}
+	if (effects & (CORE_SWITCH | CORE_POPUP))
+	{
+		Plugins_Post(&path->plugins, SWITCHY_ACTION_SWITCH, 0);
+	}
+	if (effects & CORE_TOGGLE_CAPS)
+	{
+		Plugins_Post(&path->plugins, SWITCHY_ACTION_CAPS_LOCK, 0);
+	}
+	if (effects & CORE_ONESHOT_END)
+	{
+		OneShot_End(&path->core.oneShot);
+	}
+	if (effects & CORE_ONESHOT_BEGIN)
+	{
+		OneShot_Begin(&path->core.oneShot, path->target);
+	}
+	if (effects & CORE_TYPE)
+	{
+		path->sent++;
+	}
+	if (effects & CORE_MACRO)
+	{
+		const MacroAction* action = &path->core.macros->actions[output->macro];
+		switch (action->type)
+		{
+		case MACRO_SWITCH:
+			Plugins_Post(&path->plugins, SWITCHY_ACTION_SWITCH, 0);
+			break;
+		case MACRO_LAYOUT:
+			Plugins_Post(&path->plugins, SWITCHY_ACTION_LAYOUT, strtoul(action->layout, NULL, 16));
+			break;
+		case MACRO_TEXT:
+			path->sent += action->textLength;
+			break;
+		}
+	}
+	return 1;
+}
+
+
+static void HotPathCount(HotPath* path, HotPathEvent type, const CheckedCounters* before)
+{
+	path->events[type]++;
+	path->allocations[type] += checkedCounters.allocations - before->allocations;
+	path->blocks[type] += checkedCounters.blocks - before->blocks;
+}
+
+
+// One key event the way the hook and then, if the key got through, the
+// window procedure handle it
+static void HotPathKey(HotPath* path, uint8_t vkCode, int down, uint8_t slot)
+{
+	CheckedCounters before = checkedCounters;
+	CHECKED_ENTER();
+	CoreInput input = { vkCode, (uint8_t)(down ? CORE_KEY_DOWN : CORE_KEY_UP), 1, path->time += 10 };
+	int passed = Core_Key(&path->core, &input, HotPathEffects, path) != CORE_BLOCK;
+	CHECKED_LEAVE();
+	HotPathCount(path, down ? EVENT_KEY_DOWN : EVENT_KEY_UP, &before);
+
+	if (passed && path->core.raw)
+	{
+		CoreOutput output;
+		before = checkedCounters;
+		CHECKED_ENTER();
+		if (Core_OnRaw(&path->core, slot, vkCode, down, &output))
+		{
+			HotPathEffects(&output, path);
+		}
+		CHECKED_LEAVE();
+		HotPathCount(path, down ? EVENT_RAW_DOWN : EVENT_RAW_UP, &before);
+	}
+}
+#endif
+
+
+// Feeds every key, pressed, auto-repeated and released, with and without
+// CapsLock held, with and without Raw Input, through the hook's per-key
+// path (Core_Key, then Core_OnRaw for keys that got through, and the
+// effects apart from injecting keys) with macros and typing in the other
+// layout loaded, and fails if any of it touches the heap or blocks. The
+// system calls of the hook are counted by a checked build of Switchy
+// itself. Needs a build with SWITCHY_CHECKED.
+int HotPathCheck(int argc, char** argv)
+{
+#ifdef SWITCHY_CHECKED
+	static MacroSet macros;
+	static HotPath path;
+	static KeyLayout en, ru;
+	char error[PLUGIN_MAX_PATH + 64];
+
+	const char* config = "1 2 = layout 00000409\nA B C = text Best regards\nX Y = switch\n";
+	if (!Macro_Compile(&macros, config, error, sizeof(error)))
+	{
+		printf("%s\n", error);
+		return 1;
+	}
+	for (int i = 0; i < argc; i++)
+	{
+		if (!Plugins_Load(&path.plugins, argv[i], PLUGIN_DEFAULT_BUDGET, error, sizeof(error)))
+		{
+			printf("%s\n", error);
+			Plugins_Free(&path.plugins);
+			return 1;
+		}
+	}
+
+	SampleLayouts(&en, &ru);
+	path.target = &ru;
+	Core_Init(&path.core);
+	path.core.macros = &macros;
+	int added;
+	uint8_t first = Devices_Slot(&path.core.devices, 0x100, &added);
+	uint8_t second = Devices_Slot(&path.core.devices, 0x200, &added);
+	for (int raw = 0; raw <= 1; raw++)
+	{
+		path.core.raw = (uint8_t)raw;
+		for (int round = 0; round < 4; round++)
+		{
+			// CapsLock held on every other round, on the other keyboard
+			path.core.popup = round >= 2;
+			if (round % 2)
+			{
+				HotPathKey(&path, CORE_VK_CAPITAL, 1, second);
+			}
+			for (int vkCode = 1; vkCode < 256; vkCode++)
+			{
+				uint8_t slot = vkCode % 2 ? first : second;
+				if (vkCode != CORE_VK_CAPITAL)
+				{
+					HotPathKey(&path, (uint8_t)vkCode, 1, slot);
+					HotPathKey(&path, (uint8_t)vkCode, 1, slot);
+					HotPathKey(&path, (uint8_t)vkCode, 0, slot);
+				}
+			}
+			if (round % 2)
+			{
+				HotPathKey(&path, CORE_VK_CAPITAL, 0, second);
+			}
+		}
+	}
+
+	int ok = 1;
+	for (int type = 0; type < EVENT_TYPES; type++)
+	{
+		printf("%s: %u events, %u heap calls, %u blocking calls\n", eventNames[type],
+			path.events[type], path.allocations[type], path.blocks[type]);
+		ok = ok && path.allocations[type] == 0 && path.blocks[type] == 0;
+	}
+	printf("%u characters typed in the other layout, %u characters sent\n", path.core.oneShot.typed, path.sent);
+
+	if (!ok)
+	{
+		Checked_Report(error, sizeof(error));
+		printf("%s\n", error);
+	}
+	Plugins_Free(&path.plugins);
+	return ok ? 0 : 1;
+#else
+	(void)argc;
+	(void)argv;
+	printf("hotpathcheck needs building with -DSWITCHY_CHECKED\n");
+	return 1;
+#endif
+}
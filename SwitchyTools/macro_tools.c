@@ -0,0 +1,180 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "../Switchy/core.h"
+#include "../Switchy/macro.h"
+#include "tools.h"
+#include "../Switchy/checked.h"
+
+
+// Compiles a macro config, reporting syntax errors and ambiguous sequences,
+// then measures automaton transitions per second on random key presses.
+int MacroBenchmark(int argc, char** argv)
+{
+	if (argc < 1)
+	{
+		PrintUsage();
+		return 1;
+	}
+
+	static MacroSet set;
+	char error[256];
+	double start = Now();
+	if (!Macro_LoadFile(&set, argv[0], error, sizeof(error)))
+	{
+		printf("%s\n", error);
+		return 1;
+	}
+	double compiled = Now() - start;
+	printf("%s: %u macros, %u states, %u keys, compiled in %.1f us\n",
+		argv[0], set.actionCount, set.stateCount, set.symbolCount - 1, compiled * 1e6);
+
+	// Key presses drawn from the keys the macros use plus a few others
+	uint8_t alphabet[MACRO_MAX_SYMBOLS + 4] = { 'Q', 'W', ' ', 0x0D };
+	size_t alphabetSize = 4;
+	for (int vk = 0; vk < 256; vk++)
+	{
+		if (set.symbolOf[vk] != MACRO_OTHER_SYMBOL)
+		{
+			alphabet[alphabetSize++] = (uint8_t)vk;
+		}
+	}
+
+	enum { STREAM = 1 << 16, ROUNDS = 256 };
+	static uint8_t stream[STREAM];
+	srand(1);
+	for (size_t i = 0; i < STREAM; i++)
+	{
+		stream[i] = alphabet[rand() % alphabetSize];
+	}
+
+	MacroState state = { 0 };
+	unsigned long fired = 0;
+	start = Now();
+	for (int round = 0; round < ROUNDS; round++)
+	{
+		for (size_t i = 0; i < STREAM; i++)
+		{
+			fired += Macro_OnKey(&set, &state, stream[i], 1) != MACRO_NONE;
+			Macro_OnKey(&set, &state, stream[i], 0);
+		}
+	}
+	double elapsed = Now() - start;
+	printf("%d key presses, %lu macros fired, %.1f M presses/s\n",
+		STREAM * ROUNDS, fired, elapsed > 0 ? STREAM * (double)ROUNDS / elapsed / 1e6 : 0.0);
+	return 0;
+}
+
+
+typedef struct {
+	const char* name;
+	// Pressed and released one after another, 0 ends them
+	uint8_t keys[8];
+	const char* text;
+} MacroCase;
+
+typedef struct {
+	const MacroSet* set;
+	char text[64];
+	int length;
+} MacroEditor;
+
+// The README example; only its text macro changes what the window shows
+static const char* macroExample =
+	"CapsLock E = layout 00000409\n"
+	"CapsLock R = layout 00000419\n"
+	"Pause S I G = text Best regards\n"
+	"Ctrl Q = switch\n";
+
+static const MacroCase macroCases[] = {
+	{ "the sequence", { 0x13, 'S', 'I', 'G' }, "Best regards" },
+	{ "after a word", { 'S', 'O', ' ', 0x13, 'S', 'I', 'G' }, "so Best regards" },
+	{ "a sequence that breaks", { 0x13, 'S', 'I', 'X' }, "six" },
+	{ "its keys without Pause", { 'S', 'I', 'G' }, "sig" },
+	{ "a layout macro", { 0x14, 'E' }, "" },
+};
+
+
+static void MacroType(MacroEditor* editor, char ch)
+{
+	if (ch == '\b')
+	{
+		editor->length -= editor->length > 0;
+	}
+	else if (editor->length < (int)sizeof(editor->text) - 1)
+	{
+		editor->text[editor->length++] = ch;
+	}
+}
+
+
+// What the window gets from the keys Switchy injects
+static int MacroEffects(const CoreOutput* output, void* context)
+{
+	MacroEditor* editor = (MacroEditor*)context;
+	if ((output->effects & CORE_MACRO) && editor->set->actions[output->macro].type == MACRO_TEXT)
+	{
+		const MacroAction* action = &editor->set->actions[output->macro];
+		for (int i = 0; i < action->erase; i++)
+		{
+			MacroType(editor, '\b');
+		}
+		for (int i = 0; i < action->textLength; i++)
+		{
+			MacroType(editor, (char)editor->set->text[action->textOffset + i]);
+		}
+	}
+	return 1;
+}
+
+
+// Types the README macros through the hook's per-key path and checks what
+// the window ends up with: the keys before the last one of a sequence are
+// let through, then erased when a text replaces them
+int MacroCheck(int argc, char** argv)
+{
+	(void)argc;
+	(void)argv;
+	static MacroSet set;
+	static Core core;
+	char error[256];
+	if (!Macro_Compile(&set, macroExample, error, sizeof(error)))
+	{
+		printf("%s\n", error);
+		return 1;
+	}
+
+	int failed = 0;
+	int count = (int)(sizeof(macroCases) / sizeof(macroCases[0]));
+	for (int i = 0; i < count; i++)
+	{
+		const MacroCase* test = &macroCases[i];
+		MacroEditor editor = { &set, "", 0 };
+		Core_Init(&core);
+		memset(core.unseen, 0, sizeof(core.unseen));
+		core.macros = &set;
+		uint32_t time = 0;
+		for (int k = 0; k < (int)sizeof(test->keys) && test->keys[k] != 0; k++)
+		{
+			uint8_t vkCode = test->keys[k];
+			for (int down = 1; down >= 0; down--)
+			{
+				CoreInput input = { vkCode, (uint8_t)(down ? CORE_KEY_DOWN : CORE_KEY_UP), 1, time += 100 };
+				int result = Core_Key(&core, &input, MacroEffects, &editor);
+				// Letters and Space reach the window as typed, lowercase
+				if (down && result != CORE_BLOCK && ((vkCode >= 'A' && vkCode <= 'Z') || vkCode == ' '))
+				{
+					MacroType(&editor, (char)(vkCode == ' ' ? ' ' : vkCode - 'A' + 'a'));
+				}
+			}
+		}
+		editor.text[editor.length] = 0;
+		if (strcmp(editor.text, test->text) != 0)
+		{
+			printf("Failed: %s: \"%s\" instead of \"%s\"\n", test->name, editor.text, test->text);
+			failed++;
+		}
+	}
+	printf("%d of %d macro cases passed\n", count - failed, count);
+	return failed == 0 ? 0 : 1;
+}
@@ -0,0 +1,197 @@
+#ifdef _WIN32
+#include <Windows.h>
+#else
+#include <unistd.h>
+#endif
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <wchar.h>
+#include "tools.h"
+#include "../Switchy/checked.h"
+
+
+int main(int argc, char** argv)
+{
+	if (argc > 1 && strcmp(argv[1], "dict") == 0)
+	{
+		return CompileDictionary(argc - 2, argv + 2);
+	}
+	if (argc > 1 && strcmp(argv[1], "dictstat") == 0)
+	{
+		return DictionaryStats(argc - 2, argv + 2);
+	}
+	if (argc > 1 && strcmp(argv[1], "convbench") == 0)
+	{
+		return ConversionBenchmark(argc - 2, argv + 2);
+	}
+	if (argc > 1 && strcmp(argv[1], "macrobench") == 0)
+	{
+		return MacroBenchmark(argc - 2, argv + 2);
+	}
+	if (argc > 1 && strcmp(argv[1], "macrocheck") == 0)
+	{
+		return MacroCheck(argc - 2, argv + 2);
+	}
+	if (argc > 1 && strcmp(argv[1], "statebench") == 0)
+	{
+		return StateBenchmark(argc - 2, argv + 2);
+	}
+	if (argc > 1 && strcmp(argv[1], "sharedbench") == 0)
+	{
+		return SharedBenchmark(argc - 2, argv + 2);
+	}
+	if (argc > 1 && strcmp(argv[1], "rulesbench") == 0)
+	{
+		return RulesBenchmark(argc - 2, argv + 2);
+	}
+	if (argc > 1 && strcmp(argv[1], "devicecheck") == 0)
+	{
+		return DeviceCheck(argc - 2, argv + 2);
+	}
+	if (argc > 1 && strcmp(argv[1], "hookbench") == 0)
+	{
+		return HookBenchmark(argc - 2, argv + 2);
+	}
+	if (argc > 1 && strcmp(argv[1], "x11bench") == 0)
+	{
+		return X11Benchmark(argc - 2, argv + 2);
+	}
+	if (argc > 1 && strcmp(argv[1], "plugincheck") == 0)
+	{
+		return PluginCheck(argc - 2, argv + 2);
+	}
+	if (argc > 1 && strcmp(argv[1], "hotpathcheck") == 0)
+	{
+		return HotPathCheck(argc - 2, argv + 2);
+	}
+	if (argc > 1 && strcmp(argv[1], "chattercheck") == 0)
+	{
+		return ChatterCheck(argc - 2, argv + 2);
+	}
+	if (argc > 1 && strcmp(argv[1], "model") == 0)
+	{
+		return BuildModel(argc - 2, argv + 2);
+	}
+	if (argc > 1 && strcmp(argv[1], "modelbench") == 0)
+	{
+		return ModelBenchmark(argc - 2, argv + 2);
+	}
+	if (argc > 1 && strcmp(argv[1], "oneshotcheck") == 0)
+	{
+		return OneShotCheck(argc - 2, argv + 2);
+	}
+	if (argc > 1 && strcmp(argv[1], "hookfuzz") == 0)
+	{
+		return HookFuzz(argc - 2, argv + 2);
+	}
+
+	PrintUsage();
+	return 1;
+}
+
+
+void PrintUsage()
+{
+	printf("Usage:\n");
+	printf("  SwitchyTools dict <out.dawg> <layoutA> <wordsA.txt> [<layoutB> <wordsB.txt>]\n");
+	printf("  SwitchyTools dictstat <file.dawg> <words.txt>\n");
+	printf("  SwitchyTools convbench [megabytes]\n");
+	printf("  SwitchyTools macrobench <Switchy.macros>\n");
+	printf("  SwitchyTools macrocheck\n");
+	printf("  SwitchyTools statebench <state.bin>\n");
+	printf("  SwitchyTools sharedbench [instances]\n");
+	printf("  SwitchyTools rulesbench [rules]\n");
+	printf("  SwitchyTools devicecheck [events]\n");
+	printf("  SwitchyTools hookbench [keys]\n");
+	printf("  SwitchyTools x11bench [switches]\n");
+	printf("  SwitchyTools plugincheck <budget ms> <plugin> [<plugin> ...]\n");
+	printf("  SwitchyTools hotpathcheck [<plugin> ...]\n");
+	printf("  SwitchyTools chattercheck [presses]\n");
+	printf("  SwitchyTools model <out.model> <layoutA> <textA.txt> [<layoutB> <textB.txt>] [threads]\n");
+	printf("  SwitchyTools modelbench [megabytes] [threads]\n");
+	printf("  SwitchyTools oneshotcheck [events]\n");
+	printf("  SwitchyTools hookfuzz [sequences] [threads]\n");
+	printf("Layouts are keyboard layout identifiers, e.g. 00000409 (English) or 00000419 (Russian).\n");
+	printf("Word lists are UTF-8, one word per line; model texts are plain UTF-8 text.\n");
+}
+
+
+double Now()
+{
+#ifdef _WIN32
+	LARGE_INTEGER counter, frequency;
+	QueryPerformanceCounter(&counter);
+	QueryPerformanceFrequency(&frequency);
+	return (double)counter.QuadPart / (double)frequency.QuadPart;
+#else
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+#endif
+}
+
+
+int CpuCount()
+{
+#ifdef _WIN32
+	SYSTEM_INFO info;
+	GetSystemInfo(&info);
+	return (int)info.dwNumberOfProcessors;
+#else
+	long count = sysconf(_SC_NPROCESSORS_ONLN);
+	return count > 0 ? (int)count : 1;
+#endif
+}
+
+
+const wchar_t sampleEnglish[] = L"`qwertyuiop[]asdfghjkl;'zxcvbnm,./~QWERTYUIOP{}ASDFGHJKL:\"ZXCVBNM<>?";
+const wchar_t sampleRussian[] = L"ёйцукенгшщзхъфывапролджэячсмитьбю.ЁЙЦУКЕНГШЩЗХЪФЫВАПРОЛДЖЭЯЧСМИТЬБЮ,";
+
+
+const uint8_t sampleKeys[SAMPLE_KEYS] = {
+	0xC0, 'Q', 'W', 'E', 'R', 'T', 'Y', 'U', 'I', 'O', 'P', 0xDB, 0xDD,
+	'A', 'S', 'D', 'F', 'G', 'H', 'J', 'K', 'L', 0xBA, 0xDE,
+	'Z', 'X', 'C', 'V', 'B', 'N', 'M', 0xBC, 0xBE, 0xBF
+};
+
+
+// Without system keyboard layouts the English and Russian letter keys are
+// taken from the built-in tables, with their real virtual-key codes.
+int LoadKeyLayout(const char* id, KeyLayout* keyLayout)
+{
+#ifdef _WIN32
+	HKL hkl = LoadKeyboardLayoutA(id, KLF_NOTELLSHELL);
+	return hkl != NULL && Layout_Load(keyLayout, hkl);
+#else
+	const wchar_t* sample = strcmp(id, "00000409") == 0 ? sampleEnglish : strcmp(id, "00000419") == 0 ? sampleRussian : NULL;
+	if (sample == NULL)
+	{
+		return 0;
+	}
+
+	memset(keyLayout, 0, sizeof(*keyLayout));
+	for (size_t i = 0; i < sizeof(sampleKeys); i++)
+	{
+		keyLayout->chars[sampleKeys[i]][LAYOUT_PLAIN] = (uint16_t)sample[i];
+		keyLayout->chars[sampleKeys[i]][LAYOUT_SHIFT] = (uint16_t)sample[sizeof(sampleKeys) + i];
+	}
+	return 1;
+#endif
+}
+
+
+// Letter keys of the English and Russian layouts, enough for the benchmarks
+void SampleLayouts(KeyLayout* en, KeyLayout* ru)
+{
+	size_t keys = wcslen(sampleEnglish) / 2;
+	memset(en, 0, sizeof(*en));
+	memset(ru, 0, sizeof(*ru));
+	for (size_t i = 0; i < keys; i++)
+	{
+		en->chars[i][LAYOUT_PLAIN] = (uint16_t)sampleEnglish[i];
+		en->chars[i][LAYOUT_SHIFT] = (uint16_t)sampleEnglish[keys + i];
+		ru->chars[i][LAYOUT_PLAIN] = (uint16_t)sampleRussian[i];
+		ru->chars[i][LAYOUT_SHIFT] = (uint16_t)sampleRussian[keys + i];
+	}
+}
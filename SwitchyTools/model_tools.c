@@ -0,0 +1,529 @@
+#ifdef _WIN32
+#include <Windows.h>
+#else
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "../Switchy/model.h"
+#include "tools.h"
+#include "../Switchy/checked.h"
+
+
+// Corpora are mapped whole and split into one slice per thread; each thread
+// counts its slice into a table of its own in pieces small enough for the
+// 32-bit counters, adding every piece to its 64-bit totals.
+#define MODEL_PIECE (1u << 30)
+
+typedef struct {
+	const uint8_t* text;
+	size_t size;
+#ifdef _WIN32
+	HANDLE hFile;
+	HANDLE hMapping;
+#endif
+} Corpus;
+
+typedef struct {
+	const ModelKeymap* keymap;
+	int layout;
+	const uint8_t* text;
+	size_t size;
+	uint32_t* counts;
+	uint64_t* totals;
+	size_t characters;
+	// Its thread could be created; if not, the caller counts it
+	int started;
+} CountSlice;
+
+
+
+static int OpenCorpus(Corpus* corpus, const char* path)
+{
+	memset(corpus, 0, sizeof(*corpus));
+#ifdef _WIN32
+	HANDLE hFile = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+	LARGE_INTEGER size;
+	if (hFile == INVALID_HANDLE_VALUE || !GetFileSizeEx(hFile, &size) || size.QuadPart == 0)
+	{
+		if (hFile != INVALID_HANDLE_VALUE)
+		{
+			CloseHandle(hFile);
+		}
+		return 0;
+	}
+
+	corpus->hFile = hFile;
+	corpus->hMapping = CreateFileMappingA(hFile, NULL, PAGE_READONLY, 0, 0, NULL);
+	corpus->text = corpus->hMapping ? (const uint8_t*)MapViewOfFile(corpus->hMapping, FILE_MAP_READ, 0, 0, 0) : NULL;
+	corpus->size = (size_t)size.QuadPart;
+#else
+	int fd = open(path, O_RDONLY);
+	struct stat st;
+	if (fd < 0 || fstat(fd, &st) != 0 || st.st_size == 0)
+	{
+		if (fd >= 0)
+		{
+			close(fd);
+		}
+		return 0;
+	}
+
+	void* view = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if (view != MAP_FAILED)
+	{
+		posix_madvise(view, (size_t)st.st_size, POSIX_MADV_SEQUENTIAL);
+		corpus->text = (const uint8_t*)view;
+		corpus->size = (size_t)st.st_size;
+	}
+#endif
+	return corpus->text != NULL;
+}
+
+
+static void CloseCorpus(Corpus* corpus)
+{
+#ifdef _WIN32
+	if (corpus->text)
+	{
+		UnmapViewOfFile(corpus->text);
+	}
+	if (corpus->hMapping)
+	{
+		CloseHandle(corpus->hMapping);
+	}
+	if (corpus->hFile)
+	{
+		CloseHandle(corpus->hFile);
+	}
+#else
+	if (corpus->text)
+	{
+		munmap((void*)corpus->text, corpus->size);
+	}
+#endif
+	memset(corpus, 0, sizeof(*corpus));
+}
+
+
+// Moves a split point forward to the start of a character
+static size_t CharStart(const uint8_t* text, size_t size, size_t offset)
+{
+	while (offset < size && (text[offset] & 0xC0) == 0x80)
+	{
+		offset++;
+	}
+	return offset;
+}
+
+
+#ifdef _WIN32
+static DWORD WINAPI CountThread(LPVOID param)
+#else
+static void* CountThread(void* param)
+#endif
+{
+	CountSlice* slice = (CountSlice*)param;
+	size_t table = (size_t)slice->keymap->symbolCount * slice->keymap->symbolCount * slice->keymap->symbolCount;
+	size_t offset = 0;
+	while (offset < slice->size)
+	{
+		size_t end = slice->size - offset > MODEL_PIECE ? CharStart(slice->text, slice->size, offset + MODEL_PIECE) : slice->size;
+		memset(slice->counts, 0, table * sizeof(uint32_t));
+		slice->characters += Model_Count(slice->keymap, slice->layout, slice->text + offset, end - offset, slice->counts);
+		for (size_t i = 0; i < table; i++)
+		{
+			slice->totals[i] += slice->counts[i];
+		}
+		offset = end;
+	}
+	return 0;
+}
+
+
+// Counts a corpus on `threads` threads and adds the merged counts to `totals`.
+// Returns the number of characters, or -1 if out of memory.
+static long long CountCorpus(const ModelKeymap* keymap, int layout, const uint8_t* text, size_t size, int threads, uint64_t* totals)
+{
+	size_t table = (size_t)keymap->symbolCount * keymap->symbolCount * keymap->symbolCount;
+	CountSlice* slices = calloc((size_t)threads, sizeof(CountSlice));
+	if (slices == NULL)
+	{
+		return -1;
+	}
+
+	int ok = 1;
+	size_t start = 0;
+	for (int i = 0; i < threads; i++)
+	{
+		size_t end = i == threads - 1 ? size : CharStart(text, size, size / threads * (i + 1));
+		slices[i].keymap = keymap;
+		slices[i].layout = layout;
+		slices[i].text = text + start;
+		slices[i].size = end > start ? end - start : 0;
+		slices[i].counts = malloc(table * sizeof(uint32_t));
+		slices[i].totals = calloc(table, sizeof(uint64_t));
+		ok = ok && slices[i].counts != NULL && slices[i].totals != NULL;
+		start = end > start ? end : start;
+	}
+
+	long long characters = -1;
+	if (ok)
+	{
+		// Slices whose thread cannot be created are counted here, on fewer threads
+#ifdef _WIN32
+		HANDLE* handles = malloc((size_t)threads * sizeof(HANDLE));
+		for (int i = 0; handles != NULL && i < threads; i++)
+		{
+			handles[i] = CreateThread(NULL, 0, CountThread, &slices[i], 0, NULL);
+			slices[i].started = handles[i] != NULL;
+		}
+		for (int i = 0; handles != NULL && i < threads; i++)
+		{
+			if (!slices[i].started)
+			{
+				CountThread(&slices[i]);
+			}
+			else
+			{
+				WaitForSingleObject(handles[i], INFINITE);
+				CloseHandle(handles[i]);
+			}
+		}
+		ok = handles != NULL;
+		free(handles);
+#else
+		pthread_t* handles = malloc((size_t)threads * sizeof(pthread_t));
+		for (int i = 0; handles != NULL && i < threads; i++)
+		{
+			slices[i].started = pthread_create(&handles[i], NULL, CountThread, &slices[i]) == 0;
+		}
+		for (int i = 0; handles != NULL && i < threads; i++)
+		{
+			if (!slices[i].started)
+			{
+				CountThread(&slices[i]);
+			}
+			else
+			{
+				pthread_join(handles[i], NULL);
+			}
+		}
+		ok = handles != NULL;
+		free(handles);
+#endif
+	}
+
+	if (ok)
+	{
+		characters = 0;
+		for (int i = 0; i < threads; i++)
+		{
+			for (size_t j = 0; j < table; j++)
+			{
+				totals[j] += slices[i].totals[j];
+			}
+			characters += (long long)slices[i].characters;
+		}
+	}
+
+	for (int i = 0; i < threads; i++)
+	{
+		free(slices[i].counts);
+		free(slices[i].totals);
+	}
+	free(slices);
+	return characters;
+}
+
+
+static int ModelStats(const char* path)
+{
+	Model model;
+	double start = Now();
+	if (!Model_Open(&model, path))
+	{
+		printf("Cannot open model \"%s\"\n", path);
+		return 1;
+	}
+	double opened = Now() - start;
+
+	printf("%s: %zu bytes, %u symbols, %u layouts, opened in %.1f us\n",
+		path, model.size, model.header->symbolCount, model.header->layoutCount, opened * 1e6);
+	Model_Close(&model);
+	return 0;
+}
+
+
+// Builds a model from one text corpus per layout, counting on every core
+int BuildModel(int argc, char** argv)
+{
+	if (argc < 3 || argc > 6)
+	{
+		PrintUsage();
+		return 1;
+	}
+
+	int layoutCount = (argc - 1) / 2;
+	int threads = argc % 2 == 0 ? atoi(argv[argc - 1]) : CpuCount();
+	if (threads < 1)
+	{
+		PrintUsage();
+		return 1;
+	}
+
+	static KeyLayout keyLayouts[MODEL_MAX_LAYOUTS];
+	static ModelKeymap keymap;
+	uint32_t layouts[MODEL_MAX_LAYOUTS];
+	for (int i = 0; i < layoutCount; i++)
+	{
+		layouts[i] = (uint32_t)strtoul(argv[1 + i * 2], NULL, 16);
+		if (!LoadKeyLayout(argv[1 + i * 2], &keyLayouts[i]))
+		{
+			printf("Cannot load keyboard layout %s\n", argv[1 + i * 2]);
+			return 1;
+		}
+	}
+	if (!ModelKeymap_Init(&keymap, layouts, keyLayouts, layoutCount))
+	{
+		printf("The layouts have more than %d keys\n", MODEL_MAX_SYMBOLS - 1);
+		return 1;
+	}
+
+	size_t table = (size_t)keymap.symbolCount * keymap.symbolCount * keymap.symbolCount;
+	uint64_t* counts = calloc(table * layoutCount, sizeof(uint64_t));
+	if (counts == NULL)
+	{
+		printf("Out of memory\n");
+		return 1;
+	}
+
+	for (int i = 0; i < layoutCount; i++)
+	{
+		Corpus corpus;
+		const char* path = argv[2 + i * 2];
+		if (!OpenCorpus(&corpus, path))
+		{
+			printf("Cannot open \"%s\"\n", path);
+			free(counts);
+			return 1;
+		}
+
+		double start = Now();
+		long long characters = CountCorpus(&keymap, i, corpus.text, corpus.size, threads, counts + table * i);
+		double time = Now() - start;
+		double megabytes = corpus.size / 1e6;
+		CloseCorpus(&corpus);
+		if (characters < 0)
+		{
+			printf("Out of memory\n");
+			free(counts);
+			return 1;
+		}
+		printf("%s: %.1f MB, %lld characters on %d threads in %.2f s, %.1f MB/s, %.1f MB/s per thread\n",
+			path, megabytes, characters, threads, time, megabytes / time, megabytes / time / threads);
+	}
+
+	int ok = Model_Write(&keymap, counts, argv[0]);
+	free(counts);
+	if (!ok)
+	{
+		printf("Cannot write \"%s\"\n", argv[0]);
+		return 1;
+	}
+	return ModelStats(argv[0]);
+}
+
+
+static const wchar_t* sampleEnglishWords[] = {
+	L"the", L"and", L"that", L"have", L"for", L"not", L"with", L"you", L"this", L"but",
+	L"from", L"they", L"will", L"would", L"there", L"their", L"what", L"about", L"which", L"when",
+	L"make", L"can", L"like", L"time", L"just", L"know", L"take", L"people", L"into", L"year",
+	L"good", L"some", L"could", L"them", L"see", L"other", L"than", L"then", L"now", L"look"
+};
+static const wchar_t* sampleRussianWords[] = {
+	L"что", L"это", L"так", L"вот", L"быть", L"как", L"она", L"они", L"мы", L"все",
+	L"его", L"только", L"был", L"еще", L"уже", L"сказать", L"когда", L"если", L"может", L"время",
+	L"человек", L"год", L"себя", L"дело", L"жизнь", L"день", L"рука", L"раз", L"работа", L"слово",
+	L"место", L"лицо", L"друг", L"глаз", L"вопрос", L"дом", L"сторона", L"страна", L"мир", L"случай"
+};
+
+
+static size_t AppendUtf8(uint8_t* text, wchar_t ch)
+{
+	if (ch < 0x80)
+	{
+		text[0] = (uint8_t)ch;
+		return 1;
+	}
+	if (ch < 0x800)
+	{
+		text[0] = (uint8_t)(0xC0 | (ch >> 6));
+		text[1] = (uint8_t)(0x80 | (ch & 0x3F));
+		return 2;
+	}
+	text[0] = (uint8_t)(0xE0 | (ch >> 12));
+	text[1] = (uint8_t)(0x80 | ((ch >> 6) & 0x3F));
+	text[2] = (uint8_t)(0x80 | (ch & 0x3F));
+	return 3;
+}
+
+
+static wchar_t Capital(wchar_t ch)
+{
+	return (ch >= L'a' && ch <= L'z') || (ch >= 0x430 && ch <= 0x44F) ? (wchar_t)(ch - 0x20) : ch;
+}
+
+
+// Random sentences of the sample words, capitalized and with punctuation
+static size_t GenerateCorpus(uint8_t* text, size_t size, const wchar_t** words, int wordCount)
+{
+	size_t length = 0;
+	int capital = 1;
+	while (length + 64 < size)
+	{
+		const wchar_t* word = words[rand() % wordCount];
+		for (size_t i = 0; word[i]; i++)
+		{
+			length += AppendUtf8(text + length, capital && i == 0 ? Capital(word[i]) : word[i]);
+		}
+		capital = rand() % 10 == 0;
+		length += AppendUtf8(text + length, capital ? L'.' : rand() % 8 == 0 ? L',' : L' ');
+		if (capital)
+		{
+			length += AppendUtf8(text + length, rand() % 4 == 0 ? L'\n' : L' ');
+		}
+	}
+	return length;
+}
+
+
+// Scores a sample word typed on the keys of its layout, ended with a space
+static int ScoreWord(const Model* model, const KeyLayout* keyLayout, const wchar_t* word, uint32_t* scores)
+{
+	ModelCursor cursor;
+	Model_Reset(&cursor);
+	for (size_t i = 0; word[i]; i++)
+	{
+		int vkCode = 0;
+		while (vkCode < 256 && keyLayout->chars[vkCode][LAYOUT_PLAIN] != (uint16_t)word[i])
+		{
+			vkCode++;
+		}
+		if (vkCode == 256)
+		{
+			return 0;
+		}
+		Model_Step(model, &cursor, (uint8_t)vkCode);
+	}
+	Model_Step(model, &cursor, ' ');
+	memcpy(scores, cursor.score, sizeof(cursor.score));
+	return 1;
+}
+
+
+// Counts synthetic English and Russian corpora on 1 to `threads` threads,
+// checks that every thread count gives the same model and that the model
+// tells the sample words of the two layouts apart.
+int ModelBenchmark(int argc, char** argv)
+{
+	int megabytes = argc > 0 ? atoi(argv[0]) : 256;
+	int maxThreads = argc > 1 ? atoi(argv[1]) : CpuCount();
+	if (megabytes <= 0 || maxThreads <= 0)
+	{
+		PrintUsage();
+		return 1;
+	}
+
+	static KeyLayout keyLayouts[MODEL_MAX_LAYOUTS];
+	static ModelKeymap keymap;
+	const uint32_t layouts[MODEL_MAX_LAYOUTS] = { 0x00000409, 0x00000419 };
+	LoadKeyLayout("00000409", &keyLayouts[0]);
+	LoadKeyLayout("00000419", &keyLayouts[1]);
+	ModelKeymap_Init(&keymap, layouts, keyLayouts, MODEL_MAX_LAYOUTS);
+
+	size_t size = (size_t)megabytes * 500000;
+	size_t table = (size_t)keymap.symbolCount * keymap.symbolCount * keymap.symbolCount;
+	uint8_t* texts[MODEL_MAX_LAYOUTS] = { malloc(size), malloc(size) };
+	uint64_t* reference = calloc(table * MODEL_MAX_LAYOUTS, sizeof(uint64_t));
+	uint64_t* counts = calloc(table * MODEL_MAX_LAYOUTS, sizeof(uint64_t));
+	if (texts[0] == NULL || texts[1] == NULL || reference == NULL || counts == NULL)
+	{
+		printf("Out of memory\n");
+		free(texts[0]);
+		free(texts[1]);
+		free(reference);
+		free(counts);
+		return 1;
+	}
+
+	srand(1);
+	size_t sizes[MODEL_MAX_LAYOUTS] = {
+		GenerateCorpus(texts[0], size, sampleEnglishWords, sizeof(sampleEnglishWords) / sizeof(sampleEnglishWords[0])),
+		GenerateCorpus(texts[1], size, sampleRussianWords, sizeof(sampleRussianWords) / sizeof(sampleRussianWords[0]))
+	};
+	double total = (sizes[0] + sizes[1]) / 1e6;
+	printf("%.1f MB of text, %d CPUs, %u symbols\n", total, CpuCount(), keymap.symbolCount);
+
+	int same = 1;
+	double single = 0;
+	for (int threads = 1; threads <= maxThreads; threads = threads < maxThreads && threads * 2 > maxThreads ? maxThreads : threads * 2)
+	{
+		uint64_t* target = threads == 1 ? reference : counts;
+		memset(target, 0, table * MODEL_MAX_LAYOUTS * sizeof(uint64_t));
+		double start = Now();
+		for (int layout = 0; layout < MODEL_MAX_LAYOUTS; layout++)
+		{
+			CountCorpus(&keymap, layout, texts[layout], sizes[layout], threads, target + table * layout);
+		}
+		double time = Now() - start;
+		single = threads == 1 ? time : single;
+		// A word cut at a slice boundary loses its context there, so a few
+		// trigrams move or go missing, and nothing else may differ
+		uint64_t moved = 0;
+		for (size_t i = 0; i < table * MODEL_MAX_LAYOUTS; i++)
+		{
+			moved += reference[i] > target[i] ? reference[i] - target[i] : target[i] - reference[i];
+		}
+		same = same && moved <= (uint64_t)(threads - 1) * MODEL_MAX_LAYOUTS * 8;
+		printf("%2d threads: %.3f s, %.1f MB/s, %.1f MB/s per thread, %.2fx\n",
+			threads, time, total / time, total / time / threads, single / time);
+	}
+
+	const char* path = "modelbench.model";
+	int ok = Model_Write(&keymap, reference, path);
+	Model model;
+	ok = ok && Model_Open(&model, path);
+	int right = 0, words = 0;
+	for (int layout = 0; ok && layout < MODEL_MAX_LAYOUTS; layout++)
+	{
+		const wchar_t** list = layout == 0 ? sampleEnglishWords : sampleRussianWords;
+		for (int i = 0; i < 40; i++)
+		{
+			uint32_t scores[MODEL_MAX_LAYOUTS];
+			if (ScoreWord(&model, &keyLayouts[layout], list[i], scores))
+			{
+				words++;
+				right += scores[layout] < scores[1 - layout];
+			}
+		}
+	}
+	if (ok)
+	{
+		printf("%d of %d sample words scored lowest in their own layout\n", right, words);
+		Model_Close(&model);
+	}
+	remove(path);
+
+	free(texts[0]);
+	free(texts[1]);
+	free(reference);
+	free(counts);
+	return ok && same && right == words ? 0 : 1;
+}
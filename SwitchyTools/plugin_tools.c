@@ -0,0 +1,63 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include "../Switchy/plugins.h"
+#include "tools.h"
+#include "../Switchy/checked.h"
+
+
+// Feeds actions to the plugins at one per millisecond the way the hook does
+// and shows what each plugin received and how long posting took
+int PluginCheck(int argc, char** argv)
+{
+	if (argc < 2)
+	{
+		PrintUsage();
+		return 1;
+	}
+
+	static PluginHost host;
+	char error[PLUGIN_MAX_PATH + 64];
+	uint32_t budget = (uint32_t)atoi(argv[0]);
+	for (int i = 1; i < argc; i++)
+	{
+		if (!Plugins_Load(&host, argv[i], budget, error, sizeof(error)))
+		{
+			printf("%s\n", error);
+			Plugins_Free(&host);
+			return 1;
+		}
+	}
+
+	const int count = 1000;
+	double worst = 0, total = 0;
+	for (int i = 0; i < count; i++)
+	{
+		double start = Now();
+		Plugins_Post(&host, SWITCHY_ACTION_SWITCH + i % SWITCHY_ACTION_LAYOUT, i % 2 ? 0x00000409 : 0x00000419);
+		double time = Now() - start;
+		total += time;
+		worst = time > worst ? time : worst;
+		while (Now() - start < 0.001);
+	}
+
+	// Let the workers deliver or discard what is still queued; a plugin
+	// stuck in a call keeps its queue
+	double deadline = Now() + 2.0;
+	for (int i = 0; i < host.count; i++)
+	{
+		PluginSlot* slot = &host.slots[i];
+		while (slot->tail != slot->head && Now() < deadline);
+	}
+
+	printf("%d actions posted: %.2f us average, %.2f us worst\n", count, total / count * 1e6, worst * 1e6);
+	for (int i = 0; i < host.count; i++)
+	{
+		PluginSlot* slot = &host.slots[i];
+		// Every action is delivered, dropped when posted, discarded from the
+		// queue once the plugin is disabled, or still queued behind a stuck call
+		printf("%s: %u delivered, %u dropped, %u discarded, %u still queued, %u overruns%s\n", slot->plugin->name,
+			slot->delivered, slot->dropped, slot->discarded, slot->head - slot->tail, slot->overruns, slot->disabled ? ", disabled" : "");
+	}
+	Plugins_Free(&host);
+	return 0;
+}
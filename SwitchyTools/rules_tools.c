@@ -0,0 +1,159 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "../Switchy/rules.h"
+#include "tools.h"
+#include "../Switchy/checked.h"
+
+
+// Random lowercase ASCII word of 3 to 8 letters
+static void RandomWord(char* word)
+{
+	int length = 3 + rand() % 6;
+	for (int i = 0; i < length; i++)
+	{
+		word[i] = (char)('a' + rand() % 26);
+	}
+	word[length] = 0;
+}
+
+
+// Case-insensitive ASCII substring search, the reference for the automaton
+static int ContainsWord(const uint16_t* text, const char* word)
+{
+	size_t length = strlen(word);
+	for (size_t i = 0; text[i]; i++)
+	{
+		size_t k = 0;
+		while (k < length && text[i + k] && (text[i + k] | 0x20) == (uint16_t)word[k])
+		{
+			k++;
+		}
+		if (k == length)
+		{
+			return 1;
+		}
+	}
+	return 0;
+}
+
+
+// Compiles thousands of random rules, checks the automaton against plain
+// substring search and measures matching and cached lookups.
+int RulesBenchmark(int argc, char** argv)
+{
+	enum { WINDOWS = 4096, TEXT = 64, LOOKUPS = 1 << 24 };
+	static const char* fieldNames[RULE_FIELDS] = { "process", "class", "title" };
+	int count = argc > 0 ? atoi(argv[0]) : 5000;
+	char (*words)[RULE_FIELDS][16] = calloc((size_t)count, sizeof(*words));
+	char* config = malloc((size_t)count * 80 + 1);
+	static uint16_t texts[WINDOWS][RULE_FIELDS][TEXT];
+	if (words == NULL || config == NULL)
+	{
+		printf("Out of memory\n");
+		return 1;
+	}
+
+	// Each rule has one or two conditions on different fields
+	srand(1);
+	char* out = config;
+	for (int i = 0; i < count; i++)
+	{
+		int first = rand() % RULE_FIELDS;
+		int second = rand() % 4 == 0 ? (first + 1) % RULE_FIELDS : -1;
+		RandomWord(words[i][first]);
+		out += sprintf(out, "%s %s", fieldNames[first], words[i][first]);
+		if (second >= 0)
+		{
+			RandomWord(words[i][second]);
+			out += sprintf(out, " %s \"%s\"", fieldNames[second], words[i][second]);
+		}
+		out += sprintf(out, i % 2 ? " = disable\n" : " = layout 00000409\n");
+	}
+
+	static RuleSet set;
+	char error[256];
+	double start = Now();
+	if (!Rules_Compile(&set, config, error, sizeof(error)))
+	{
+		printf("%s\n", error);
+		return 1;
+	}
+	double compiled = Now() - start;
+	size_t memory = (size_t)set.stateCount * set.symbolCount * sizeof(uint32_t) +
+		(set.outputStart[set.stateCount] + set.stateCount) * sizeof(uint32_t);
+	printf("%d rules, %u patterns, %u states, %u symbols, %.1f MB, compiled in %.1f ms\n",
+		count, set.patternCount, set.stateCount, set.symbolCount, memory / 1048576.0, compiled * 1e3);
+
+	// Windows are random text, every fourth one embeds the words of a rule
+	for (int w = 0; w < WINDOWS; w++)
+	{
+		int rule = w % 4 == 0 ? rand() % count : -1;
+		for (int field = 0; field < RULE_FIELDS; field++)
+		{
+			int length = 16 + rand() % (TEXT - 32);
+			for (int i = 0; i < length; i++)
+			{
+				texts[w][field][i] = (uint16_t)(rand() % 8 == 0 ? ' ' : (rand() % 2 ? 'a' : 'A') + rand() % 26);
+			}
+			texts[w][field][length] = 0;
+			if (rule >= 0 && words[rule][field][0])
+			{
+				int at = rand() % (length - 8);
+				for (int i = 0; words[rule][field][i]; i++)
+				{
+					texts[w][field][at + i] = (uint16_t)(words[rule][field][i] - (rand() % 2 ? 0x20 : 0));
+				}
+			}
+		}
+	}
+
+	uint32_t* results = malloc(WINDOWS * sizeof(uint32_t));
+	start = Now();
+	for (int w = 0; w < WINDOWS; w++)
+	{
+		RuleWindow window = { texts[w][RULE_FIELD_PROCESS], texts[w][RULE_FIELD_CLASS], texts[w][RULE_FIELD_TITLE], 0 };
+		results[w] = Rules_Match(&set, &window);
+	}
+	double matched = (Now() - start) / WINDOWS;
+
+	int mismatches = 0, hits = 0;
+	for (int w = 0; w < WINDOWS; w++)
+	{
+		uint32_t expected = RULE_NONE;
+		for (int i = 0; i < count && expected == RULE_NONE; i++)
+		{
+			int all = 1;
+			for (int field = 0; field < RULE_FIELDS; field++)
+			{
+				all &= !words[i][field][0] || ContainsWord(texts[w][field], words[i][field]);
+			}
+			expected = all ? (uint32_t)i : RULE_NONE;
+		}
+		mismatches += results[w] != expected;
+		hits += expected != RULE_NONE;
+	}
+	printf("%d windows, %d match a rule, %.2f us per window, %s\n",
+		WINDOWS, hits, matched * 1e6, mismatches ? "RESULTS DIFFER" : "results match");
+
+	// Cached decisions by window handle, as looked up on every key event
+	static RuleCache cache;
+	for (int w = 0; w < RULE_CACHE_SIZE / 4; w++)
+	{
+		RuleCache_Store(&cache, 0x10000 + (uintptr_t)w * 0x1A2, results[w]);
+	}
+	uint32_t rule, found = 0;
+	start = Now();
+	for (int i = 0; i < LOOKUPS; i++)
+	{
+		found += RuleCache_Lookup(&cache, 0x10000 + (uintptr_t)(i % (RULE_CACHE_SIZE / 4)) * 0x1A2, &rule);
+	}
+	double looked = Now() - start;
+	printf("%d cached lookups, %u hits, %.1f ns per lookup\n", LOOKUPS, found, looked * 1e9 / LOOKUPS);
+
+	Rules_Free(&set);
+	free(results);
+	free(words);
+	free(config);
+	return mismatches ? 1 : 0;
+}
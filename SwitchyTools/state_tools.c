@@ -0,0 +1,131 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "../Switchy/chatter.h"
+#include "../Switchy/convert.h"
+#include "../Switchy/shared.h"
+#include "../Switchy/state.h"
+#include "tools.h"
+#include "../Switchy/checked.h"
+
+
+// Saves a state snapshot, measures restore time and checks that a damaged
+// file is rejected.
+int StateBenchmark(int argc, char** argv)
+{
+	if (argc < 1)
+	{
+		PrintUsage();
+		return 1;
+	}
+
+	// A key that bounces within 3 ms of every release learns a threshold
+	// of its own, which must survive the round trip. It is pressed long
+	// enough for its counts to be halved, odd ones included.
+	static ChatterFilter learned, restored;
+	static StateData saved, loaded;
+	Chatter_Init(&learned);
+	uint32_t time = 0;
+	for (int i = 0; i < CHATTER_HISTORY; i++)
+	{
+		Chatter_OnKey(&learned, 'E', 1, time += 200);
+		Chatter_OnKey(&learned, 'E', 0, time += 80);
+		Chatter_OnKey(&learned, 'E', 1, time += 1 + i % 3);
+		Chatter_OnKey(&learned, 'E', 0, time += 1);
+	}
+	uint32_t sequence;
+	saved.enabled = 1;
+	Chatter_Save(&learned, saved.chatter);
+	double start = Now();
+	if (!State_Save(argv[0], &saved, 42))
+	{
+		printf("Cannot write \"%s\"\n", argv[0]);
+		return 1;
+	}
+	double written = Now() - start;
+
+	enum { LOADS = 1000 };
+	int valid = 1;
+	start = Now();
+	for (int i = 0; i < LOADS; i++)
+	{
+		valid &= State_Load(argv[0], &loaded, &sequence);
+	}
+	double elapsed = (Now() - start) / LOADS;
+	valid &= memcmp(&saved, &loaded, sizeof(saved)) == 0 && sequence == 42;
+	Chatter_Init(&restored);
+	Chatter_Restore(&restored, loaded.chatter);
+	valid &= Chatter_Threshold(&restored, 'E') == Chatter_Threshold(&learned, 'E') &&
+		Chatter_Threshold(&restored, 'E') != Chatter_Threshold(&restored, 'A') &&
+		restored.keys['E'].samples == learned.keys['E'].samples;
+	printf("%zu bytes, saved in %.1f us, restored in %.1f us, %s (E threshold %u ms, %u samples)\n", sizeof(StateFile),
+		written * 1e6, elapsed * 1e6, valid ? "contents match" : "CONTENTS DIFFER", Chatter_Threshold(&restored, 'E'),
+		restored.keys['E'].samples);
+
+	// Flip one byte of the sequence, then one of the payload: the checksum
+	// must catch both
+	int rejected = 1;
+	long offsets[2] = { (long)offsetof(StateFile, sequence), (long)offsetof(StateFile, data) };
+	for (int i = 0; i < 2; i++)
+	{
+		FILE* file = fopen(argv[0], "r+b");
+		if (file == NULL || fseek(file, offsets[i], SEEK_SET) != 0 || fputc(0x5A, file) == EOF)
+		{
+			printf("Cannot modify \"%s\"\n", argv[0]);
+			return 1;
+		}
+		fclose(file);
+		rejected &= !State_Load(argv[0], &loaded, &sequence);
+		State_Save(argv[0], &saved, 42);
+	}
+	printf("Damaged sequence and payload %s\n", rejected ? "rejected" : "ACCEPTED");
+	remove(argv[0]);
+	return valid && rejected ? 0 : 1;
+}
+
+
+// Builds the conversion tables into a shared section once, then maps them
+// as further instances would and compares the cost and the contents.
+int SharedBenchmark(int argc, char** argv)
+{
+	typedef struct {
+		ConvertTable forward;
+		ConvertTable backward;
+	} Tables;
+
+	int instances = argc > 0 ? atoi(argv[0]) : 100;
+	KeyLayout en, ru;
+	SampleLayouts(&en, &ru);
+
+	char name[64];
+	snprintf(name, sizeof(name), "Switchy.Bench.%ld", (long)time(NULL));
+	SharedSection owner;
+	double start = Now();
+	if (!Shared_Open(&owner, name, sizeof(Tables)) || !owner.created)
+	{
+		printf("Cannot create shared section \"%s\"\n", name);
+		return 1;
+	}
+	Tables* tables = (Tables*)owner.data;
+	Convert_Build(&tables->forward, &ru, &en);
+	Convert_Build(&tables->backward, &en, &ru);
+	Shared_Publish(&owner);
+	double built = Now() - start;
+
+	int valid = 1;
+	start = Now();
+	for (int i = 0; i < instances; i++)
+	{
+		SharedSection section;
+		valid &= Shared_Open(&section, name, sizeof(Tables)) && !section.created &&
+			Shared_WaitReady(&section, 1000) && memcmp(section.data, tables, sizeof(Tables)) == 0;
+		Shared_Close(&section);
+	}
+	double mapped = (Now() - start) / (instances > 0 ? instances : 1);
+
+	printf("%zu bytes of tables, built and published in %.1f us, mapped read-only in %.1f us, %s\n",
+		sizeof(Tables), built * 1e6, mapped * 1e6, valid ? "contents match" : "CONTENTS DIFFER");
+	Shared_Close(&owner);
+	return valid ? 0 : 1;
+}
@@ -0,0 +1,52 @@
+#pragma once
+#include <stddef.h>
+#include <stdint.h>
+#include <wchar.h>
+#include "../Switchy/layout.h"
+
+// What the SwitchyTools subcommands share. Each group of tools has a source
+// file of its own; main.c dispatches to them.
+
+#define SAMPLE_KEYS 34
+
+void PrintUsage();
+double Now();
+int CpuCount();
+
+// Built-in English and Russian letter keys for systems without keyboard
+// layouts: the characters typed without Shift, then with it, and the
+// virtual keys that type them
+extern const wchar_t sampleEnglish[];
+extern const wchar_t sampleRussian[];
+extern const uint8_t sampleKeys[SAMPLE_KEYS];
+int LoadKeyLayout(const char* id, KeyLayout* keyLayout);
+void SampleLayouts(KeyLayout* en, KeyLayout* ru);
+
+// dict_tools.c
+int CompileDictionary(int argc, char** argv);
+int DictionaryStats(int argc, char** argv);
+// convert_tools.c
+int ConversionBenchmark(int argc, char** argv);
+int OneShotCheck(int argc, char** argv);
+// macro_tools.c
+int MacroBenchmark(int argc, char** argv);
+int MacroCheck(int argc, char** argv);
+// state_tools.c
+int StateBenchmark(int argc, char** argv);
+int SharedBenchmark(int argc, char** argv);
+// rules_tools.c
+int RulesBenchmark(int argc, char** argv);
+// device_tools.c
+int DeviceCheck(int argc, char** argv);
+int ChatterCheck(int argc, char** argv);
+// hook_tools.c
+int HookBenchmark(int argc, char** argv);
+int X11Benchmark(int argc, char** argv);
+int HotPathCheck(int argc, char** argv);
+// plugin_tools.c
+int PluginCheck(int argc, char** argv);
+// model_tools.c
+int BuildModel(int argc, char** argv);
+int ModelBenchmark(int argc, char** argv);
+// fuzz_tools.c
+int HookFuzz(int argc, char** argv);